@@ -1,7 +1,12 @@
 /**
  * A sample class extension for the server that
  * can asynchronously accepts clients, C++ 11 style.
- * 
+ *
+ * The server and its clients are watched by an event loop on a single
+ * thread, and every accepted client and received line is handed to a
+ * work-stealing thread pool, so the number of threads stays bounded by
+ * the number of cores however many clients connect.
+ *
  * Compile with: g++ async-server.cpp -pthread -std=c++11 -o async-server
  */
 
@@ -9,64 +14,245 @@
 #include <cstdio>			// std::printf
 #include <memory>			// std::shared_ptr
 #include <thread>			// std::thread
+#include <mutex>			// std::mutex, std::lock_guard
+#include <condition_variable>	// std::condition_variable
+#include <atomic>			// std::atomic
+#include <deque>			// std::deque
 #include <vector>			// std::vector
 #include <functional>		// std::function
+#include <sys/socket.h>		// recv()
 #include "../net_server.hpp"	// net::server, net::socket, net::socket_exception
-#include "../net_socketstream.hpp" // net::isocketstream
+#include "../net_event_loop.hpp"	// net::event_loop
+#include "../net_thread_pool.hpp"	// net::thread_pool
 
 using namespace std;
 
 struct async_server : public net::server {
 
-	async_server(unsigned short port): net::server(port) {}
+	/**
+	 * @brief      the lines received from a client that were not handled yet
+	 */
+
+	struct line_reader {
+		net::socket socket;
+		function<void(const string&)> line;
+		function<void()> closed;
+		mutex lock;			// guards the fields below, but is never held while a callback runs
+		string received;	// bytes received after the last complete line
+		bool eof;			// whether the client has disconnected
+		bool notified;		// whether closed() was called
+		bool delivering;	// whether a pool thread is calling the callbacks, which keeps the lines of a client in order
+	};
+
+	// the pool that runs the callbacks
+	net::thread_pool& pool;
+
+	// watches the server and its clients on the io thread
+	net::event_loop loop;
+
+	// work for the io thread that was requested from other threads, guarded by lock
+	mutex lock;
+	vector<function<void()> > requests;
+
+	// the callbacks waiting for a client to be accepted, only touched on the io thread
+	deque<function<void(net::socket)> > accepts;
+
+	atomic<bool> running;
+	thread io;
+
+	async_server(unsigned short port, net::thread_pool& pool): net::server(port), pool(pool), running(true) {
+		set_blocking(false);
+		loop.add(*this, [this] {accept_pending();});
+		io = thread([this] {
+			while (running) {
+				loop.poll();
+				run_requests();
+			}
+		});
+	}
+
+	~async_server() {
+		running = false;
+		loop.wake();
+		io.join();
+	}
 
 	/**
-	 * @brief      asynchronously accepts a new socket using C++ 11 threading.
-	 * @param[in]  done  a function that is called when a socket was accepted into the server
-	 * @return     std::thread referring to the lightweight process thread that has executed the accept()
+	 * @brief      asynchronously accepts a new socket using the thread pool.
+	 * @param[in]  done  a function that is called on the thread pool when a socket was accepted into the server
 	 * @since      C++ 11
 	 */
-	
-	thread accept(function<void(net::socket)> done) {
-		return thread([this, &done] {done(net::server::accept());});
+
+	void accept(function<void(net::socket)> done) {
+		// done is copied into the request, so it outlives the caller's argument
+		request([this, done] {
+			accepts.push_back(done);
+			accept_pending();
+		});
+	}
+
+	/**
+	 * @brief      asynchronously receives lines from a socket using the thread pool.
+	 * @param[in]  socket  the socket to read from
+	 * @param[in]  line    a function that is called on the thread pool for every line, in order
+	 * @param[in]  closed  a function that is called on the thread pool after the last line, once the socket disconnects
+	 */
+
+	void read_lines(net::socket socket, function<void(const string&)> line, function<void()> closed) {
+		shared_ptr<line_reader> reader(new line_reader());
+		reader->socket = socket;
+		reader->line = line;
+		reader->closed = closed;
+		reader->eof = reader->notified = reader->delivering = false;
+		request([this, reader] {
+			reader->socket.set_blocking(false);
+			loop.add(reader->socket, [this, reader] {receive(reader);});
+		});
+	}
+
+private:
+
+	// runs a function on the io thread, which owns the event loop
+	void request(function<void()> work) {
+		{
+			lock_guard<mutex> guard(lock);
+			requests.push_back(work);
+		}
+		loop.wake();
+	}
+
+	// runs the work requested from other threads
+	void run_requests() {
+		vector<function<void()> > work;
+		{
+			lock_guard<mutex> guard(lock);
+			work.swap(requests);
+		}
+		for (size_t i = 0; i < work.size(); ++i)
+			work[i]();
+	}
+
+	// accepts pending clients for as long as there are callbacks waiting for them
+	void accept_pending() {
+		while (!accepts.empty()) {
+			net::socket socket;
+			try {socket = try_accept();}
+			catch (net::socket_exception& ex) {
+				cerr << ex.what() << endl;
+				if (ex.code == EMFILE || ex.code == ENFILE)
+					continue;
+				return;
+			}
+			if (!socket) return;
+			function<void(net::socket)> done = accepts.front();
+			accepts.pop_front();
+			pool.submit([done, socket] {done(socket);});
+		}
+	}
+
+	// receives what a client has sent on the io thread, then hands the lines to the pool
+	void receive(shared_ptr<line_reader> reader) {
+		char buffer[4096];
+		ssize_t received;
+		while ((received = recv(reader->socket, buffer, sizeof buffer, MSG_DONTWAIT)) > 0) {
+			lock_guard<mutex> guard(reader->lock);
+			reader->received.append(buffer, received);
+		}
+		if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			loop.remove(reader->socket);
+			lock_guard<mutex> guard(reader->lock);
+			reader->eof = true;
+		}
+		pool.submit([reader] {deliver(reader);});
+	}
+
+	// calls the line callback for every complete line, and the closed callback once the client is gone
+	static void deliver(shared_ptr<line_reader> reader) {
+		{
+			lock_guard<mutex> guard(reader->lock);
+			if (reader->delivering)
+				return; // the thread already delivering picks up the new lines as well
+			reader->delivering = true;
+		}
+		while (true) {
+			// take the complete lines under the lock, so the io thread can keep receiving while they are handled
+			vector<string> lines;
+			bool closing = false;
+			{
+				lock_guard<mutex> guard(reader->lock);
+				size_t start = 0, end;
+				while ((end = reader->received.find('\n', start)) != string::npos) {
+					lines.push_back(reader->received.substr(start, end - start));
+					start = end + 1;
+				}
+				reader->received.erase(0, start);
+				if (lines.empty()) {
+					if (!reader->eof || reader->notified) {
+						reader->delivering = false;
+						return;
+					}
+					reader->notified = closing = true;
+				}
+			}
+			for (size_t i = 0; i < lines.size(); ++i)
+				reader->line(lines[i]);
+			if (closing) {
+				// delivering stays set, since nothing comes after closed()
+				reader->socket.close();
+				reader->closed();
+				return;
+			}
+		}
 	}
 
 };
 
 int main() {
+	// run the callbacks on one thread per core
+	net::thread_pool pool;
+
 	// setup server at port 4000
-	async_server server(4000);
+	async_server server(4000, pool);
 	printf("Server is listening at %s:%d\n", server.ip(), server.port());
 
-	
+	// counts the clients that have disconnected
+	mutex lock;
+	condition_variable disconnected;
+	int left = 0;
+
 	// asynchronously listen to four clients
-	thread threads[4];
-	for (auto& thread_ptr : threads) {
+	for (int i = 0; i < 4; ++i) {
 
 		printf("Accepting a client...\n"); // will be printed 4 times
-		            
-		// accept the thread
-		thread_ptr = server.accept([] (net::socket socket) {
-			
+
+		// accept the client on the thread pool
+		server.accept([&] (net::socket socket) {
+
 			printf("Thread has accepted client [sockfd=%d]\n", (int) socket);
-			
-			// wrap this socket with a stream
-			net::isocketstream oss(socket);
-			
-			// receive some messages from the client socket
-			string message;
-			while (getline(oss, message))
-				printf("[%d]: %s\n", (int) socket, message.c_str());
+			int sockfd = socket;
 
-			printf("Client [%d] has disconnected\n", (int) socket);
+			// receive some messages from the client socket
+			server.read_lines(socket, [sockfd] (const string& message) {
+				printf("[%d]: %s\n", sockfd, message.c_str());
+			}, [&, sockfd] {
+				printf("Client [%d] has disconnected\n", sockfd);
+				lock_guard<mutex> guard(lock);
+				++left;
+				disconnected.notify_one();
+			});
 
 		});
 
 	}
 
-	// wait for all threads to finish, ala daemon
-	for (auto& thread_ptr : threads)
-		thread_ptr.join();
+	// wait for all clients to disconnect, ala daemon
+	{
+		unique_lock<mutex> guard(lock);
+		disconnected.wait(guard, [&] {return left == 4;});
+	}
 
+	net::thread_pool::statistics stats = pool.stats();
+	printf("%lu tasks on %lu threads (%lu stolen), waited %.1fus on average, p99 under %.0fus\n",
+		stats.executed, (unsigned long) pool.size(), stats.stolen, stats.mean_latency, stats.percentile(0.99));
 	return 0;
-}
\ No newline at end of file
+}
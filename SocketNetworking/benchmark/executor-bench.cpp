@@ -0,0 +1,95 @@
+/**
+ * Compares the io_uring and epoll executors on loopback by running an
+ * echo server on each of them, and counting the system calls the server
+ * makes per echoed message. Many connections are kept busy at once, so
+ * that the io_uring executor can batch their operations.
+ *
+ * Compile with: g++ executor-bench.cpp -std=c++11 -O2 -pthread -o executor-bench
+ * Usage: ./executor-bench [connections] [rounds] [message_bytes]
+ */
+
+#include <cstdio>				// std::printf()
+#include <cstdlib>				// std::atoi()
+#include <string>				// std::string
+#include <vector>				// std::vector
+#include <memory>				// std::unique_ptr, std::shared_ptr
+#include <thread>				// std::thread
+#include <chrono>				// std::chrono::steady_clock
+#include "../net_client.hpp"	// net::client
+#include "../net_server.hpp"	// net::server
+#include "../net_executor.hpp"	// net::executor, net::uring_executor, net::epoll_executor
+
+using namespace std;
+
+// a connection served by the echo server
+struct connection {
+	net::client client;
+	string pending;	// the bytes being echoed back
+};
+
+// reads from a connection, and echoes what was read before reading again
+void echo(net::executor& exec, shared_ptr<connection> conn) {
+	exec.async_read(conn->client, [&exec, conn] (const char* data, ssize_t bytes) {
+		if (bytes <= 0) {
+			conn->client.close();
+			return;
+		}
+		conn->pending.assign(data, bytes);
+		exec.async_send(conn->client, conn->pending.data(), conn->pending.size(), [&exec, conn] (ssize_t sent) {
+			if (sent < 0) conn->client.close();
+			else echo(exec, conn);
+		});
+	});
+}
+
+// runs an echo server for a number of connections until they all disconnect
+void serve(net::executor& exec, net::server& server, int connections) {
+	for (int i = 0; i < connections; ++i)
+		exec.async_accept(server, [&exec] (net::socket sock) {
+			if (sock) echo(exec, make_shared<connection>(connection {sock, string()}));
+		});
+	exec.run();
+}
+
+// measures one executor, and prints a line of results
+void measure(net::executor* exec, unsigned short port, int connections, int rounds, size_t bytes) {
+	net::server server(port, connections);
+	unsigned long setup = exec->syscalls();
+	thread worker([&] {serve(*exec, server, connections);});
+	vector<net::client> clients;
+	for (int i = 0; i < connections; ++i)
+		clients.push_back(net::client("127.0.0.1", port));
+	string message(bytes, 'x');
+	vector<char> reply(bytes);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round) {
+		// keep every connection busy at once, then collect the echoes
+		for (int i = 0; i < connections; ++i)
+			clients[i].send(message.data(), bytes);
+		for (int i = 0; i < connections; ++i)
+			clients[i].read(reply.data(), bytes);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	for (int i = 0; i < connections; ++i)
+		clients[i].close();
+	worker.join();
+	double messages = (double) connections * rounds;
+	printf("%-9s %11.0f msg/s %9.3f syscalls/msg\n", exec->name(), messages / seconds, (exec->syscalls() - setup) / messages);
+}
+
+int main(int argc, char* argv[]) {
+	int connections = argc > 1 ? atoi(argv[1]) : 64;
+	int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+	size_t bytes = argc > 3 ? atoi(argv[3]) : 64;
+	printf("%d connections, %d rounds, %zu byte messages\n", connections, rounds, bytes);
+	{
+		unique_ptr<net::executor> exec(new net::epoll_executor());
+		measure(exec.get(), 4100, connections, rounds, bytes);
+	}
+	unique_ptr<net::executor> exec = net::make_executor();
+	if (string(exec->name()) == "epoll")
+		printf("io_uring is not available on this kernel\n");
+	else
+		measure(exec.get(), 4101, connections, rounds, bytes);
+	return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * Measures the round-trip latency of small chat-like messages on loopback,
+ * with the default socket options and with socket_profile::low_latency().
+ * Every reply is written like the chat servers write theirs, as a status
+ * flag followed by a string, so the second write of a reply meets Nagle's
+ * algorithm and the delayed acknowledgement of the first one.
+ *
+ * Compile with: g++ latency-bench.cpp -std=c++11 -O2 -pthread -o latency-bench
+ * Usage: ./latency-bench [rounds] [message_bytes]
+ */
+
+#include <cstdio>				// std::printf()
+#include <cstdlib>				// std::atoi()
+#include <string>				// std::string
+#include <vector>				// std::vector
+#include <algorithm>			// std::sort()
+#include <thread>				// std::thread
+#include <chrono>				// std::chrono::steady_clock
+#include "../net_client.hpp"	// net::client
+#include "../net_server.hpp"	// net::server
+
+using namespace std;
+
+// replies to every message of a connection until it disconnects
+void serve(net::server& server, const net::socket_profile& profile) {
+	net::client client = server.accept();
+	client.apply(profile);
+	client.buffer();
+	string message;
+	while (client.read(message))
+		client.send(true).send(message);
+}
+
+// gets a percentile of sorted samples
+double percentile(const vector<double>& sorted, double fraction) {
+	size_t index = fraction * (sorted.size() - 1) + 0.5;
+	return sorted[index];
+}
+
+// measures one profile, and prints a line of results
+void measure(const char* name, const net::socket_profile& profile, unsigned short port, int rounds, size_t bytes) {
+	net::server server(port, 1);
+	thread worker([&] {serve(server, profile);});
+	net::client client("127.0.0.1", port);
+	client.apply(profile);
+	client.buffer();
+	string message(bytes, 'x'), reply;
+	vector<double> samples;
+	for (int i = -rounds / 10; i < rounds; ++i) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		client.send(message);
+		client.read<bool>();
+		client.read(reply);
+		double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+		if (i >= 0) samples.push_back(micros); // the first tenth warms up the connection
+	}
+	client.close();
+	worker.join();
+	sort(samples.begin(), samples.end());
+	printf("%-12s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+		percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99), percentile(samples, 0.999), samples.back());
+}
+
+int main(int argc, char* argv[]) {
+	int rounds = argc > 1 ? atoi(argv[1]) : 500;
+	size_t bytes = argc > 2 ? atoi(argv[2]) : 64;
+	if (rounds < 1) {
+		printf("Format: %s [rounds] [message_bytes]\n", argv[0]);
+		return 0;
+	}
+	printf("%d round trips of %lu byte messages, in microseconds\n", rounds, (unsigned long) bytes);
+	printf("%-12s %10s %10s %10s %10s %10s\n", "profile", "p50", "p90", "p99", "p99.9", "max");
+	measure("default", net::socket_profile(), 4110, rounds, bytes);
+	measure("low-latency", net::socket_profile::low_latency(), 4111, rounds, bytes);
+}
@@ -0,0 +1,228 @@
+/**
+ * Measures net::client::send()/read() and net::osocketstream/isocketstream
+ * on loopback across message sizes from 8 bytes to 16 megabytes and from
+ * 1 to 1024 concurrent connections, so the cost of a change to either one
+ * can be tracked over time.
+ *
+ * Every connection has its own thread on each side. A client sends a
+ * message, the server reads all of it and sends it back, and the client
+ * times the round trip. Each run reports throughput, round trips per
+ * second, the p50/p99/p99.9 round-trip latency, and the CPU time and
+ * context switches per round trip from a getrusage() delta of the whole
+ * process, which counts the server side as well. getrusage() has no count
+ * of system calls; the system CPU time per round trip is the closest cost
+ * it reports.
+ *
+ * Each run gets a fixed budget of round trips and of bytes, split across
+ * its connections, so the large runs do not take minutes. Runs whose
+ * buffers would not fit in the memory limit are skipped. Results are
+ * printed as a table and written as CSV to the output file, one line per
+ * run.
+ *
+ * Compile with: g++ net-bench.cpp -std=c++11 -O2 -pthread -o net-bench
+ * Usage: ./net-bench [output.csv] [max_message_bytes] [max_connections] [round_trips] [budget_megabytes]
+ */
+
+#include <cstdio>					// std::printf(), std::fopen(), std::fprintf()
+#include <cstdlib>					// std::atoi(), std::atol()
+#include <string>					// std::string
+#include <vector>					// std::vector
+#include <algorithm>				// std::sort(), std::min(), std::max()
+#include <thread>					// std::thread
+#include <mutex>					// std::mutex, std::lock_guard
+#include <condition_variable>		// std::condition_variable
+#include <chrono>					// std::chrono::steady_clock
+#include <sys/time.h>				// timeval
+#include <sys/resource.h>			// getrusage(), getrlimit(), setrlimit()
+#include "../net_client.hpp"		// net::client
+#include "../net_server.hpp"		// net::server
+#include "../net_socketstream.hpp"	// net::isocketstream, net::osocketstream
+
+using namespace std;
+
+// how the bytes of a message are sent and received
+enum transport {CLIENT, STREAM};
+
+// the port of every run; the server reuses the address, so runs can follow each other
+const unsigned short PORT = 4130;
+
+// lets every client thread start at once, after all of them have connected
+struct start_gate {
+	mutex lock;
+	condition_variable opened;
+	bool open;
+	start_gate(): open(false) {}
+	void wait() {
+		unique_lock<mutex> guard(lock);
+		opened.wait(guard, [this] {return open;});
+	}
+	void release() {
+		lock_guard<mutex> guard(lock);
+		open = true;
+		opened.notify_all();
+	}
+};
+
+// the results of one run
+struct result {
+	double seconds;
+	vector<double> samples;	// the round-trip latencies, in microseconds
+	double user_micros, system_micros, switches;
+};
+
+// reads and echoes every message of a connection until it disconnects
+void serve(net::socket sock, transport kind, size_t bytes) {
+	vector<char> message(bytes);
+	if (kind == CLIENT) {
+		net::client client = sock;
+		while (client.read(message.data(), bytes))
+			client.send(message.data(), bytes);
+	} else {
+		net::isocketstream in(sock);
+		net::osocketstream out(sock);
+		while (in.read(message.data(), bytes))
+			out.write(message.data(), bytes).flush();
+	}
+}
+
+// sends a number of messages over a connection, and records the round trip of each of them
+void talk(net::client& client, transport kind, size_t bytes, int rounds, start_gate& gate, vector<double>& samples) {
+	vector<char> message(bytes, 'x');
+	samples.reserve(rounds);
+	if (kind == CLIENT) {
+		gate.wait();
+		for (int i = 0; i < rounds; ++i) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			client.send(message.data(), bytes);
+			client.read(message.data(), bytes);
+			samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+		}
+	} else {
+		net::isocketstream in(client);
+		net::osocketstream out(client);
+		gate.wait();
+		for (int i = 0; i < rounds; ++i) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			out.write(message.data(), bytes).flush();
+			in.read(message.data(), bytes);
+			samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+		}
+	}
+}
+
+// gets the number of microseconds in a timeval
+double micros(const timeval& time) {
+	return time.tv_sec * 1e6 + time.tv_usec;
+}
+
+// runs one transport, message size and number of connections
+result measure(transport kind, size_t bytes, int connections, int rounds) {
+	net::server server(PORT, connections);
+	vector<thread> servers;
+	thread acceptor([&] {
+		for (int i = 0; i < connections; ++i) {
+			net::socket sock = server.accept();
+			sock.set<net::tcp_nodelay>(true);
+			servers.push_back(thread(serve, sock, kind, bytes));
+		}
+	});
+	vector<net::client> clients;
+	for (int i = 0; i < connections; ++i) {
+		clients.push_back(net::client("127.0.0.1", PORT));
+		clients.back().set<net::tcp_nodelay>(true);
+	}
+	acceptor.join();
+	start_gate gate;
+	vector<vector<double> > samples(connections);
+	vector<thread> talkers;
+	for (int i = 0; i < connections; ++i)
+		talkers.push_back(thread(talk, ref(clients[i]), kind, bytes, rounds, ref(gate), ref(samples[i])));
+	// every thread exists and waits at the gate, so only the round trips are measured
+	result run;
+	struct rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	gate.release();
+	for (int i = 0; i < connections; ++i)
+		talkers[i].join();
+	run.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	getrusage(RUSAGE_SELF, &after);
+	for (int i = 0; i < connections; ++i)
+		clients[i].close();
+	for (int i = 0; i < connections; ++i)
+		servers[i].join();
+	for (int i = 0; i < connections; ++i)
+		run.samples.insert(run.samples.end(), samples[i].begin(), samples[i].end());
+	sort(run.samples.begin(), run.samples.end());
+	run.user_micros = micros(after.ru_utime) - micros(before.ru_utime);
+	run.system_micros = micros(after.ru_stime) - micros(before.ru_stime);
+	run.switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+	return run;
+}
+
+// gets a percentile of sorted samples
+double percentile(const vector<double>& sorted, double fraction) {
+	size_t index = fraction * (sorted.size() - 1) + 0.5;
+	return sorted[index];
+}
+
+int main(int argc, char* argv[]) {
+	const char* output = argc > 1 ? argv[1] : "net-bench.csv";
+	size_t max_bytes = argc > 2 ? atol(argv[2]) : 16 << 20;
+	int max_connections = argc > 3 ? atoi(argv[3]) : 1024;
+	long round_trips = argc > 4 ? atol(argv[4]) : 20000;
+	size_t budget = (argc > 5 ? atol(argv[5]) : 256) << 20;
+	if (max_bytes < 8 || max_connections < 1 || round_trips < 1) {
+		printf("Format: %s [output.csv] [max_message_bytes] [max_connections] [round_trips] [budget_megabytes]\n", argv[0]);
+		return 0;
+	}
+	FILE* csv = fopen(output, "w");
+	if (!csv) {
+		perror(output);
+		return 1;
+	}
+	// every connection takes a socket on both sides
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+	// runs whose messages alone would take more memory than this are skipped
+	const size_t MEMORY_LIMIT = 1 << 30;
+	fprintf(csv, "transport,message_bytes,connections,round_trips,seconds,megabytes_per_second,round_trips_per_second,"
+		"p50_us,p99_us,p999_us,user_us_per_round_trip,system_us_per_round_trip,context_switches_per_round_trip\n");
+	printf("%-9s %9s %6s %8s %10s %11s %10s %10s %10s %9s %9s %9s\n", "transport", "bytes", "conns", "trips",
+		"MB/s", "trips/s", "p50 us", "p99 us", "p99.9 us", "usr us", "sys us", "csw");
+	const char* names[] = {"client", "stream"};
+	for (int kind = CLIENT; kind <= STREAM; ++kind) {
+		for (size_t bytes = 8; bytes <= max_bytes; bytes *= 8) {
+			for (int connections = 1; connections <= max_connections; connections *= 4) {
+				// both sides of every connection hold a whole message
+				if (2 * bytes * connections > MEMORY_LIMIT) {
+					printf("%-9s %9lu %6d skipped, the buffers would take more than %lu MB\n",
+						names[kind], (unsigned long) bytes, connections, (unsigned long) (MEMORY_LIMIT >> 20));
+					continue;
+				}
+				int rounds = max(1L, min(round_trips / connections, (long) (budget / (bytes * connections))));
+				result run = measure((transport) kind, bytes, connections, rounds);
+				double trips = run.samples.size();
+				double megabytes = 2.0 * bytes * trips / (1 << 20); // both directions
+				double p50 = percentile(run.samples, 0.5), p99 = percentile(run.samples, 0.99), p999 = percentile(run.samples, 0.999);
+				printf("%-9s %9lu %6d %8.0f %10.1f %11.0f %10.1f %10.1f %10.1f %9.2f %9.2f %9.3f\n",
+					names[kind], (unsigned long) bytes, connections, trips, megabytes / run.seconds, trips / run.seconds,
+					p50, p99, p999, run.user_micros / trips, run.system_micros / trips, run.switches / trips);
+				fprintf(csv, "%s,%lu,%d,%.0f,%.6f,%.3f,%.1f,%.2f,%.2f,%.2f,%.3f,%.3f,%.4f\n",
+					names[kind], (unsigned long) bytes, connections, trips, run.seconds, megabytes / run.seconds, trips / run.seconds,
+					p50, p99, p999, run.user_micros / trips, run.system_micros / trips, run.switches / trips);
+				fflush(csv);
+				if (connections * 4 > max_connections && connections < max_connections)
+					connections = max_connections / 4; // always finish with max_connections itself
+			}
+			if (bytes * 8 > max_bytes && bytes < max_bytes)
+				bytes = max_bytes / 8; // always finish with max_message_bytes itself
+		}
+	}
+	fclose(csv);
+	printf("Results written to %s\n", output);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * Measures the throughput of net::isocketstream and net::osocketstream on
+ * loopback against the streambufs they replaced, which received one byte
+ * per recv() and sent every overflow() and xsputn() with its own send().
+ *
+ * Three workloads are measured: short lines that are each flushed with
+ * std::endl, like the chat examples write them; short lines that are only
+ * flushed at the end; and large blocks written with ostream::write().
+ *
+ * Compile with: g++ socketstream-bench.cpp -std=c++11 -O2 -pthread -o socketstream-bench
+ * Usage: ./socketstream-bench [megabytes]
+ */
+
+#include <cstdio>					// std::printf()
+#include <cstdlib>					// std::atoi()
+#include <string>					// std::string, std::getline()
+#include <vector>					// std::vector
+#include <thread>					// std::thread
+#include <chrono>					// std::chrono::steady_clock
+#include <sys/socket.h>				// send(), recv()
+#include "../net_client.hpp"		// net::client
+#include "../net_server.hpp"		// net::server
+#include "../net_socketstream.hpp"	// net::isocketstream, net::osocketstream
+
+using namespace std;
+
+// the output buffer as it was: no put area, one send() per call
+struct legacy_osocketbuf : public streambuf {
+	int sockfd;
+	legacy_osocketbuf(int sockfd): sockfd(sockfd) {}
+	int_type overflow(int_type c) {
+		return c != traits_type::eof() && send(sockfd, &c, 1, 0) <= 0 ? traits_type::eof() : c;
+	}
+	streamsize xsputn(const char* data, streamsize bytes) {
+		return send(sockfd, data, bytes, 0);
+	}
+};
+
+// the input buffer as it was: one recv() per byte
+struct legacy_isocketbuf : public streambuf {
+	int sockfd;
+	char buffer[64];
+	legacy_isocketbuf(int sockfd): sockfd(sockfd) {
+		setg(buffer + 4, buffer + 4, buffer + 4);
+	}
+	int_type underflow() {
+		if (gptr() < egptr())
+			return traits_type::to_int_type(*gptr());
+		char* start = buffer + 4;
+		if (recv(sockfd, start, 1, 0) <= 0)
+			return traits_type::eof();
+		setg(start, start, start + 1);
+		return traits_type::to_int_type(*gptr());
+	}
+};
+
+enum workload {FLUSHED_LINES, LINES, BLOCKS};
+
+const size_t LINE = 64;
+const size_t BLOCK = 1 << 16;
+
+// writes the workload into a stream
+void produce(ostream& out, workload kind, size_t bytes) {
+	string line(LINE - 1, 'x');
+	vector<char> block(BLOCK, 'x');
+	for (size_t sent = 0; sent < bytes; ) {
+		if (kind == FLUSHED_LINES) {
+			out << line << endl;
+			sent += LINE;
+		}
+		else if (kind == LINES) {
+			out << line << '\n';
+			sent += LINE;
+		}
+		else {
+			out.write(block.data(), block.size());
+			sent += BLOCK;
+		}
+	}
+	out.flush();
+}
+
+// reads the workload from a stream until the connection closes
+size_t consume(istream& in, workload kind) {
+	size_t received = 0;
+	if (kind == BLOCKS) {
+		vector<char> block(BLOCK);
+		while (in.read(block.data(), block.size()) || in.gcount())
+			received += in.gcount();
+	}
+	else {
+		string line;
+		while (getline(in, line))
+			received += line.size() + 1;
+	}
+	return received;
+}
+
+// measures one workload through one kind of stream, in megabytes per second
+double measure(bool legacy, workload kind, unsigned short port, size_t bytes) {
+	net::server server(port, 1);
+	thread writer([&] {
+		net::client client = server.accept();
+		if (legacy) {
+			legacy_osocketbuf buf(client);
+			ostream out(&buf);
+			produce(out, kind, bytes);
+		}
+		else {
+			net::osocketstream out(client);
+			produce(out, kind, bytes);
+		}
+		client.close();
+	});
+	net::client client("127.0.0.1", port);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	size_t received;
+	if (legacy) {
+		legacy_isocketbuf buf(client);
+		istream in(&buf);
+		received = consume(in, kind);
+	}
+	else {
+		net::isocketstream in(client);
+		received = consume(in, kind);
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	writer.join();
+	if (received < bytes)
+		printf("warning: received %lu of %lu bytes\n", (unsigned long) received, (unsigned long) bytes);
+	return received / seconds / (1 << 20);
+}
+
+int main(int argc, char* argv[]) {
+	int megabytes = argc > 1 ? atoi(argv[1]) : 4;
+	if (megabytes < 1) {
+		printf("Format: %s [megabytes]\n", argv[0]);
+		return 0;
+	}
+	size_t bytes = (size_t) megabytes << 20;
+	const char* names[] = {"lines+endl", "lines", "blocks"};
+	printf("%d MB per workload, in MB/s\n", megabytes);
+	printf("%-12s %10s %10s %8s\n", "workload", "legacy", "buffered", "speedup");
+	unsigned short port = 4120;
+	for (int kind = FLUSHED_LINES; kind <= BLOCKS; ++kind) {
+		double before = measure(true, (workload) kind, port++, bytes);
+		double after = measure(false, (workload) kind, port++, bytes);
+		printf("%-12s %10.1f %10.1f %7.1fx\n", names[kind], before, after, after / before);
+	}
+}
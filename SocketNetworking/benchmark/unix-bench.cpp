@@ -0,0 +1,165 @@
+/**
+ * Compares TCP on loopback with Unix domain sockets and socket pairs on
+ * the same host, through the same net::client send()/read() calls.
+ *
+ * For every transport, a client sends small messages that the other end
+ * echoes back, and times each round trip; then it streams a large amount
+ * of data one way in large writes. Each line reports the p50/p99/p99.9
+ * round-trip latency, the system CPU time per round trip from a getrusage()
+ * delta of the whole process, which counts both ends, and the streaming
+ * throughput. A last line times passing an open file descriptor over a
+ * Unix domain socket with unix_client::send_fd() and read_fd().
+ *
+ * Compile with: g++ unix-bench.cpp -std=c++11 -O2 -pthread -o unix-bench
+ * Usage: ./unix-bench [rounds] [message_bytes] [stream_megabytes]
+ */
+
+#include <cstdio>				// std::printf()
+#include <cstdlib>				// std::atoi()
+#include <vector>				// std::vector
+#include <algorithm>			// std::sort(), std::min()
+#include <thread>				// std::thread
+#include <chrono>				// std::chrono::steady_clock
+#include <unistd.h>				// close()
+#include <sys/time.h>			// timeval
+#include <sys/resource.h>		// getrusage()
+#include "../net_client.hpp"	// net::client
+#include "../net_server.hpp"	// net::server
+#include "../net_unix.hpp"		// net::unix_server, net::unix_client, net::make_socket_pair()
+
+using namespace std;
+
+// the kinds of connection compared
+enum transport {TCP, UNIX, PAIR};
+
+// where the servers listen; the Unix domain socket has an abstract name, so it leaves no file behind
+const unsigned short PORT = 4140;
+const char* PATH = "@net-unix-bench";
+
+// the size of every write while streaming
+const size_t CHUNK = 256 * 1024;
+
+// connects two clients with a transport
+void connect(transport kind, net::client& near, net::client& far) {
+	if (kind == TCP) {
+		net::server server(PORT, 1, "127.0.0.1");
+		near = net::client("127.0.0.1", PORT);
+		far = server.accept();
+		near.set<net::tcp_nodelay>(true);
+		far.set<net::tcp_nodelay>(true);
+	} else if (kind == UNIX) {
+		net::unix_server server(PATH, 1);
+		near = net::unix_client(PATH);
+		far = server.accept();
+	} else {
+		pair<net::unix_client, net::unix_client> ends = net::make_socket_pair();
+		near = ends.first;
+		far = ends.second;
+	}
+}
+
+// echoes messages of a fixed size until the connection closes
+void echo(net::client peer, size_t bytes) {
+	vector<char> message(bytes);
+	while (peer.read(message.data(), bytes))
+		peer.send(message.data(), bytes);
+}
+
+// reads everything sent to a connection until it closes
+void drain(net::client peer) {
+	vector<char> chunk(CHUNK);
+	while (peer.read(chunk.data(), CHUNK));
+}
+
+// gets the number of microseconds in a timeval
+double micros(const timeval& time) {
+	return time.tv_sec * 1e6 + time.tv_usec;
+}
+
+// gets a percentile of sorted samples
+double percentile(const vector<double>& sorted, double fraction) {
+	size_t index = fraction * (sorted.size() - 1) + 0.5;
+	return sorted[index];
+}
+
+// measures one transport, and prints a line of results
+void measure(const char* name, transport kind, int rounds, size_t bytes, size_t stream_bytes) {
+	// round trips of small messages
+	net::client near, far;
+	connect(kind, near, far);
+	thread echoer(echo, far, bytes);
+	far = net::client();
+	vector<char> message(bytes, 'x');
+	vector<double> samples;
+	struct rusage before, after;
+	for (int i = -rounds / 10; i < rounds; ++i) {
+		if (i == 0) getrusage(RUSAGE_SELF, &before); // the first tenth warms up the connection
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		near.send(message.data(), bytes);
+		near.read(message.data(), bytes);
+		double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+		if (i >= 0) samples.push_back(micros);
+	}
+	getrusage(RUSAGE_SELF, &after);
+	near.close();
+	echoer.join();
+	sort(samples.begin(), samples.end());
+	// one way streaming of large writes
+	connect(kind, near, far);
+	thread drainer(drain, far);
+	far = net::client();
+	vector<char> chunk(CHUNK, 'x');
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t sent = 0; sent < stream_bytes; sent += CHUNK)
+		near.send(chunk.data(), min(CHUNK, stream_bytes - sent));
+	near.close();
+	drainer.join();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("%-12s %10.1f %10.1f %10.1f %10.2f %10.0f\n", name,
+		percentile(samples, 0.5), percentile(samples, 0.99), percentile(samples, 0.999),
+		(micros(after.ru_stime) - micros(before.ru_stime)) / rounds, stream_bytes / seconds / (1 << 20));
+}
+
+// measures passing a file descriptor back and forth over a socket pair, and prints a line of results
+void measure_fd_passing(int rounds) {
+	pair<net::unix_client, net::unix_client> ends = net::make_socket_pair();
+	net::unix_client far = ends.second;
+	thread returner([far, rounds] () mutable {
+		int fd;
+		for (int i = 0; i < rounds && far.read_fd(fd); ++i) {
+			far.send_fd(fd);
+			close(fd);
+		}
+	});
+	ends.second = net::unix_client();
+	far = net::unix_client();
+	vector<double> samples;
+	for (int i = 0; i < rounds; ++i) {
+		int fd;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		ends.first.send_fd(ends.first).read_fd(fd); // any open descriptor will do
+		samples.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+		close(fd);
+	}
+	returner.join();
+	sort(samples.begin(), samples.end());
+	printf("%-12s %10.1f %10.1f %10.1f\n", "fd passing",
+		percentile(samples, 0.5), percentile(samples, 0.99), percentile(samples, 0.999));
+}
+
+int main(int argc, char* argv[]) {
+	int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+	size_t bytes = argc > 2 ? atoi(argv[2]) : 64;
+	size_t stream_bytes = (size_t) (argc > 3 ? atoi(argv[3]) : 1024) << 20;
+	if (rounds < 1 || bytes < 1 || !stream_bytes) {
+		printf("Format: %s [rounds] [message_bytes] [stream_megabytes]\n", argv[0]);
+		return 0;
+	}
+	printf("%d round trips of %lu byte messages in microseconds, then %lu MB streamed one way\n",
+		rounds, (unsigned long) bytes, (unsigned long) (stream_bytes >> 20));
+	printf("%-12s %10s %10s %10s %10s %10s\n", "transport", "p50", "p99", "p99.9", "sys us", "MB/s");
+	measure("tcp", TCP, rounds, bytes, stream_bytes);
+	measure("unix", UNIX, rounds, bytes, stream_bytes);
+	measure("socketpair", PAIR, rounds, bytes, stream_bytes);
+	measure_fd_passing(rounds);
+}
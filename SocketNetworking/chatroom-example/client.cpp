@@ -1,10 +1,12 @@
-// compile: g++ client.cpp -o client 
+// compile: g++ client.cpp -std=c++11 -pthread -o client 
 #include <iostream>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
-#include <unistd.h>
+#include <thread>
+#include <sys/socket.h>
 #include "../net_client.hpp"
+#include "../net_pool.hpp"
 
 using namespace std;
 
@@ -20,13 +22,16 @@ int main(int argc, char* argv[]) {
 	printf("Enter your name: ");
 	string name;
 	getline(cin, name);
-	// try connecting to the server indefinitely with a 5 second timeout
+	// try connecting to the server indefinitely with a 5 second timeout, backing off between attempts
 	net::client client;
+	net::backoff retry;
 	while (!client) {
 		printf("Connecting to server at %s:%s...\n", host, port);
-		try {client = net::client(host, atoi(port));}
-		catch (net::socket_exception) {sleep(3);}
+		try {client = net::client(host, atoi(port), 5000);}
+		catch (net::socket_exception) {retry.wait();}
 	}
+	client.buffer(); // parse messages from large reads instead of one recv() per byte
+	client.apply(net::socket_profile::low_latency()); // small messages should not wait for Nagle or delayed acks
 	// send name to server
 	printf("Sending client information...\n");
 	client.send(name);
@@ -36,21 +41,19 @@ int main(int argc, char* argv[]) {
 		cout << "Server: " << client.read<string>() << endl;
 		return EXIT_FAILURE;
 	}
-	// create a listening process
-	pid_t f = fork();
-	if (f == -1)
-		perror("fork()");
-	else if (f) {
-		// child process, receive messages
+	// receive messages on another thread while this one sends
+	thread receiver([&] {
 		string message;
 		while (client.read(message))
 			cout << "\r" << message << '\n' << name << ": " << flush;
-	} else {
-		// parent process, send messages through console input
-		string message;
-		while (getline(cin, message)) {
-			client.send(message);
-			cout << name << ": ";
-		}
+	});
+	// send messages through console input
+	string message;
+	while (getline(cin, message)) {
+		client.send(message);
+		cout << name << ": ";
 	}
+	// let the server know that nothing more will be sent, then wait for it to hang up
+	shutdown(client, SHUT_WR);
+	receiver.join();
 }
@@ -1,33 +1,44 @@
-// compile: g++ server.cpp -pthread -o server
+// compile: g++ server.cpp -std=c++11 -pthread -o server
 #include <iostream>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <unistd.h>
-#include <pthread.h>
 #include <map>
 #include <vector>
 #include "../net_client.hpp"
 #include "../net_server.hpp"
+#include "../net_event_loop.hpp"
 
 using namespace std;
 
 // maintain a list of clients
 map<string, net::client> clients;
 
+// the name of each connected client by sockfd, empty until the client has sent it
+map<int, string> names;
+
+// the event loop that serves the server and every client
+net::event_loop loop;
+
 // send a message to all clients
 void send_all(string message, net::client sender = -1) {
 	message = "[" + message + "]";
 	cout << message << endl;
 	for (map<string, net::client>::iterator it = clients.begin(); it != clients.end(); ++it) {
 		net::client& subscriber = it->second;
-		if (subscriber != sender)
-			subscriber.send(message);
+		if (subscriber != sender) {
+			try {subscriber.send(message);}
+			catch (net::socket_exception& ex) {cerr << ex.what() << endl;}
+		}
 	}
 }
 
-// thread that listens to clients
-void* client_listener(void* args);
+// accepts every pending client
+void accept_clients(net::server& server);
+
+// handles every complete message received from a client
+void client_readable(net::client client);
 
 int main(int argc, char* argv[]) {
 	// check validity of arguments
@@ -41,48 +52,75 @@ int main(int argc, char* argv[]) {
 	net::server server(port, 4);
 	int sockfd = (int) server;	// we can get sockfd of server
 	printf("Server: created server at %s (port %s) [sockfd=%d]\n", server.ip(), argv[1], sockfd);
-	// maintain a a pthread vector that will be destructed on exit
-	vector<pthread_t> pthreads;
-	// indefinitely accept clients
+	// accept from the event loop, which must never block
+	server.set_blocking(false);
+	loop.add(server, [&server] {accept_clients(server);});
+	// indefinitely serve clients
+	printf("Server: accepting clients...\n");
+	loop.run();
+}
+
+// accepts every pending client
+void accept_clients(net::server& server) {
 	while (true) {
-		printf("Server: accepting clients...\n");
-		// accept a client from the server socket
-		net::client client = server.accept();
-		printf("Server: connected to client socket [sockfd=%d]\n", (int) client);
-		// create a dedicated thread for client messages
-		pthreads.push_back(pthread_t());
-		int clientfd = client, error = 0;
-		if (error = pthread_create(&pthreads.back(), NULL, &client_listener, reinterpret_cast<void*>(clientfd))) {
-			errno = error;
-			perror("pthread_create()");
+		net::client client;
+		try {client = server.try_accept();}
+		catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			if (ex.code == EMFILE || ex.code == ENFILE)
+				continue; // that connection was refused, the ones behind it may still fit
+			return;
 		}
-		sleep(1);
+		if (!client)
+			return; // no more pending connections
+		printf("Server: connected to client socket [sockfd=%d]\n", (int) client);
+		printf("Server: acquiring name of client [%s]...\n", client.ip());
+		client.buffer(); // parse messages from large reads instead of one recv() per byte
+		client.set<net::tcp_nodelay>(true); // replies are several small writes, which Nagle would hold back
+		names[client];
+		// the callback keeps a copy of the client, so it stays open while it is watched
+		loop.add(client, [client] {client_readable(client);});
 	}
 }
 
-// thread that listens to client messages
-void* client_listener(void* args) {
-	net::client client = *(int*) &args;
-	const char* ip = client.ip();
-	printf("Server: acquiring name of client [%s]...\n", ip);
-	string name = client.read<string>();
-	if (client.good()) {
-		// check if name already exists
-		if (clients.count(name)) {
-			// send an error ping
-			client.send(false);
-			client.send("that name already exists!");
-		} else {
-			clients[name] = client;
-			// send an ok ping
-			client.send(true);
-			send_all(name + " entered the room");
+// handles every complete message received from a client
+void client_readable(net::client client) {
+	int sockfd = client;
+	string& name = names[sockfd];
+	try {
+		bool more;
+		do {
+			more = client.read_available();
 			string message;
-			while (client.read(message))
-				if (!message.empty())
-					send_all(name + ": " + message, client);
+			while (client.good() && client.try_read(message)) {
+				if (!name.empty()) {
+					if (!message.empty())
+						send_all(name + ": " + message, client);
+				}
+				else if (message.empty() || clients.count(message)) {
+					// check if name already exists, send an error ping
+					client.send(false);
+					client.send("that name already exists!");
+					client.close();
+				} else {
+					name = message;
+					clients[name] = client;
+					// send an ok ping
+					client.send(true);
+					send_all(name + " entered the room");
+				}
+			}
+		} while (more && client.good());
+	} catch (net::socket_exception& ex) {
+		cerr << ex.what() << endl;
+		client.close();
+	}
+	if (!client.good()) {
+		loop.remove(sockfd);
+		if (!name.empty()) {
+			clients.erase(name);
+			send_all(name + " has left the room");
 		}
+		names.erase(sockfd);
 	}
-	clients.erase(name);
-	send_all(name + " has left the room");
-}
\ No newline at end of file
+}
@@ -1,5 +1,5 @@
 // multiple chat linux client, for CS 162 Lab 10 requirement
-// compile: g++ chat.cpp -o chat 
+// compile: g++ chat.cpp -std=c++11 -pthread -o chat
 #include <iostream>
 #include <cerrno>
 #include <cstdio>
@@ -8,6 +8,7 @@
 #include <termios.h>  // getch()
 #include <unistd.h>
 #include "../net_client.hpp"
+#include "../net_pool.hpp"
 
 using namespace std;
 
@@ -50,6 +51,11 @@ char getch(){
 void* listener(void* args) {
 	string message;
 	while (client.read(message)) {
+		// the server pings with an empty message after a silence; answer it, or get evicted
+		if (message.empty()) {
+			client.send("");
+			continue;
+		}
 		// pad some spaces
 		int len = inbuffer.length();
 		cout << string(len, '\b') << string(len, ' ') << '\r' << message;
@@ -68,12 +74,15 @@ int main(int argc, char* argv[]) {
 	char* host = argv[1];
 	char* port = argv[2];
 	name = argv[3];
-	// try connecting to the server indefinitely with a 5 second timeout
+	// try connecting to the server indefinitely with a 5 second timeout, backing off between attempts
+	net::backoff retry;
 	while (!client) {
 		printf("Connecting to server at %s:%s...\n", host, port);
-		try {client = net::client(host, atoi(port));}
-		catch (net::socket_exception) {sleep(3);}
+		try {client = net::client(host, atoi(port), 5000);}
+		catch (net::socket_exception) {retry.wait();}
 	}
+	client.buffer(); // parse messages from large reads instead of one recv() per byte
+	client.apply(net::socket_profile::low_latency()); // small messages should not wait for Nagle or delayed acks
 	// send name to server
 	printf("Sending client information...\n");
 	client.send(name);
@@ -0,0 +1,170 @@
+// multiple chat linux server, for CS 162 Lab 10 requirement, with a coroutine per client
+// compile: g++ coserver.cpp -std=c++20 -pthread -o coserver
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include "../net_client.hpp"
+#include "../net_server.hpp"
+#include "../net_coroutine.hpp"
+#include "../net_send_queue.hpp"
+
+using namespace std;
+
+// runs every client coroutine on the main thread
+net::scheduler scheduler;
+
+// a connected client and the messages waiting to be sent to it
+struct chatter {
+	net::client client;
+	string name;
+	string label;		// "(sockfd)[name]", empty until the client has joined
+	deque<net::shared_buffer> outbox;	// messages not sent yet, in order; a broadcast is shared by every outbox
+	bool writing;		// whether a client_writer is sending the outbox
+	chatter(): writing(false) {}
+};
+
+// maintain a list of clients by join number
+map<unsigned long, shared_ptr<chatter> > clients;
+unsigned long joined_count = 0;
+
+// kick clients above this threshold
+int max_connections;
+
+// sends the outbox of a client until it is empty; only one runs per client, so messages are never interleaved
+net::task<> client_writer(shared_ptr<chatter> who) {
+	try {
+		while (!who->outbox.empty() && who->client.good()) {
+			// hold the buffer while it is sent, it is freed once the last client has sent it
+			net::shared_buffer pending = who->outbox.front();
+			who->outbox.pop_front();
+			co_await scheduler.async_send(who->client, pending->data(), pending->size());
+		}
+	} catch (net::socket_exception& ex) {
+		if (who->client.good()) // otherwise the client has left, and its listener is cleaning up
+			cerr << ex.what() << endl;
+	}
+	who->outbox.clear();
+	who->writing = false;
+}
+
+// queues a buffer to a client, without waiting for it to be sent
+void deliver(const shared_ptr<chatter>& who, const net::shared_buffer& bytes) {
+	who->outbox.push_back(bytes);
+	if (!who->writing) {
+		who->writing = true;
+		scheduler.spawn(client_writer(who));
+	}
+}
+
+// send a message to all clients
+void send_all(const string& message, const chatter* sender = NULL) {
+	// frame the message once like client::send(), with its terminating '\0'; every outbox shares the same bytes
+	net::shared_buffer framed = net::make_shared_buffer(string(message.c_str(), message.size() + 1));
+	for (map<unsigned long, shared_ptr<chatter> >::iterator it = clients.begin(); it != clients.end(); ++it)
+		if (it->second.get() != sender)
+			deliver(it->second, framed);
+	clog << message << endl; // have a log in the console
+}
+
+// serves a client from its name until it leaves
+net::task<> client_listener(shared_ptr<chatter> who) {
+	net::client& client = who->client;
+	int sockfd = client;
+	// set once the client has joined, so it leaves the room however its listener ends
+	bool joined = false;
+	unsigned long id = 0;
+	try {
+		// the first message of a client is its name
+		if (!co_await scheduler.async_read(client, who->name))
+			co_return;
+		if (clients.size() >= (size_t) max_connections) {
+			// server already full
+			bool accepted = false;
+			co_await scheduler.async_send(client, accepted);
+			co_await scheduler.async_send(client, "server is already full");
+			scheduler.close(client);
+			co_return;
+		}
+		id = joined_count++;
+		clients[id] = who;
+		joined = true;
+		{
+			// prepare the label of this client: "(sockfd)[name]"
+			ostringstream oss;
+			oss << "(" << sockfd << ")[" << who->name << "]";
+			who->label = oss.str();
+		}
+		// client can join, and gets its socket number as well
+		bool accepted = true;
+		deliver(who, net::make_shared_buffer(string((const char*) &accepted, sizeof accepted) + string((const char*) &sockfd, sizeof sockfd)));
+		send_all(who->name + " entered the room {{ " + who->label + " }}");
+		string message;
+		while (co_await scheduler.async_read(client, message) && message != "@exit")
+			if (!message.empty())
+				send_all(who->label + ": " + message, who.get());
+	} catch (net::socket_exception& ex) {
+		cerr << ex.what() << endl;
+	}
+	if (joined) {
+		clients.erase(id);
+		send_all(who->name + " has left the room {{ " + who->label + " }}");
+	}
+	scheduler.close(client);
+}
+
+// accepts clients for as long as the server runs
+net::task<> accept_clients(net::server& server) {
+	while (true) {
+		net::client client;
+		try {client = co_await scheduler.async_accept(server);}
+		catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			continue;
+		}
+		printf("connected to client socket [%d]\n", (int) client);
+		printf("acquiring name of client [%s]...\n", client.ip());
+		shared_ptr<chatter> who(new chatter());
+		who->client = std::move(client);
+		who->client.set<net::tcp_nodelay>(true); // replies are several small writes, which Nagle would hold back
+		scheduler.spawn(client_listener(who));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// check validity of arguments
+	if (argc < 3) {
+		printf("Some missing arguments\n");
+		printf("Format: %s <max_connections> <port>\n", argv[0]);
+		return 0;
+	}
+	::max_connections = atoi(argv[1]);
+	net::server server(atoi(argv[2]), max_connections);
+	printf("Server: created at %s (port %d)\n", server.ip(), server.port());
+	// have an input thread that accepts input from the server
+	thread input([] {
+		string message;
+		while (getline(cin, message))
+			if (message == "@exit") {
+				scheduler.stop();
+				return;
+			}
+	});
+	input.detach();
+	scheduler.spawn(accept_clients(server));
+	printf("Server: accepting clients...\n");
+	scheduler.run();
+	// say goodbye to everyone before the coroutines are abandoned
+	for (map<unsigned long, shared_ptr<chatter> >::iterator it = clients.begin(); it != clients.end(); ++it) {
+		try {
+			it->second->client.set_blocking(true);
+			it->second->client.send("Server commenced shutdown");
+		}
+		catch (net::socket_exception& ex) {cerr << ex.what() << endl;}
+	}
+	clog << "Server commenced shutdown" << endl;
+}
@@ -0,0 +1,194 @@
+// headless load generator for the chatroom-lab server, which connects many chat.cpp-style clients and measures fan-out
+// compile: g++ loadgen.cpp -std=c++11 -O2 -pthread -o loadgen
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "../net_client.hpp"
+#include "../net_event_loop.hpp"
+
+using namespace std;
+
+typedef chrono::steady_clock timer;
+
+// reads the messages of a share of the clients on its own event loop, and keeps the fan-out latency of each of them
+struct receiver {
+	net::event_loop loop;
+	vector<unsigned> latencies;	// microseconds from sending a timestamped message to receiving it
+	unsigned long others;		// messages that the generator did not send, e.g. join notices
+	unsigned long lost;			// clients that the server disconnected
+	timer::time_point last;		// when the last timestamped message arrived
+	thread runner;
+	receiver(): others(0), lost(0) {}
+};
+
+// the number of timestamped messages received by all clients, to tell when the server has delivered everything
+atomic<unsigned long> delivered(0);
+
+// gets the current time in nanoseconds, which is embedded in every message
+inline unsigned long long now() {
+	return chrono::duration_cast<chrono::nanoseconds>(timer::now().time_since_epoch()).count();
+}
+
+// handles every complete message received by a client
+void client_readable(receiver& self, net::client& client) {
+	try {
+		bool more;
+		do {
+			more = client.read_available();
+			string message;
+			while (client.good() && client.try_read(message)) {
+				// answer the pings of the server, which a silent client gets when the rate is low
+				if (message.empty()) {
+					client.send("");
+					continue;
+				}
+				// messages from the generator look like "(sockfd)[name]: t <nanoseconds>"
+				size_t at = message.find(": t ");
+				if (at == string::npos) {
+					++self.others;
+					continue;
+				}
+				unsigned long long sent = strtoull(message.c_str() + at + 4, NULL, 10);
+				self.latencies.push_back((unsigned) ((now() - sent) / 1000));
+				self.last = timer::now();
+				++delivered;
+			}
+		} while (more && client.good());
+	} catch (net::socket_exception& ex) {
+		cerr << ex.what() << endl;
+		client.close();
+	}
+	if (!client.good()) {
+		self.loop.remove(client);
+		++self.lost;
+	}
+}
+
+// gets a percentile of sorted samples
+unsigned percentile(const vector<unsigned>& sorted, double fraction) {
+	return sorted.empty() ? 0 : sorted[(size_t) (fraction * (sorted.size() - 1) + 0.5)];
+}
+
+int main(int argc, char* argv[]) {
+	// check validity of arguments
+	if (argc < 4) {
+		printf("Some missing arguments\n");
+		printf("Format: %s <host> <port> <clients> [messages_per_second|0] [seconds] [rooms]\n", argv[0]);
+		printf("A rate of 0 sends as fast as the server takes messages, to find its ceiling\n");
+		return 0;
+	}
+	const char* host = argv[1];
+	int port = atoi(argv[2]);
+	int count = atoi(argv[3]);
+	double rate = argc > 4 ? atof(argv[4]) : 100;
+	double seconds = argc > 5 ? atof(argv[5]) : 10;
+	int rooms = argc > 6 ? max(1, atoi(argv[6])) : 1;
+	if (count < 2 || seconds <= 0) {
+		printf("Needs at least 2 clients and a positive duration\n");
+		return 0;
+	}
+	// every client takes a file descriptor
+	struct rlimit files;
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+		files.rlim_cur = files.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+	// connect every client with the chat handshake: its name, then the server replies true and the socket number
+	vector<net::client> clients;
+	vector<int> members(rooms, 0);
+	clients.reserve(count);
+	printf("Connecting %d clients to %s:%d...\n", count, host, port);
+	for (int i = 0; i < count; ++i) {
+		try {
+			net::client client(host, port);
+			client.set<net::tcp_nodelay>(true); // every message is its own small write
+			client.send("load" + to_string(i));
+			if (client.read<bool>() == false) {
+				cout << "Server: " << client.read<string>() << endl;
+				return EXIT_FAILURE;
+			}
+			client.read<int>();
+			if (rooms > 1)
+				client.send("@join room" + to_string(i % rooms));
+			++members[i % rooms];
+			client.buffer();
+			clients.push_back(std::move(client));
+		} catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			return EXIT_FAILURE;
+		}
+	}
+	// read the clients on one event loop per core
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1) cores = 1;
+	vector<receiver*> receivers;
+	for (long i = 0; i < cores; ++i)
+		receivers.push_back(new receiver());
+	for (int i = 0; i < count; ++i) {
+		receiver* self = receivers[i % cores];
+		net::client* client = &clients[i];
+		self->loop.add(*client, [self, client] {client_readable(*self, *client);});
+	}
+	for (long i = 0; i < cores; ++i)
+		receivers[i]->runner = thread([i, &receivers] {receivers[i]->loop.run();});
+	// let the join notices settle before measuring
+	this_thread::sleep_for(chrono::milliseconds(500));
+	// send timestamped messages from the clients in turn, at the target rate
+	printf("Sending %s for %.1f s from %d clients in %d room(s)...\n",
+		rate > 0 ? (to_string((long) rate) + " msg/s").c_str() : "as fast as the server takes", seconds, count, rooms);
+	unsigned long sent = 0, expected = 0;
+	timer::time_point start = timer::now(), until = start + chrono::microseconds((long long) (seconds * 1e6));
+	for (int i = 0; timer::now() < until; i = (i + 1) % count) {
+		if (rate > 0) {
+			timer::time_point due = start + chrono::microseconds((long long) (sent * 1e6 / rate));
+			if (due > until) break;
+			this_thread::sleep_until(due);
+		}
+		if (!clients[i].good()) continue;
+		try {clients[i].send("t " + to_string(now()));}
+		catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			continue;
+		}
+		++sent;
+		expected += members[i % rooms] - 1; // everyone else in the room
+	}
+	double sending = chrono::duration<double>(timer::now() - start).count();
+	// wait until nothing more arrives for a while
+	for (unsigned long last = ~0ul; last != delivered; ) {
+		last = delivered;
+		this_thread::sleep_for(chrono::milliseconds(500));
+	}
+	timer::time_point finish = start;
+	for (long i = 0; i < cores; ++i) {
+		receivers[i]->loop.stop();
+		receivers[i]->runner.join();
+		finish = max(finish, receivers[i]->last);
+	}
+	double elapsed = chrono::duration<double>(finish - start).count();
+	// gather what every receiver measured
+	vector<unsigned> latencies;
+	unsigned long others = 0, lost = 0;
+	for (long i = 0; i < cores; ++i) {
+		latencies.insert(latencies.end(), receivers[i]->latencies.begin(), receivers[i]->latencies.end());
+		others += receivers[i]->others;
+		lost += receivers[i]->lost;
+	}
+	sort(latencies.begin(), latencies.end());
+	printf("sent       %lu messages in %.2f s, %.0f msg/s\n", sent, sending, sent / sending);
+	printf("delivered  %lu of %lu expected (%.2f%%) in %.2f s, %.0f msg/s\n", (unsigned long) latencies.size(), expected,
+		expected ? 100.0 * latencies.size() / expected : 0.0, elapsed, latencies.size() / elapsed);
+	printf("other      %lu notice(s), %lu client(s) disconnected by the server\n", others, lost);
+	printf("fan-out latency in microseconds: p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+		percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), percentile(latencies, 0.999),
+		latencies.empty() ? 0 : latencies.back());
+	return 0;
+}
@@ -1,5 +1,5 @@
 // multiple chat linux server, for CS 162 Lab 10 requirement
-// compile: g++ server.cpp -pthread -o server
+// compile: g++ server.cpp -std=c++11 -pthread [-DNET_STATS] -o server
 #include <iostream>
 #include <sstream>
 #include <cerrno>
@@ -7,72 +7,247 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <map>
 #include <vector>
+#include <atomic>
+#include <functional>
+#include <chrono>
 #include "../net_client.hpp"
 #include "../net_server.hpp"
+#include "../net_event_loop.hpp"
+#include "../net_send_queue.hpp"
+#include "../net_stats.hpp"
+#include "../net_timer_wheel.hpp"
 
 using namespace std;
 
-// maintain a list of clients
-vector<net::client> clients;
+// every client starts in this room
+const string LOBBY = "lobby";
+
+// the number of clients in the chat, and the join number of the next one
+atomic<int> chatting(0);
+atomic<unsigned long> joined_count(0);
 
 // kick clients above this threshold
 int max_connections;
 
-// send a message to all clients
-void send_all(string message, net::client sender = -1) {
-	for (int i = 0; i < clients.size(); ++i)
-		if (clients[i] != sender)
-			clients[i].send(message);
-	clog << message << endl; // have a log in the console
+// the size and overflow policy of the outbound queue of every client
+size_t queue_capacity = net::send_queue::DEFAULT_CAPACITY;
+net::send_queue::overflow_policy queue_policy = net::send_queue::DROP_OLDEST;
+
+// ping a client after this many seconds of silence, and evict it if it is still silent after as many more; 0 never does
+unsigned heartbeat = 30;
+
+// the listeners of the event loops, which share the server port
+net::listener_group* listeners;
+
+// the local listener that reports the socket counters to whoever connects, if an admin port was given
+net::server admin;
+
+// the outbound queues of the members of a room by join number, only touched by the worker that owns the room
+struct room {
+	map<unsigned long, shared_ptr<net::send_queue> > members;
+};
+
+// a connected client and its chat state, owned by the worker that accepted it
+struct chatter {
+	net::client client;
+	shared_ptr<net::send_queue> outbox;	// every message to this client, so they are never interleaved
+	string name;
+	string label;	// "(sockfd)[name]", empty until the client has joined
+	string room;	// the room this client is in, once it has joined
+	unsigned long id;	// the join number of this client, once it has joined
+	uint64_t heard;	// the tick of the wheel of the worker when this client last sent anything
+	net::timer_wheel::timer deadline;	// when this client is due for a ping or an eviction
+};
+
+// an event loop, the clients it serves and the rooms it owns, run by one thread per core
+struct worker {
+	net::event_loop loop;
+	net::server listener;	// this worker's own listener on the shared port
+	map<int, chatter> chatters;	// the clients accepted by this worker, whatever room they are in
+	map<string, room> rooms;	// the rooms whose names hash to this worker
+	net::timer_wheel wheel;	// the deadlines of the clients accepted by this worker
+	pthread_t thread;
+};
+
+// the workers, which do not change once the server runs
+vector<worker*> workers;
+
+// the number of workers still telling their rooms that the server shuts down
+atomic<size_t> closing(0);
+
+// gets the worker that owns a room
+worker& owner(const string& name) {
+	return *workers[hash<string>()(name) % workers.size()];
 }
 
-// thread that listens to clients
-void* client_listener(void*);
+// runs a task on the worker that owns a room: right away if it is the calling worker, or else on its event loop
+void on_owner(worker* self, const string& name, const net::event_loop::callback& task) {
+	worker& host = owner(name);
+	if (&host == self)
+		task();
+	else
+		host.loop.post(task);
+}
+
+// sends a message to everyone in a room but the sender, without waiting for any of them unless the overflow policy is to block; runs on the owner of the room
+void room_send(worker& host, const string& name, const string& message, const net::send_queue* sender = NULL) {
+	map<string, room>::iterator it = host.rooms.find(name);
+	if (it == host.rooms.end())
+		return;
+	// frame the message once like client::send(), with its terminating '\0'; every queue shares the same bytes
+	net::shared_buffer framed = net::make_shared_buffer(string(message.c_str(), message.size() + 1));
+	map<unsigned long, shared_ptr<net::send_queue> >& members = it->second.members;
+	// a failed or overflowing client is shut down by its queue, and cleaned up by the worker that accepted it
+	for (map<unsigned long, shared_ptr<net::send_queue> >::iterator member = members.begin(); member != members.end(); ++member)
+		if (member->second.get() != sender)
+			member->second->push(framed);
+	clog << "#" << name << " " << message << endl; // have a log in the console
+}
+
+// adds a client to a room and lets the room know; runs on the owner of the room
+void room_join(worker& host, const string& name, unsigned long id, const shared_ptr<net::send_queue>& outbox, const string& greeting) {
+	host.rooms[name].members[id] = outbox;
+	room_send(host, name, greeting);
+}
+
+// removes a client from a room and lets the rest of the room know; runs on the owner of the room
+void room_leave(worker& host, const string& name, unsigned long id, const string& farewell) {
+	map<string, room>::iterator it = host.rooms.find(name);
+	if (it == host.rooms.end())
+		return;
+	it->second.members.erase(id);
+	room_send(host, name, farewell);
+	if (it->second.members.empty())
+		host.rooms.erase(it);
+}
+
+// sends a message from another room, or tells the sender that nobody is there; runs on the owner of the room
+void room_relay(worker& host, const string& name, const string& message, const shared_ptr<net::send_queue>& sender) {
+	if (host.rooms.count(name)) {
+		room_send(host, name, message);
+	} else {
+		string notice = "nobody is in #" + name;
+		sender->push(string(notice.c_str(), notice.size() + 1));
+	}
+}
+
+// tells every room of a worker that the server shuts down, and exits once every worker has; runs on the worker
+void close_rooms(worker& self) {
+	for (map<string, room>::iterator it = self.rooms.begin(); it != self.rooms.end(); ++it)
+		room_send(self, it->first, "Server commenced shutdown");
+	// give the clients one moment in all to receive what is still queued, however many of them are slow; whatever
+	// is left is dropped on exit
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(1000);
+	for (map<string, room>::iterator it = self.rooms.begin(); it != self.rooms.end(); ++it)
+		for (map<unsigned long, shared_ptr<net::send_queue> >::iterator member = it->second.members.begin(); member != it->second.members.end(); ++member) {
+			long left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+			if (!member->second->flush() || member->second->size() == 0)
+				continue;
+			member->second->wait(left > 0 ? left : 0);
+		}
+	if (--closing == 0)
+		exit(EXIT_SUCCESS);
+}
+
+// accepts every pending client into a worker
+void accept_clients(worker& self);
+
+// sends the socket counters to every admin connection, then hangs up, on a thread of its own
+void* admin_thread(void*);
+
+// handles every complete message received from a client
+void client_readable(worker& self, int sockfd);
+
+// pings a client that has been silent for a heartbeat, or evicts it if it did not answer
+void client_idle(worker& self, int sockfd);
+
+// runs the event loop of a worker
+void* worker_thread(void*);
 
 // thread that listens to server input
 void* server_listener(void*);
 
 int main(int argc, char* argv[]) {
 	// check validity of arguments
-	if (argc == 1) {
+	if (argc < 3) {
 		printf("Some missing arguments\n");
-		printf("Format: %s <max_connections> <port>\n", argv[0]);
+		printf("Format: %s <max_connections> <port> [drop|disconnect|block] [queue_kb] [admin_port] [heartbeat_s]\n", argv[0]);
 		return 0;
 	}
 	::max_connections = atoi(argv[1]);
 	int port = atoi(argv[2]);
-	// create server using port, listen up to max_connections
-	net::server server(port, max_connections);
-	int sockfd = (int) server;	// we can get sockfd of server
-	printf("Server: created server at %s (port %d) [sockfd=%d]\n", server.ip(), port, sockfd);
-	// maintain a a pthread vector that will be destructed on exit
-	vector<pthread_t> pthreads;
-	// have an input process that accepts input from the server
+	// choose what happens to a client that cannot keep up with the room
+	if (argc > 3) {
+		string policy = argv[3];
+		if (policy == "disconnect") queue_policy = net::send_queue::DISCONNECT;
+		else if (policy == "block") queue_policy = net::send_queue::BLOCK;
+		else if (policy != "drop") {
+			printf("Unknown overflow policy %s\n", argv[3]);
+			return 0;
+		}
+	}
+	if (argc > 4 && atoi(argv[4]) > 0)
+		queue_capacity = (size_t) atoi(argv[4]) * 1024;
+	if (argc > 6)
+		heartbeat = atoi(argv[6]);
+	// create one listener per core on the same port, each listening up to max_connections
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores < 1) cores = 1;
+	listeners = new net::listener_group(port, cores, max_connections);
+	printf("Server: created %ld listener(s) at %s (port %d)\n", cores, (*listeners)[0].ip(), port);
+	// run one event loop per core; each one accepts clients from its own listener and owns the rooms that hash to it
+	for (long i = 0; i < cores; ++i) {
+		worker* self = new worker();
+		self->listener = (*listeners)[i];
+		// accept from the event loop, which must never block
+		self->listener.set_blocking(false);
+		self->loop.add(self->listener, [self] {accept_clients(*self);});
+		// expire the deadlines of the clients on every tick of the wheel, on the same thread as everything else they touch
+		if (heartbeat)
+			self->loop.add(self->wheel.fd(), [self] {self->wheel.expire();});
+		workers.push_back(self);
+	}
+	// report the socket counters on a port of the local host only, e.g. with: nc localhost <admin_port>
+	if (argc > 5 && atoi(argv[5]) > 0) {
+		admin = net::server(atoi(argv[5]), 16, "127.0.0.1");
+		// a viewer that does not read must never stall a worker, so the reports are sent from their own thread
+		int error;
+		pthread_t thread;
+		if (error = pthread_create(&thread, NULL, &admin_thread, NULL)) {
+			errno = error;
+			perror("pthread_create()");
+		}
+		printf("Server: reporting socket counters at 127.0.0.1 (port %d)\n", atoi(argv[5]));
+	}
+	// have an input process that accepts input from the server, once the workers are set up
 	{
 		int error;
-		pthreads.push_back(pthread_t());
-		if (error = pthread_create(&pthreads.back(), NULL, &server_listener, NULL)) {
+		pthread_t thread;
+		if (error = pthread_create(&thread, NULL, &server_listener, NULL)) {
 			errno = error;
 			perror("pthread_create()");
 		}
 	}
-	// indefinitely accept clients
-	while (true) {
-		printf("Server: accepting clients...\n");
-		// accept a client from the server socket
-		net::client client = server.accept();
-		printf("connected to client socket [%d]\n", (int) client);
-		// create a dedicated thread for client messages
-		pthreads.push_back(pthread_t());
+	printf("Server: accepting clients on %ld event loop(s)...\n", cores);
+	for (int i = 1; i < workers.size(); ++i) {
 		int error;
-		if (error = pthread_create(&pthreads.back(), NULL, &client_listener, reinterpret_cast<void*>((int) client))) {
+		if (error = pthread_create(&workers[i]->thread, NULL, &worker_thread, workers[i])) {
 			errno = error;
 			perror("pthread_create()");
 		}
-		sleep(1);
 	}
+	worker_thread(workers[0]);
+}
+
+// runs the event loop of a worker
+void* worker_thread(void* args) {
+	worker& self = *(worker*) args;
+	try {self.loop.run();}
+	catch (net::socket_exception& ex) {cerr << ex.what() << endl;}
+	return NULL;
 }
 
 // thread that listens to server input
@@ -80,69 +255,244 @@ void* server_listener(void*) {
 	string message;
 	while (getline(cin, message)) {
 		if (message == "@exit") {
-			send_all("Server commenced shutdown");
-			exit(EXIT_SUCCESS);
+			// every worker says goodbye to its own rooms, and the last one to finish exits
+			closing = workers.size();
+			for (size_t i = 0; i < workers.size(); ++i) {
+				worker* self = workers[i];
+				self->loop.post([self] {close_rooms(*self);});
+			}
+		}
+		if (message == "@accepts") {
+			// show how evenly the kernel spreads connections across the listeners
+			vector<unsigned long> counts = listeners->accepted();
+			for (size_t i = 0; i < counts.size(); ++i)
+				printf("listener %lu: %lu connection(s) accepted\n", (unsigned long) i, counts[i]);
+		}
+		if (message == "@rooms") {
+			// show how the rooms are spread across the workers, from the thread of each worker
+			for (size_t i = 0; i < workers.size(); ++i) {
+				worker* self = workers[i];
+				self->loop.post([self, i] {
+					for (map<string, room>::iterator it = self->rooms.begin(); it != self->rooms.end(); ++it)
+						printf("worker %lu: #%s, %lu member(s)\n", (unsigned long) i, it->first.c_str(), (unsigned long) it->second.members.size());
+				});
+			}
 		}
 	}
+	return NULL;
 }
 
-// thread that listens to client messages
-void* client_listener(void* args) {
-	net::client client = *(int*) &args;
-	const char* ip = client.ip();
-	printf("acquiring name of client [%s]...\n", ip);
-	// get name of the client
-	string name;
-	client.read(name);
-	if (client.good()) {
-		if (clients.size() >= max_connections) {
-			// server already full
-			client.send(false);
-			client.send("server is already full");
+// accepts every pending client into a worker
+void accept_clients(worker& self) {
+	while (true) {
+		net::client client;
+		try {client = self.listener.try_accept();}
+		catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			if (ex.code == EMFILE || ex.code == ENFILE)
+				continue; // that connection was refused, the ones behind it may still fit
+			return;
+		}
+		if (!client)
+			return; // no more pending connections
+		int sockfd = client;
+		printf("connected to client socket [%d]\n", sockfd);
+		printf("acquiring name of client [%s]...\n", client.ip());
+		chatter& entry = self.chatters[sockfd];
+		entry.client = std::move(client);
+		entry.client.buffer();
+		entry.client.set<net::tcp_nodelay>(true); // replies are several small writes, which Nagle would hold back
+		entry.outbox.reset(new net::send_queue(sockfd, queue_capacity, queue_policy));
+		shared_ptr<net::send_queue> outbox = entry.outbox;
+		self.loop.add(sockfd, [&self, sockfd] {client_readable(self, sockfd);}, [outbox] {outbox->flush();});
+		// a client that never says anything, not even its name, is evicted as well
+		entry.heard = self.wheel.now();
+		entry.deadline.action = [&self, sockfd] {client_idle(self, sockfd);};
+		if (heartbeat)
+			self.wheel.schedule(entry.deadline, heartbeat * 1000ul);
+	}
+}
+
+// sends the socket counters to every admin connection, then hangs up, on a thread of its own
+void* admin_thread(void*) {
+	while (true) {
+		net::client viewer;
+		try {viewer = admin.accept();}
+		catch (net::socket_exception& ex) {
+			cerr << ex.what() << endl;
+			continue;
+		}
+		// give up on a viewer that stops reading, so the next one still gets its report
+		struct timeval timeout = {2, 0};
+		setsockopt(viewer, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+		ostringstream oss;
+		oss << "clients " << chatting << "\n";
+		if (!net::io_stats::enabled) {
+			oss << "socket counters are disabled, compile the server with -DNET_STATS\n";
 		} else {
-			// client can join
-			clients.push_back(client);
-			string label;
-			try {
-				client.send(true);
-				client.send((int) client); // send the socket number of this client as well
-				{
-					// prepare the label of this client: "(sockfd)[name]: "
-					ostringstream oss;
-					oss << "(" << (int) client << ")[" << name << "]";
-					label = oss.str();
-				}
-				{
-					// send a message to everyone that client has joined
-					ostringstream oss;
-					oss << name << " entered the room {{ " << label << " }}";
-					send_all(oss.str());
-				}
-				// indefinitely listen to messages
-				string message;
-				while (client.read(message)) {
-					if (message == "@exit") {
-						client.close();
-						break;
-					}
-					if (!message.empty()) {
-						ostringstream oss;
-						send_all(label + ": " + message, client);
-					}
+			// the totals include the sockets that were closed, every other line is a socket that is still open
+			oss << "total " << net::io_stats::total().str() << "\n";
+			vector<pair<int, net::socket_stats> > sockets = net::io_stats::active();
+			for (size_t i = 0; i < sockets.size(); ++i)
+				oss << "fd " << sockets[i].first << " " << sockets[i].second.str() << "\n";
+		}
+		string report = oss.str();
+		try {viewer.send(report.data(), report.size());}
+		catch (net::socket_exception& ex) {cerr << ex.what() << endl;}
+		viewer.close();
+	}
+	return NULL;
+}
+
+// moves a client into a room, on the worker that owns the room
+void enter_room(worker& self, chatter& entry, const string& name) {
+	entry.room = name;
+	ostringstream oss;
+	oss << entry.name << " entered #" << name << " {{ " << entry.label << " }}";
+	worker* host = &owner(name);
+	unsigned long id = entry.id;
+	shared_ptr<net::send_queue> outbox = entry.outbox;
+	string greeting = oss.str();
+	on_owner(&self, name, [host, name, id, outbox, greeting] {room_join(*host, name, id, outbox, greeting);});
+}
+
+// takes a client out of its room, on the worker that owns the room
+void leave_room(worker& self, chatter& entry) {
+	ostringstream oss;
+	oss << entry.name << " has left #" << entry.room << " {{ " << entry.label << " }}";
+	worker* host = &owner(entry.room);
+	string name = entry.room;
+	unsigned long id = entry.id;
+	string farewell = oss.str();
+	on_owner(&self, name, [host, name, id, farewell] {room_leave(*host, name, id, farewell);});
+	entry.room.clear();
+}
+
+// handles the name sent by a client, which is its first message
+void client_joined(worker& self, chatter& entry, const string& name) {
+	net::client& client = entry.client;
+	entry.name = name;
+	if (chatting++ >= max_connections) {
+		--chatting;
+		// server already full
+		client.send(false);
+		client.send("server is already full");
+		client.close();
+		return;
+	}
+	entry.id = joined_count++;
+	{
+		// send the join reply before any room message can be queued: true, then the socket number of this client
+		bool accepted = true;
+		int sockfd = client;
+		entry.outbox->push(string((const char*) &accepted, sizeof accepted) + string((const char*) &sockfd, sizeof sockfd));
+	}
+	{
+		// prepare the label of this client: "(sockfd)[name]: "
+		ostringstream oss;
+		oss << "(" << (int) client << ")[" << name << "]";
+		entry.label = oss.str();
+	}
+	// every client starts in the lobby
+	enter_room(self, entry, LOBBY);
+}
+
+// handles a message from a client that has joined: a command, or a message to its room
+void client_said(worker& self, chatter& entry, const string& message) {
+	istringstream iss(message);
+	string command, name;
+	iss >> command >> name;
+	if (command == "@join" && !name.empty()) {
+		// move to another room, which is created by its first member
+		if (name != entry.room) {
+			leave_room(self, entry);
+			enter_room(self, entry, name);
+		}
+		return;
+	}
+	if (command == "@to" && !name.empty()) {
+		// send a message to another room without moving there
+		string text;
+		getline(iss >> ws, text);
+		worker* host = &owner(name);
+		string relayed = entry.label + " from #" + entry.room + ": " + text;
+		shared_ptr<net::send_queue> outbox = entry.outbox;
+		on_owner(&self, name, [host, name, relayed, outbox] {room_relay(*host, name, relayed, outbox);});
+		return;
+	}
+	// send a message to everyone else in the room
+	string room = entry.room;
+	worker* host = &owner(room);
+	string said = entry.label + ": " + message;
+	shared_ptr<net::send_queue> sender = entry.outbox;
+	on_owner(&self, room, [host, room, said, sender] {room_send(*host, room, said, sender.get());});
+}
+
+// removes a disconnected client from the chat
+void client_left(worker& self, int sockfd) {
+	chatter& entry = self.chatters[sockfd];
+	self.loop.remove(sockfd);
+	bool joined = !entry.label.empty();
+	if (joined) {
+		leave_room(self, entry);
+		--chatting;
+	}
+	// forget the socket before it is closed, so no other thread writes to a new client with the same number
+	entry.outbox->close();
+	entry.client.close();
+	self.chatters.erase(sockfd);
+}
+
+// handles every complete message received from a client
+void client_readable(worker& self, int sockfd) {
+	chatter& entry = self.chatters[sockfd];
+	net::client& client = entry.client;
+	entry.heard = self.wheel.now(); // any message counts, including the empty answer to a ping
+	try {
+		bool more;
+		do {
+			more = client.read_available();
+			string message;
+			while (client.good() && client.try_read(message)) {
+				if (entry.label.empty()) {
+					client_joined(self, entry, message);
+					continue;
 				}
-			} catch (net::socket_exception ex) {
-				cerr << ex.what() << endl;
-			}
-			// client has disconnected
-			for (int i = 0; i < clients.size(); ++i) {
-				if (!clients[i].good()) {
-					clients[i--] = clients.back();
-					clients.pop_back();
+				if (message == "@exit") {
+					entry.outbox->close(); // before the socket, like client_left()
+					client.close();
+					break;
 				}
+				if (!message.empty())
+					client_said(self, entry, message);
 			}
-			ostringstream oss;
-			oss << name << " has left the room {{ " << label << " }}";
-			send_all(oss.str());
-		}		
+		} while (more && client.good());
+	} catch (net::socket_exception& ex) {
+		cerr << ex.what() << endl;
+		entry.outbox->close();
+		client.close();
+	}
+	if (!client.good())
+		client_left(self, sockfd);
+}
+
+// pings a client that has been silent for a heartbeat, or evicts it if it did not answer
+void client_idle(worker& self, int sockfd) {
+	chatter& entry = self.chatters[sockfd];
+	// the deadline is not moved on every message, so a client that spoke since it was set is only checked again
+	uint64_t silent = (self.wheel.now() - entry.heard) * self.wheel.tick();
+	uint64_t period = heartbeat * 1000ul;
+	if (silent >= 2 * period) {
+		printf("evicting silent client socket [%d]\n", sockfd);
+		client_left(self, sockfd);
+		return;
+	}
+	if (silent < period) {
+		self.wheel.schedule(entry.deadline, period - silent);
+		return;
 	}
+	// an empty message is a ping, which the client answers with an empty message; not before the join reply, though
+	if (!entry.label.empty())
+		entry.outbox->push(string(1, '\0'));
+	self.wheel.schedule(entry.deadline, 2 * period - silent);
 }
@@ -0,0 +1,131 @@
+/**
+ * The chunked protocol of the file transfer example. The file is cut into
+ * chunks of a fixed size, and each chunk is sent with its CRC32C so the
+ * receiver can verify it. The receiver records the chunks it verified in a
+ * manifest next to the file, so a transfer that drops only resends what is
+ * missing after it reconnects.
+ *
+ *     sender:   transfer_header
+ *     receiver: bitmap of verified chunks
+ *     sender:   (chunk_header, chunk data) for every missing chunk
+ *     ... repeated until the bitmap is complete
+ */
+
+#ifndef __INCLUDE_CHUNK__
+#define __INCLUDE_CHUNK__
+
+#include <cstdio>			// rename()
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>			// open()
+#include <unistd.h>			// write(), read(), fsync()
+
+// identifies a version of the file being sent
+struct transfer_header {
+	uint64_t size;		// the size of the whole file in bytes
+	uint64_t chunk;		// the size of each chunk in bytes; the last one may be shorter
+	int64_t mtime;		// the modification time of the file, so a changed file is sent again from scratch
+};
+
+// sent before the data of every chunk
+struct chunk_header {
+	uint64_t index;		// the index of the chunk in the file
+	uint32_t length;	// the number of bytes of data that follow
+	uint32_t crc;		// the CRC32C of the data
+};
+
+// the largest chunk a receiver accepts, since it maps a whole chunk at once; the window size of net::mapped_file
+const uint64_t MAX_CHUNK = 32 * 1024 * 1024;
+
+// the largest bitmap of verified chunks a receiver keeps, in bytes
+const uint64_t MAX_BITMAP = 64 * 1024 * 1024;
+
+// gets the number of chunks in a file
+inline uint64_t chunk_count(const transfer_header& header) {
+	return (header.size + header.chunk - 1) / header.chunk;
+}
+
+// gets the number of bytes in a chunk
+inline uint32_t chunk_length(const transfer_header& header, uint64_t chunk) {
+	uint64_t offset = chunk * header.chunk;
+	return header.size - offset < header.chunk ? header.size - offset : header.chunk;
+}
+
+// checks if a chunk is set in a bitmap of chunks
+inline bool chunk_bit(const unsigned char* bitmap, uint64_t chunk) {
+	return bitmap[chunk / 8] >> (chunk % 8) & 1;
+}
+
+// the set of verified chunks of a file, one bit per chunk
+class manifest {
+	transfer_header header;
+	std::vector<unsigned char> bits;
+	std::string path;
+
+public:
+	// loads the manifest at path if it was written for the same transfer, otherwise starts empty
+	manifest(const std::string& path, const transfer_header& header):
+		header(header),
+		bits((chunk_count(header) + 7) / 8),
+		path(path) {
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return;
+		transfer_header saved;
+		bool same = read(fd, &saved, sizeof(saved)) == sizeof(saved)
+			&& saved.size == header.size && saved.chunk == header.chunk && saved.mtime == header.mtime;
+		if (!same || read(fd, bits.data(), bits.size()) != (ssize_t) bits.size())
+			bits.assign(bits.size(), 0);
+		close(fd);
+	}
+
+	// forgets every verified chunk
+	void clear() {
+		bits.assign(bits.size(), 0);
+	}
+
+	// checks if any chunk was verified, in which case the file has data worth keeping
+	bool resumed() const {
+		for (size_t i = 0; i < bits.size(); ++i)
+			if (bits[i]) return true;
+		return false;
+	}
+
+	bool verified(uint64_t chunk) const {
+		return chunk_bit(bits.data(), chunk);
+	}
+
+	void verify(uint64_t chunk) {
+		bits[chunk / 8] |= 1 << (chunk % 8);
+	}
+
+	// gets the number of chunks that are not verified yet
+	uint64_t missing() const {
+		uint64_t count = 0;
+		for (uint64_t k = 0; k < chunk_count(header); ++k)
+			count += !verified(k);
+		return count;
+	}
+
+	const unsigned char* bitmap() const {
+		return bits.data();
+	}
+
+	size_t bitmap_size() const {
+		return bits.size();
+	}
+
+	// writes the manifest to a temporary file, then renames it over the old one, so a crash never leaves half of it
+	bool save() const {
+		std::string temporary = path + ".tmp";
+		int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) return false;
+		bool ok = write(fd, &header, sizeof(header)) == sizeof(header)
+			&& write(fd, bits.data(), bits.size()) == (ssize_t) bits.size()
+			&& fsync(fd) == 0;
+		close(fd);
+		return ok && rename(temporary.c_str(), path.c_str()) == 0;
+	}
+};
+
+#endif /* __INCLUDE_CHUNK__ */
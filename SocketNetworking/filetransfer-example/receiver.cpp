@@ -1,16 +1,67 @@
 /**
- * Receive a file from a client through the network by receiving the number of bytes first.
+ * Receive a file from a client through the network in checksummed chunks, keeping a manifest of verified chunks so
+ * an interrupted transfer can be resumed.
  */
 #include <iostream>
-#include <fstream>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <stdint.h>
+#include <unistd.h>			// fdatasync()
+#include <sys/stat.h>		// stat()
 #include "../net_server.hpp"
 #include "../net_client.hpp"
+#include "../net_file.hpp"
+#include "../net_crc32c.hpp"
+#include "chunk.hpp"
 
 using namespace std;
 
+// the number of verified bytes after which the manifest is saved
+const uint64_t SAVE_INTERVAL = 64 * 1024 * 1024;
+
+// flushes the received chunks to disk, then records them as verified, so the manifest never claims unwritten data
+void save(net::mapped_file& file, const manifest& verified) {
+	if (fdatasync(file) < 0 || !verified.save())
+		perror("Could not save manifest");
+}
+
+// receives the missing chunks of a file until it is complete or the connection is lost
+void receive_chunks(net::client& client, const transfer_header& header, net::mapped_file& file, manifest& verified) {
+	while (client) {
+		// tell the client which chunks are still missing
+		client.send(verified.bitmap(), verified.bitmap_size());
+		uint64_t missing = verified.missing();
+		if (!missing) return;
+		uint64_t unsaved = 0;
+		for (uint64_t i = 0; i < missing && client; ++i) {
+			chunk_header chunk;
+			if (!client.read(chunk)) break;
+			if (chunk.index >= chunk_count(header) || chunk.length != chunk_length(header, chunk.index)) {
+				printf("Invalid chunk header\n");
+				client.close();
+				break;
+			}
+			// receive straight into the file, then verify while the data is still in the cache
+			char* data = file.map(chunk.index * header.chunk, chunk.length);
+			if (!client.read(data, chunk.length)) break;
+			if (net::crc32c(data, chunk.length) == chunk.crc) {
+				verified.verify(chunk.index);
+				unsaved += chunk.length;
+			}
+			else printf("Chunk %llu failed its checksum\n", (unsigned long long) chunk.index);
+			file.unmap();
+			if (unsaved >= SAVE_INTERVAL) {
+				save(file, verified);
+				unsaved = 0;
+			}
+		}
+		file.unmap();
+		save(file, verified);
+	}
+}
+
 int main(int argc, char* argv[]) {
 	// get arguments
 	if (argc < 3) {
@@ -20,32 +71,42 @@ int main(int argc, char* argv[]) {
 	}
 	char* port = argv[1];
 	char* filename = argv[2];
-	// open server for one connection
+	string manifest_path = string(filename) + ".manifest";
+	// open server for one connection at a time
 	net::server server(atoi(port), 1);
 	printf("Server is at %s:%s\n", server.ip(), port);
-	printf("Waiting for client...\n");
-	net::client client = server.accept();
-	// get the number of bytes to receive first
-	int bytes = client.read<int>();
-	printf("Receiving file (size=%.3fKB)...\n", bytes / 1000.0f);
-	char* buffer = new char[bytes];
-	// write into the buffer
-	try {client.read(buffer, bytes);}
-	catch (net::socket_exception ex) {
-		printf("Receive failed %s\n", ex.what());
-		delete[] buffer;
-		return EXIT_FAILURE;
-	}
-	printf("Writing to file...\n");
-	// write to file
-	try {
-		ofstream file(filename);
-		file.write(buffer, bytes);
-		client.send(true);
-		printf("Downloaded file to %s\n", filename);
-	} catch (...) {
-		printf("Could not write to file\n");
-		client.send(false);
+	while (true) {
+		printf("Waiting for client...\n");
+		net::client client = server.accept();
+		// get the file being sent first
+		transfer_header header;
+		if (!client.read(header)) continue;
+		// bound the size too, so counting the chunks cannot overflow and their bitmap stays small
+		if (header.chunk < 1 || header.chunk > MAX_CHUNK || header.size > UINT64_MAX - header.chunk
+			|| chunk_count(header) / 8 > MAX_BITMAP) {
+			printf("Invalid transfer header\n");
+			continue;
+		}
+		manifest verified(manifest_path, header);
+		// only resume into the file the manifest was written for
+		struct stat info;
+		if (verified.resumed() && (stat(filename, &info) < 0 || (uint64_t) info.st_size != header.size))
+			verified.clear();
+		bool resumed = verified.resumed();
+		if (resumed) printf("Resuming file (size=%.3fKB), %llu of %llu chunks missing...\n", header.size / 1000.0,
+			(unsigned long long) verified.missing(), (unsigned long long) chunk_count(header));
+		else printf("Receiving file (size=%.3fKB)...\n", header.size / 1000.0);
+		try {
+			// preallocate the file, keeping its contents if resuming
+			net::mapped_file file(filename, header.size, !resumed);
+			receive_chunks(client, header, file, verified);
+		} catch (net::socket_exception& ex) {
+			printf("Receive failed %s\n", ex.what());
+			return EXIT_FAILURE;
+		}
+		if (!verified.missing()) break;
+		printf("Connection lost with %llu chunks missing\n", (unsigned long long) verified.missing());
 	}
-	delete[] buffer;
-}
\ No newline at end of file
+	remove(manifest_path.c_str());
+	printf("Downloaded file to %s\n", filename);
+}
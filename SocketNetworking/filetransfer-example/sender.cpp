@@ -1,54 +1,117 @@
 /**
- * Send a file to a server through network by sending the number of bytes first.
+ * Send a file to a server through network in checksummed chunks, resending only the chunks the server is missing.
  */
 #include <iostream>
-#include <fstream>
-#include <iterator>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+#include <signal.h>			// signal()
+#include <fcntl.h>			// open()
+#include <sys/stat.h>		// fstat()
+#include <sys/mman.h>		// mmap(), munmap()
 #include "../net_client.hpp"
+#include "../net_pool.hpp"
+#include "../net_crc32c.hpp"
+#include "chunk.hpp"
 
 using namespace std;
 
+// sends every chunk that is not set in the bitmap of the receiver
+void send_missing(net::client& client, int file, const transfer_header& header, const vector<unsigned char>& bitmap) {
+	static const uint64_t page = sysconf(_SC_PAGESIZE);
+	for (uint64_t k = 0; k < chunk_count(header) && client; ++k) {
+		if (chunk_bit(bitmap.data(), k)) continue;
+		chunk_header chunk = {k, chunk_length(header, k), 0};
+		uint64_t offset = k * header.chunk;
+		// checksum the chunk in the page cache through a mapping, which then also serves sendfile() without another read
+		uint64_t start = offset - offset % page;
+		size_t mapped = chunk.length + (offset - start);
+		void* memory = mmap(NULL, mapped, PROT_READ, MAP_SHARED | MAP_POPULATE, file, start);
+		if (memory == MAP_FAILED)
+			throw net::socket_exception("mmap()");
+		chunk.crc = net::crc32c((char*) memory + (offset - start), chunk.length);
+		munmap(memory, mapped);
+		client.send(chunk);
+		client.send_file(file, offset, chunk.length);
+	}
+}
+
 int main(int argc, char* argv[]) {
 	// get arguments
 	if (argc < 4) {
 		printf("Some missing arguments\n");
-		printf("Format: %s <host> <port> <filename>\n", argv[0]);
+		printf("Format: %s <host> <port> <filename> [chunk_kb=1024]\n", argv[0]);
 		return 0;
 	}
 	char* host = argv[1];
 	char* port = argv[2];
 	char* filename = argv[3];
+	uint64_t chunk = (argc > 4 ? atoll(argv[4]) : 1024) * 1024;
+	if (chunk < 1 || chunk > MAX_CHUNK) {
+		printf("The chunk size must be from 1 KB to %llu KB\n", (unsigned long long) MAX_CHUNK / 1024);
+		return EXIT_FAILURE;
+	}
 	// retrieve file
-	ifstream file(filename);
-	if (!file) {
+	int file = open(filename, O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) < 0) {
 		printf("File not found\n");
 		return EXIT_FAILURE;
 	}
-	// connect to the server
-	net::client client;
-	while (!client) {
-		try {client = net::client(host, atoi(port));}
-		catch (net::socket_exception) {
-			printf("Cannot connect to \"%s:%s\". Attempting to reconnect...\n", host, port);
-			sleep(3);
+	transfer_header header = {(uint64_t) info.st_size, chunk, (int64_t) info.st_mtime};
+	// a lost connection should be resumed instead of killing the process
+	signal(SIGPIPE, SIG_IGN);
+	vector<unsigned char> bitmap((chunk_count(header) + 7) / 8);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool done = false, stalled = false;
+	net::backoff retry;
+	while (!done && !stalled) {
+		// connect to the server
+		net::client client;
+		while (!client) {
+			try {client = net::client(host, atoi(port), 5000);}
+			catch (net::socket_exception) {
+				printf("Cannot connect to \"%s:%s\". Attempting to reconnect...\n", host, port);
+				retry.wait();
+			}
+		}
+		retry.reset();
+		try {
+			client.send(header);
+			// the server replies with the chunks it has verified, until it has all of them
+			uint64_t previous = chunk_count(header) + 1;
+			int rounds_without_progress = 0;
+			while (client.read(bitmap.data(), bitmap.size())) {
+				uint64_t missing = 0;
+				for (uint64_t k = 0; k < chunk_count(header); ++k)
+					missing += !chunk_bit(bitmap.data(), k);
+				if (!missing) {
+					done = true;
+					break;
+				}
+				if (missing >= previous && ++rounds_without_progress == 3) {
+					// the same chunks keep failing their checksum, e.g. the file is being modified
+					stalled = true;
+					break;
+				}
+				previous = missing;
+				printf("Uploading %llu of %llu chunks...\n", (unsigned long long) missing, (unsigned long long) chunk_count(header));
+				send_missing(client, file, header, bitmap);
+			}
+		} catch (net::socket_exception& ex) {
+			printf("Upload interrupted: %s\n", ex.what());
+		}
+		if (!done && !stalled) {
+			printf("Connection lost. Attempting to resume...\n");
+			retry.wait();
 		}
 	}
-	printf("Waiting for upload to finish...\n");
-	// get size of file
-	file.seekg(0, file.end);
-	int bytes = file.tellg();
-	file.seekg(0);
-	// read file to memory
-	char* buffer = new char[bytes];
-	file.read(buffer, bytes);
-	file.close();
-	client.send(bytes);			// send file number of bytes first
-	client.send(buffer, bytes); // then send the actual file
-	delete[] buffer;
-	// receive a ping back that all is ok
-	if (client.read<bool>()) printf("Uploaded %s (size=%.3fKB)\n", filename, bytes / 1000.0f);
-	else printf("An error occured in uploading %s (size=%dB)\n", filename, bytes);
-}
\ No newline at end of file
+	close(file);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	if (done) printf("Uploaded %s (size=%.3fKB) in %.3fs, %.2f MB/s\n", filename, header.size / 1000.0, seconds, header.size / seconds / 1e6);
+	else printf("An error occured in uploading %s (size=%lluB)\n", filename, (unsigned long long) header.size);
+	return done ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,12 +2,13 @@
  * Send a file to a server through network, without sending the number of bytes
  */
 #include <iostream>
-#include <fstream>
-#include <iterator>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <fcntl.h>			// open()
+#include <sys/stat.h>		// fstat()
 #include "../net_client.hpp"
+#include "../net_pool.hpp"
 
 using namespace std;
 
@@ -22,31 +23,27 @@ int main(int argc, char* argv[]) {
 	char* port = argv[2];
 	char* filename = argv[3];
 	// retrieve file
-	ifstream file(filename);
-	if (!file) {
+	int file = open(filename, O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) < 0) {
 		printf("File not found\n");
 		return EXIT_FAILURE;
 	}
 	// connect to the server
 	printf("Connecting to server...\n");
 	net::client client;
+	net::backoff retry;
 	while (!client) {
-		try {client = net::client(host, atoi(port));}
+		try {client = net::client(host, atoi(port), 5000);}
 		catch (net::socket_exception) {
 			printf("Cannot connect to \"%s:%s\". Attempting to reconnect...\n", host, port);
-			sleep(3);
+			retry.wait();
 		}
 	}
 	printf("Waiting for upload to finish...\n");
 	// get size of file
-	file.seekg(0, file.end);
-	int bytes = file.tellg();
-	file.seekg(0);
-	// read file to memory
-	char* buffer = new char[bytes];
-	file.read(buffer, bytes);
-	file.close();
-	client.send(buffer, bytes); // send the file
-	delete[] buffer;
+	off_t bytes = info.st_size;
+	client.send_file(file, 0, bytes); // stream the file straight from the page cache
+	close(file);
 	printf("Uploaded %s (size=%.3fKB)\n", filename, bytes / 1000.0f);
-}
\ No newline at end of file
+}
@@ -0,0 +1,661 @@
+/**
+ * This header serializes values for net::client as bytes with a fixed
+ * layout, so that containers and structs can be sent safely, unlike
+ * client::send(T), which copies the sizeof(T) bytes of a value as they
+ * are in memory, pointers and all.
+ *
+ * Integers and floating point numbers are sent least significant byte
+ * first. Strings, vectors and other sequences are sent as their length,
+ * as a varint, followed by their elements. Structs list their fields
+ * with NET_FIELDS(), and are sent field by field.
+ *
+ * Whatever is already laid out in memory as it would be sent is copied
+ * with a single memcpy(): numbers on little-endian hosts, arrays of them,
+ * and structs whose fields are all such values with no padding between
+ * them. This is decided at compile time for every type, so a vector of
+ * such structs is sent as its length and one block of bytes, and other
+ * types fall back to their fields without any check at run time. Since
+ * other hosts send such a struct field by field, its NET_FIELDS() must
+ * list its fields in the order they are declared; this is checked once
+ * per type, on the first value that is copied.
+ *
+ *     struct point {
+ *         int32_t x, y;
+ *         NET_FIELDS(x, y)
+ *     };
+ *
+ *     net::oarchive out(client);
+ *     out << string("points") << vector<point>(100);
+ *     out.flush();                    // a single send()
+ *
+ *     net::iarchive in(client);
+ *     string name = in.get<string>();
+ *     vector<point> points = in.get<vector<point> >();
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_ARCHIVE__
+#define __INCLUDE_NET_ARCHIVE__
+
+#include <cstring>			// memcpy()
+#include <cerrno>			// errno
+#include <cstdint>			// uint64_t
+#include <string>			// std::string
+#include <vector>			// std::vector
+#include <array>			// std::array
+#include <utility>			// std::pair, std::declval()
+#include <tuple>			// std::tuple, std::tie()
+#include <type_traits>		// std::integral_constant, std::enable_if, std::is_trivially_copyable
+#include <algorithm>		// std::reverse()
+#include "net_socket.hpp"	// net::socket_exception
+#include "net_client.hpp"	// net::client, net::varint_encode(), net::varint_decode()
+
+/**
+ * declares the fields of a struct that are serialized by net::oarchive and net::iarchive, in order; a struct that is
+ * copied as a whole (see net::is_bitwise) must list them in the order they are declared
+ * e.g. struct point {int32_t x, y; NET_FIELDS(x, y)};
+ */
+
+#define NET_FIELDS(...) \
+	auto net_fields() -> decltype(std::tie(__VA_ARGS__)) {return std::tie(__VA_ARGS__);} \
+	auto net_fields() const -> decltype(std::tie(__VA_ARGS__)) {return std::tie(__VA_ARGS__);}
+
+namespace net {
+
+	using namespace std;
+
+	class oarchive;
+	class iarchive;
+
+	/**
+	 * true if numbers are stored least significant byte first, as they are sent
+	 */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	const bool HOST_LITTLE_ENDIAN = false;
+#else
+	const bool HOST_LITTLE_ENDIAN = true;
+#endif
+
+	/**
+	 * @brief      checks if a type declares its fields with NET_FIELDS()
+	 */
+
+	template <typename T>
+	class has_fields {
+		template <typename U> static char test(typename remove_reference<decltype(declval<const U&>().net_fields())>::type*);
+		template <typename U> static long test(...);
+	public:
+		static const bool value = sizeof(test<T>(0)) == sizeof(char);
+	};
+
+	template <typename T, typename Enable = void> struct is_bitwise;
+
+	/**
+	 * @brief      checks if every field in a list is sent as it is in memory, and adds up their sizes
+	 */
+
+	template <typename... Fields> struct fields_layout;
+
+	template <>
+	struct fields_layout<> {
+		static const bool bitwise = true;
+		static const size_t size = 0;
+	};
+
+	template <typename Field, typename... Fields>
+	struct fields_layout<Field, Fields...> {
+		typedef typename decay<Field>::type type;
+		static const bool bitwise = is_bitwise<type>::value && fields_layout<Fields...>::bitwise;
+		static const size_t size = sizeof(type) + fields_layout<Fields...>::size;
+	};
+
+	template <typename... Fields>
+	struct fields_layout<tuple<Fields...> > : fields_layout<Fields...> {};
+
+	/**
+	 * @brief      checks if a type is sent as it is in memory, so it can be copied with memcpy()
+	 * @details    true for numbers and enums on little-endian hosts, arrays of such types, and structs whose
+	 *             NET_FIELDS() are all such types and fill the whole struct
+	 */
+
+	template <typename T, typename Enable>
+	struct is_bitwise : integral_constant<bool, HOST_LITTLE_ENDIAN && (is_arithmetic<T>::value || is_enum<T>::value)> {};
+
+	template <typename T, size_t N>
+	struct is_bitwise<T[N]> : is_bitwise<T> {};
+
+	template <typename T, size_t N>
+	struct is_bitwise<array<T, N> > : integral_constant<bool, is_bitwise<T>::value && sizeof(array<T, N>) == N * sizeof(T)> {};
+
+	template <typename T>
+	struct is_bitwise<T, typename enable_if<has_fields<T>::value>::type> {
+		typedef fields_layout<decltype(declval<const T&>().net_fields())> layout;
+		static const bool value = layout::bitwise && layout::size == sizeof(T) && is_trivially_copyable<T>::value;
+	};
+
+	template <size_t Index, size_t Count> struct fields_order;
+
+	/**
+	 * @brief      checks that the NET_FIELDS() of a struct copied as a whole, and of the structs within it, are listed
+	 *             in the order they are declared, so the bytes copied match the fields sent by big-endian hosts
+	 * @details    the sizes of such fields add up to the size of the struct, so they are in order exactly when each one
+	 *             starts where the one listed before it ends; checked once per type, on the first value given
+	 */
+
+	template <typename T, typename Enable = void>
+	struct fields_in_order {
+		static bool check(const T&) {return true;}
+	};
+
+	template <typename T, size_t N>
+	struct fields_in_order<T[N]> {
+		static bool check(const T (&value)[N]) {return fields_in_order<T>::check(value[0]);}
+	};
+
+	template <typename T, size_t N>
+	struct fields_in_order<array<T, N> > {
+		static bool check(const array<T, N>& value) {return !N || fields_in_order<T>::check(value[0]);}
+	};
+
+	template <typename T>
+	struct fields_in_order<T, typename enable_if<has_fields<T>::value>::type> {
+		static bool check(const T& value) {
+			typedef decltype(value.net_fields()) fields;
+			static const bool ordered = fields_order<0, tuple_size<fields>::value>::check(value.net_fields(), (const char*) &value);
+			return ordered;
+		}
+	};
+
+	template <size_t Index, size_t Count>
+	struct fields_order {
+		template <typename Tuple>
+		static bool check(const Tuple& fields, const char* start) {
+			typedef typename decay<typename tuple_element<Index, Tuple>::type>::type type;
+			const type& field = get<Index>(fields);
+			return (const char*) &field == start && fields_in_order<type>::check(field)
+				&& fields_order<Index + 1, Count>::check(fields, start + sizeof(type));
+		}
+	};
+
+	template <size_t Count>
+	struct fields_order<Count, Count> {
+		template <typename Tuple> static bool check(const Tuple&, const char*) {return true;}
+	};
+
+	/**
+	 * @brief      throws if the NET_FIELDS() of a value copied as a whole are not in declaration order
+	 * @throw      a socket_exception with EINVAL, see fields_in_order
+	 */
+
+	template <typename T>
+	inline void check_fields_order(const T& value) NET_THROWS(socket_exception) {
+		if (!fields_in_order<T>::check(value)) {
+			errno = EINVAL;
+			throw socket_exception("net::NET_FIELDS() out of declaration order");
+		}
+	}
+
+	/**
+	 * @brief      the ways a type can be serialized, chosen at compile time
+	 */
+
+	enum archive_method {
+		ARCHIVE_BITWISE,	// copied as it is in memory
+		ARCHIVE_SWAPPED,	// a number copied in reverse byte order, on big-endian hosts
+		ARCHIVE_FIELDS,		// a struct sent field by field
+		ARCHIVE_CUSTOM		// a type with its own serializer, e.g. a container
+	};
+
+	template <typename T>
+	struct archive_method_of : integral_constant<archive_method,
+		is_bitwise<T>::value ? ARCHIVE_BITWISE :
+		is_arithmetic<T>::value || is_enum<T>::value ? ARCHIVE_SWAPPED :
+		has_fields<T>::value ? ARCHIVE_FIELDS : ARCHIVE_CUSTOM> {};
+
+	/**
+	 * @brief      writes values of a type into an oarchive, and reads them back from an iarchive
+	 * @details    specialize this for ARCHIVE_CUSTOM types that cannot declare NET_FIELDS()
+	 * @tparam     T       the type to serialize
+	 * @tparam     Method  how the type is serialized
+	 */
+
+	template <typename T, archive_method Method = archive_method_of<T>::value>
+	struct serializer {
+		static_assert(Method != ARCHIVE_CUSTOM || sizeof(T) == 0, "net::serializer: declare the fields of this type with NET_FIELDS()");
+	};
+
+	/**
+	 * the output archive, which collects serialized values into bytes to send at once
+	 */
+
+	class oarchive {
+
+	protected:
+
+		/**
+		 * the client that oarchive::flush() sends to, if any
+		 */
+
+		client* target;
+
+		/**
+		 * the serialized bytes that were not sent yet
+		 */
+
+		string bytes;
+
+	public:
+
+		/**
+		 * @brief      constructs an archive that only collects bytes, see oarchive::str()
+		 */
+
+		oarchive(): target(NULL) {}
+
+		/**
+		 * @brief      constructs an archive that sends its bytes to a client on oarchive::flush()
+		 * @param      target  the client to send to
+		 */
+
+		explicit oarchive(client& target): target(&target) {}
+
+		/**
+		 * @brief      appends raw bytes
+		 * @param[in]  data   the bytes to append
+		 * @param[in]  bytes  the number of bytes
+		 * @return     a reference to this archive
+		 */
+
+		oarchive& write(const void* data, size_t bytes) {
+			this->bytes.append((const char*) data, bytes);
+			return *this;
+		}
+
+		/**
+		 * @brief      appends the length of a sequence as a varint
+		 * @param[in]  count  the number of elements
+		 * @return     a reference to this archive
+		 */
+
+		oarchive& write_size(uint64_t count) {
+			char header[VARINT_MAX_BYTES];
+			return write(header, varint_encode(count, header));
+		}
+
+		/**
+		 * @brief      appends a serialized value
+		 * @param[in]  value  the value to serialize
+		 * @tparam     T      the type of the value
+		 * @return     a reference to this archive
+		 */
+
+		template <typename T>
+		oarchive& operator << (const T& value) {
+			serializer<T>::save(*this, value);
+			return *this;
+		}
+
+		/**
+		 * @brief      appends a C string like a string, as its length and its characters
+		 * @param[in]  value  the string to serialize
+		 * @return     a reference to this archive
+		 */
+
+		oarchive& operator << (const char* value) {
+			return *this << string(value);
+		}
+
+		/**
+		 * @brief      sends every collected byte to the client with a single send, then empties the archive
+		 * @throw      a socket_exception if there was an error in sending, or if the archive has no client
+		 */
+
+		void flush() NET_THROWS(socket_exception) {
+			if (!target) {
+				errno = ENOTCONN;
+				throw socket_exception("oarchive::flush()");
+			}
+			target->send(bytes.data(), bytes.size());
+			bytes.clear();
+		}
+
+		/**
+		 * @brief      gets the collected bytes, e.g. to send them with client::send_frame()
+		 */
+
+		inline const string& str() const {
+			return bytes;
+		}
+
+		/**
+		 * @brief      gets the number of collected bytes
+		 */
+
+		inline size_t size() const {
+			return bytes.size();
+		}
+
+		/**
+		 * @brief      discards every collected byte
+		 */
+
+		inline void clear() {
+			bytes.clear();
+		}
+
+	};
+
+	/**
+	 * the input archive, which reads serialized values from a client or from a block of bytes
+	 */
+
+	class iarchive {
+
+	protected:
+
+		/**
+		 * the client to read from, or NULL to read from input
+		 */
+
+		client* source;
+
+		/**
+		 * the bytes left to read, when there is no client
+		 */
+
+		const char* input;
+		size_t remaining;
+
+	public:
+
+		/**
+		 * @brief      constructs an archive that reads from a client; buffer the client so small values do not cost a recv() each
+		 * @param      source  the client to read from
+		 */
+
+		explicit iarchive(client& source): source(&source), input(NULL), remaining(0) {}
+
+		/**
+		 * @brief      constructs an archive that reads from a block of bytes, e.g. a frame from client::read_frame()
+		 * @param[in]  data   the bytes to read; must stay valid while the archive is used
+		 * @param[in]  bytes  the number of bytes
+		 */
+
+		iarchive(const void* data, size_t bytes): source(NULL), input((const char*) data), remaining(bytes) {}
+
+		/**
+		 * @brief      reads raw bytes
+		 * @param      data   where to put the bytes
+		 * @param[in]  bytes  the number of bytes to read
+		 * @throw      a socket_exception if there was an error in receiving, or if the input ended first
+		 * @return     a reference to this archive
+		 */
+
+		iarchive& read(void* data, size_t bytes) NET_THROWS(socket_exception) {
+			if (source) {
+				if (!source->read((char*) data, bytes)) {
+					errno = ECONNRESET;
+					throw socket_exception("iarchive::read()");
+				}
+				return *this;
+			}
+			if (bytes > remaining) {
+				errno = EBADMSG;
+				throw socket_exception("iarchive::read()");
+			}
+			memcpy(data, input, bytes);
+			input += bytes;
+			remaining -= bytes;
+			return *this;
+		}
+
+		/**
+		 * @brief      reads the length of a sequence, and checks that it could fit in a message
+		 * @param[in]  element  the size of an element of the sequence in bytes
+		 * @throw      a socket_exception if the length could not be read, or if the elements would be larger than
+		 *             client::MAX_FRAME_SIZE, or than what is left of a block of bytes
+		 * @return     the number of elements
+		 */
+
+		uint64_t read_size(size_t element) NET_THROWS(socket_exception) {
+			char header[VARINT_MAX_BYTES];
+			uint64_t count;
+			size_t bytes = 0;
+			do read(header + bytes++, 1);
+			while (!varint_decode(header, bytes, count));
+			uint64_t limit = (source ? client::MAX_FRAME_SIZE : remaining) / (element ? element : 1);
+			if (count > limit) {
+				errno = EMSGSIZE;
+				throw socket_exception("iarchive::read_size()");
+			}
+			return count;
+		}
+
+		/**
+		 * @brief      reads a serialized value
+		 * @param      value  where to put the value
+		 * @tparam     T      the type of the value
+		 * @throw      a socket_exception if there was an error in receiving, or if the input ended first
+		 * @return     a reference to this archive
+		 */
+
+		template <typename T>
+		iarchive& operator >> (T& value) NET_THROWS(socket_exception) {
+			serializer<T>::load(*this, value);
+			return *this;
+		}
+
+		/**
+		 * @brief      reads a serialized value of a default constructible type
+		 * @tparam     T     the type of the value
+		 * @throw      a socket_exception if there was an error in receiving, or if the input ended first
+		 * @return     the value
+		 */
+
+		template <typename T>
+		T get() NET_THROWS(socket_exception) {
+			T value;
+			*this >> value;
+			return value;
+		}
+
+		/**
+		 * @brief      gets the number of bytes left in a block of bytes; always 0 when reading from a client
+		 */
+
+		inline size_t available() const {
+			return remaining;
+		}
+
+	};
+
+	/**
+	 * @brief      copies values that are sent as they are in memory
+	 */
+
+	template <typename T>
+	struct serializer<T, ARCHIVE_BITWISE> {
+		static void save(oarchive& out, const T& value) {
+			check_fields_order(value);
+			out.write(&value, sizeof value);
+		}
+		static void load(iarchive& in, T& value) {
+			check_fields_order(value);
+			in.read(&value, sizeof value);
+		}
+	};
+
+	/**
+	 * @brief      copies numbers in reverse byte order, on big-endian hosts
+	 */
+
+	template <typename T>
+	struct serializer<T, ARCHIVE_SWAPPED> {
+		static void save(oarchive& out, const T& value) {
+			char bytes[sizeof value];
+			memcpy(bytes, &value, sizeof value);
+			reverse(bytes, bytes + sizeof value);
+			out.write(bytes, sizeof value);
+		}
+		static void load(iarchive& in, T& value) {
+			char bytes[sizeof value];
+			in.read(bytes, sizeof value);
+			reverse(bytes, bytes + sizeof value);
+			memcpy(&value, bytes, sizeof value);
+		}
+	};
+
+	/**
+	 * @brief      visits the fields of a struct in order
+	 */
+
+	template <size_t Index, size_t Count>
+	struct fields_visitor {
+		template <typename Tuple>
+		static void save(oarchive& out, const Tuple& fields) {
+			out << get<Index>(fields);
+			fields_visitor<Index + 1, Count>::save(out, fields);
+		}
+		template <typename Tuple>
+		static void load(iarchive& in, const Tuple& fields) {
+			in >> get<Index>(fields);
+			fields_visitor<Index + 1, Count>::load(in, fields);
+		}
+	};
+
+	template <size_t Count>
+	struct fields_visitor<Count, Count> {
+		template <typename Tuple> static void save(oarchive&, const Tuple&) {}
+		template <typename Tuple> static void load(iarchive&, const Tuple&) {}
+	};
+
+	/**
+	 * @brief      sends a struct field by field, for structs that cannot be copied as a whole
+	 */
+
+	template <typename T>
+	struct serializer<T, ARCHIVE_FIELDS> {
+		static void save(oarchive& out, const T& value) {
+			typedef decltype(value.net_fields()) fields;
+			fields_visitor<0, tuple_size<fields>::value>::save(out, value.net_fields());
+		}
+		static void load(iarchive& in, T& value) {
+			typedef decltype(value.net_fields()) fields;
+			fields_visitor<0, tuple_size<fields>::value>::load(in, value.net_fields());
+		}
+	};
+
+	/**
+	 * @brief      sends an array element by element, when its elements cannot be copied as a whole
+	 */
+
+	template <typename T, size_t N>
+	struct serializer<T[N], ARCHIVE_CUSTOM> {
+		static void save(oarchive& out, const T (&value)[N]) {
+			for (size_t i = 0; i < N; ++i)
+				out << value[i];
+		}
+		static void load(iarchive& in, T (&value)[N]) {
+			for (size_t i = 0; i < N; ++i)
+				in >> value[i];
+		}
+	};
+
+	template <typename T, size_t N>
+	struct serializer<array<T, N>, ARCHIVE_CUSTOM> {
+		static void save(oarchive& out, const array<T, N>& value) {
+			for (size_t i = 0; i < N; ++i)
+				out << value[i];
+		}
+		static void load(iarchive& in, array<T, N>& value) {
+			for (size_t i = 0; i < N; ++i)
+				in >> value[i];
+		}
+	};
+
+	/**
+	 * @brief      sends a string as its length and one block of characters
+	 */
+
+	template <>
+	struct serializer<string, ARCHIVE_CUSTOM> {
+		static void save(oarchive& out, const string& value) {
+			out.write_size(value.size());
+			out.write(value.data(), value.size());
+		}
+		static void load(iarchive& in, string& value) {
+			value.resize(in.read_size(1));
+			if (!value.empty())
+				in.read(&value[0], value.size());
+		}
+	};
+
+	/**
+	 * @brief      sends a vector as its length and one block of elements, or its elements one by one if they
+	 *             cannot be copied as they are
+	 * @details    elements received one by one are appended as they are decoded, so a large length only costs memory
+	 *             once its elements actually arrive
+	 */
+
+	template <typename T>
+	struct serializer<vector<T>, ARCHIVE_CUSTOM> {
+		static const bool block = is_bitwise<T>::value && !is_same<T, bool>::value;
+		static const size_t RESERVE_LIMIT = 64 * 1024; // bytes reserved up front for elements received one by one
+		static void save(oarchive& out, const vector<T>& value) {
+			out.write_size(value.size());
+			save(out, value, integral_constant<bool, block>());
+		}
+		static void load(iarchive& in, vector<T>& value) {
+			load(in, value, integral_constant<bool, block>());
+		}
+		static void save(oarchive& out, const vector<T>& value, true_type) {
+			if (!value.empty())
+				check_fields_order(value[0]);
+			out.write(value.data(), value.size() * sizeof(T));
+		}
+		static void load(iarchive& in, vector<T>& value, true_type) {
+			value.resize(in.read_size(sizeof(T)));
+			if (!value.empty())
+				check_fields_order(value[0]);
+			in.read(value.data(), value.size() * sizeof(T));
+		}
+		static void save(oarchive& out, const vector<T>& value, false_type) {
+			for (typename vector<T>::const_iterator it = value.begin(); it != value.end(); ++it)
+				out << (const T&) *it;
+		}
+		static void load(iarchive& in, vector<T>& value, false_type) {
+			uint64_t count = in.read_size(1);
+			value.clear();
+			value.reserve(count < RESERVE_LIMIT / sizeof(T) ? count : RESERVE_LIMIT / sizeof(T));
+			for (uint64_t i = 0; i < count; ++i) {
+				T element;
+				in >> element;
+				value.push_back(element);
+			}
+		}
+	};
+
+	template <typename T>
+	const size_t serializer<vector<T>, ARCHIVE_CUSTOM>::RESERVE_LIMIT;
+
+	/**
+	 * @brief      sends a pair as its first value, then its second
+	 */
+
+	template <typename First, typename Second>
+	struct serializer<pair<First, Second>, ARCHIVE_CUSTOM> {
+		static void save(oarchive& out, const pair<First, Second>& value) {
+			out << value.first << value.second;
+		}
+		static void load(iarchive& in, pair<First, Second>& value) {
+			in >> value.first >> value.second;
+		}
+	};
+
+}
+
+#endif /* __INCLUDE_NET_ARCHIVE__ */
@@ -9,13 +9,30 @@
  * "client" class, this does not in any way mean that the server cannot
  * make use of its functions. In a server-client model, a server can accept
  * multiple clients through the net::server::accept() method, which can
- * be wrapped into the net::client object.
+ * be wrapped into the net::client object. Hostnames are looked up through
+ * the cache of net::resolver::shared(), and an optional timeout bounds
+ * how long connecting may take.
  * 
  * Unlike net::isocketstream and net::osocketstream which stream data as
  * characters, net::client sends and reads data in raw bytes, which is 
- * buffer-free and more efficient. It does so through implicit conversion
- * using C++ templates, given that the data sent or received are either
- * strings, integral data types, or structs without pointers.
+ * more efficient. It does so through implicit conversion using C++
+ * templates, given that the data sent or received are either strings,
+ * integral data types, or structs without pointers.
+ * 
+ * By default, net::client reads straight from the socket. Calling
+ * client::buffer() gives the client a receive buffer that is filled with
+ * large recv() calls, so that strings and small values are parsed from
+ * memory instead of costing one system call each. Copies of a client
+ * share the same receive buffer, since they share the same socket.
+ * 
+ * For binary payloads, client::send_frame() prefixes the data with its
+ * length as a varint instead of terminating it, and client::read_frame()
+ * returns a net::frame, a non-owning view into the receive buffer that
+ * stays valid until the next read on the client.
+ * 
+ * Files can be sent with client::send_file(), which lets the kernel copy
+ * them straight from the page cache to the socket, so they never pass
+ * through a buffer in this process no matter how large they are.
  * 
  * When net::client sends strings, it also sends a terminating '\0' char
  * to the receiver, such that strings sent or received can be identified
@@ -32,30 +49,398 @@
 
 #include <cstring>			// std::strlen()
 #include <string>			// std::string
+#include <utility>			// std::move()
+#include <memory>			// std::shared_ptr
+#include <type_traits>		// std::aligned_storage
+#include <stdint.h>			// uint64_t
 #include <sys/types.h>		// sockaddr, sockaddr_in
-#include <sys/socket.h>		// connect(), send(), recv()
-#include <netdb.h>			// gethostbyname()
+#include <sys/socket.h>		// connect(), send(), recv(), sendmsg()
+#include <sys/uio.h>		// iovec
+#include <sys/sendfile.h>	// sendfile()
+#include <fcntl.h>			// splice(), pipe2()
+#include <unistd.h>			// close()
+#include <poll.h>			// poll()
+#include <chrono>			// std::chrono::steady_clock
 #include <arpa/inet.h>		// htons()
 #include "net_socket.hpp"	// net::socket, net::socket_exception
+#include "net_resolver.hpp"	// net::resolver
 
 namespace net {
 
 	using namespace std;
 
+	/**
+	 * the maximum number of bytes used by an encoded varint
+	 */
+
+	const size_t VARINT_MAX_BYTES = 10;
+
+	/**
+	 * @brief      encodes an unsigned integer as a varint, 7 bits per byte, least significant group first
+	 * @param[in]  value   the integer to encode
+	 * @param      output  where to write the encoded bytes; must have room for VARINT_MAX_BYTES
+	 * @return     the number of bytes written
+	 */
+
+	inline size_t varint_encode(uint64_t value, char* output) {
+		size_t bytes = 0;
+		while (value >= 0x80) {
+			output[bytes++] = (char) (value | 0x80);
+			value >>= 7;
+		}
+		output[bytes++] = (char) value;
+		return bytes;
+	}
+
+	/**
+	 * @brief      decodes a varint from the front of a byte array
+	 * @param[in]  input  the encoded bytes
+	 * @param[in]  bytes  the number of bytes available in the input
+	 * @param      value  where to put the decoded integer
+	 * @throw      a socket_exception if the varint is longer than VARINT_MAX_BYTES
+	 * @return     the number of bytes the varint used, or 0 if the input ends before the varint does
+	 */
+
+	inline size_t varint_decode(const char* input, size_t bytes, uint64_t& value) NET_THROWS(socket_exception) {
+		value = 0;
+		for (size_t i = 0; i < bytes && i < VARINT_MAX_BYTES; ++i) {
+			value |= (uint64_t) (input[i] & 0x7f) << (7 * i);
+			if (!(input[i] & 0x80))
+				return i + 1;
+		}
+		if (bytes >= VARINT_MAX_BYTES) {
+			errno = EBADMSG;
+			throw socket_exception("net::varint_decode()");
+		}
+		return 0;
+	}
+
+	/**
+	 * @brief      a non-owning view of a framed message
+	 * @details    when returned by client::read_frame(), it points into the client's receive buffer and stays valid until the next read on that client
+	 */
+
+	class frame {
+	public:
+
+		/**
+		 * the first byte of the payload
+		 */
+
+		const char* data;
+
+		/**
+		 * the number of bytes in the payload
+		 */
+
+		size_t size;
+
+		/**
+		 * @brief      constructs a view of a payload
+		 * @param[in]  data  the first byte of the payload
+		 * @param[in]  size  the number of bytes in the payload
+		 */
+
+		frame(const char* data = NULL, size_t size = 0): data(data), size(size) {}
+
+		/**
+		 * @brief      gets an iterator to the first byte of the payload
+		 */
+
+		inline const char* begin() const {
+			return data;
+		}
+
+		/**
+		 * @brief      gets an iterator past the last byte of the payload
+		 */
+
+		inline const char* end() const {
+			return data + size;
+		}
+
+		/**
+		 * @brief      checks if the payload has no bytes
+		 */
+
+		inline bool empty() const {
+			return size == 0;
+		}
+
+		/**
+		 * @brief      copies the payload into an owning string
+		 */
+
+		inline string str() const {
+			return string(data, size);
+		}
+
+	};
+
+	/**
+	 * @brief      a receive buffer holding bytes that were received but not yet read
+	 * @details    unread bytes are kept in [begin, end) of the data array
+	 */
+
+	class recv_buffer {
+	public:
+
+		/**
+		 * the buffer storage
+		 */
+
+		char* data;
+
+		/**
+		 * the total number of bytes allocated for the buffer
+		 */
+
+		size_t capacity;
+
+		/**
+		 * the offset of the first unread byte
+		 */
+
+		size_t begin;
+
+		/**
+		 * the offset past the last unread byte
+		 */
+
+		size_t end;
+
+		/**
+		 * whether the buffer should be refilled when it runs out; false once the client goes back to raw reads
+		 */
+
+		bool refill;
+
+		/**
+		 * @brief      allocates an empty receive buffer
+		 * @param[in]  capacity  the number of bytes to allocate
+		 */
+
+		explicit recv_buffer(size_t capacity):
+			data(new char[capacity]),
+			capacity(capacity),
+			begin(0),
+			end(0),
+			refill(true) {}
+
+		/**
+		 * @brief      frees the buffer storage
+		 */
+
+		~recv_buffer() {
+			delete[] data;
+		}
+
+		/**
+		 * @brief      gets the number of unread bytes
+		 */
+
+		inline size_t size() const {
+			return end - begin;
+		}
+
+		/**
+		 * @brief      moves up to a certain number of unread bytes out of the buffer
+		 * @param      output  where to copy the bytes
+		 * @param[in]  bytes   the maximum number of bytes to copy
+		 * @return     the number of bytes copied
+		 */
+
+		size_t take(char* output, size_t bytes) {
+			if (bytes > size())
+				bytes = size();
+			memcpy(output, data + begin, bytes);
+			consume(bytes);
+			return bytes;
+		}
+
+		/**
+		 * @brief      discards a certain number of unread bytes
+		 * @param[in]  bytes  the number of bytes to discard; must not exceed size()
+		 */
+
+		inline void consume(size_t bytes) {
+			begin += bytes;
+			if (begin == end)
+				begin = end = 0;
+		}
+
+		/**
+		 * @brief      moves the unread bytes to the front, making all free space contiguous
+		 */
+
+		void compact() {
+			if (begin > 0) {
+				memmove(data, data + begin, size());
+				end -= begin;
+				begin = 0;
+			}
+		}
+
+		/**
+		 * @brief      grows the buffer so it can hold at least a certain number of bytes, keeping unread bytes
+		 * @param[in]  bytes  the minimum capacity
+		 */
+
+		void reserve(size_t bytes) {
+			if (bytes <= capacity) return;
+			char* grown = new char[bytes];
+			memcpy(grown, data + begin, size());
+			delete[] data;
+			data = grown;
+			end -= begin;
+			begin = 0;
+			capacity = bytes;
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		recv_buffer(const recv_buffer&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		recv_buffer& operator = (const recv_buffer&);
+
+	};
+
 	/**
 	 * @brief      a lightweight wrapper class for a client socket
 	 */
 
 	class client : public socket {
+	protected:
+
+		/**
+		 * the receive buffer shared by all copies of this client; NULL when the client reads straight from the socket
+		 */
+
+		shared_ptr<recv_buffer> rbuf;
+
+		/**
+		 * the number of microseconds a read polls without blocking before it sleeps; see socket_profile::spin
+		 */
+
+		unsigned spin;
+
+		/**
+		 * @brief      connects this socket to an address, giving up at a deadline
+		 * @details    with a deadline, connects in non-blocking mode and waits for the result with poll(), then
+		 *             restores blocking mode; sets errno to ETIMEDOUT if the deadline passed
+		 * @param[in]  address   the address to connect to
+		 * @param[in]  deadline  the time to give up at, or NULL to wait as long as connect() does
+		 * @return     true if this socket is connected
+		 */
+
+		bool connect(const sockaddr_in& address, const chrono::steady_clock::time_point* deadline) {
+			if (!deadline)
+				return ::connect(sockfd, (const sockaddr*) &address, sizeof address) == 0;
+			int flags = fcntl(sockfd, F_GETFL, 0);
+			if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+				return false;
+			bool connected = ::connect(sockfd, (const sockaddr*) &address, sizeof address) == 0;
+			if (!connected && errno == EINPROGRESS) {
+				struct pollfd pending = {sockfd, POLLOUT, 0};
+				int ready;
+				do {
+					chrono::milliseconds left = chrono::duration_cast<chrono::milliseconds>(*deadline - chrono::steady_clock::now());
+					ready = poll(&pending, 1, left.count() > 0 ? left.count() : 0);
+				} while (ready < 0 && errno == EINTR);
+				if (!ready)
+					errno = ETIMEDOUT;
+				else if (ready > 0) {
+					// the outcome of the connection is reported as a pending socket error
+					int error = 0;
+					socklen_t length = sizeof error;
+					if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &length) == 0)
+						connected = !(errno = error);
+				}
+			}
+			int error = errno;
+			fcntl(sockfd, F_SETFL, flags);
+			errno = error;
+			return connected;
+		}
+
+		/**
+		 * @brief      receives whatever is available up to a certain number of bytes, in a single recv() call
+		 * @details    closes this client socket if the connection was lost
+		 * @param      data   where to put the received bytes
+		 * @param[in]  bytes  the maximum number of bytes to receive
+		 * @throw      a socket_exception if there was an error in receiving
+		 * @return     the number of bytes received, which is 0 if the connection was lost
+		 */
+
+		size_t receive(char* data, size_t bytes) NET_THROWS(socket_exception) {
+			ssize_t received = -1;
+			if (spin) {
+				// a reply that arrives within the spin is picked up without the cost of sleeping and waking up
+				chrono::steady_clock::time_point until = chrono::steady_clock::now() + chrono::microseconds(spin);
+				do {
+					io_probe probe;
+					received = ::recv(sockfd, data, bytes, MSG_DONTWAIT);
+					probe.received(sockfd, bytes, received);
+				} while (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && chrono::steady_clock::now() < until);
+			}
+			if (received < 0 && (!spin || errno == EAGAIN || errno == EWOULDBLOCK)) {
+				io_probe probe;
+				received = ::recv(sockfd, data, bytes, 0);
+				probe.received(sockfd, bytes, received);
+			}
+			if (received < 0)
+				throw socket_exception("client::read()");
+			else if (!received)
+				close();
+			return received;
+		}
+
+		/**
+		 * @brief      fills the free space of the receive buffer with a single recv() call
+		 * @details    closes this client socket if the connection was lost
+		 * @throw      a socket_exception if there was an error in receiving
+		 * @return     the number of bytes received, which is 0 if the connection was lost
+		 */
+
+		size_t fill() NET_THROWS(socket_exception) {
+			if (rbuf->end == rbuf->capacity)
+				rbuf->compact();
+			size_t received = receive(rbuf->data + rbuf->end, rbuf->capacity - rbuf->end);
+			rbuf->end += received;
+			return received;
+		}
+
 	public:
 
+		/**
+		 * the default number of bytes allocated by client::buffer()
+		 */
+
+		static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+		/**
+		 * the largest payload accepted by client::read_frame(), to guard against corrupt or hostile headers
+		 */
+
+		static const size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
 		/**
 		 * @brief      constructs and wraps a file descriptor as a client socket
 		 * @details    does not call connect()
 		 * @param[in]  sockfd	a socket file descriptor
 		 */
 
-		client(int sockfd = -1): socket(sockfd) {}
+		client(int sockfd = -1): socket(sockfd), spin(0) {}
 
 		/**
 		 * @brief      constructs and wraps another socket as a client socket
@@ -63,32 +448,67 @@ namespace net {
 		 * @param[in]  sock		another socket
 		 */
 
-		client(const socket& sock): socket(sock) {}
+		client(const socket& sock): socket(sock), spin(0) {}
+
+		/**
+		 * @brief      constructs a client socket by taking over another socket
+		 * @details    does not call connect(); the other socket is left empty
+		 * @param[in]  sock		the socket to move from
+		 */
+
+		client(socket&& sock): socket(std::move(sock)), spin(0) {}
+
+		/**
+		 * @brief      constructs a copy of another client socket
+		 * @param[in]  sock		the client socket to copy
+		 */
+
+		client(const client& sock) = default;
+
+		/**
+		 * @brief      constructs a client socket by taking over another client socket
+		 * @param[in]  sock		the client socket to move from
+		 */
+
+		client(client&& sock) = default;
+
+		/**
+		 * @brief      copies another client socket
+		 * @param[in]  sock		the client socket to copy
+		 * @return     a reference to this client object
+		 */
+
+		client& operator = (const client& sock) = default;
+
+		/**
+		 * @brief      takes over another client socket
+		 * @param[in]  sock		the client socket to move from
+		 * @return     a reference to this client object
+		 */
+
+		client& operator = (client&& sock) = default;
 
 		/**
 		 * @brief      constructs and connects a client socket to a server with a specific host and port
-		 * @param[in]  host  the host server to connect to
-		 * @param[in]  port  the host port to connect to
+		 * @details    the host is resolved through resolver::shared(), so repeated connects to a host only look it up
+		 *             once; every address of the host is tried in order until one accepts the connection
+		 * @param[in]  host     the host server to connect to
+		 * @param[in]  port     the host port to connect to
+		 * @param[in]  timeout  the number of milliseconds to wait for a connection before failing with
+		 *                      ETIMEDOUT, or -1 to wait as long as connect() does [default: -1]
 		 * @throw      a socket_exception if client cannot connect to host
 		 */
 
-		client(const string& host, unsigned short port): socket() {
-			// get host by name
-			struct hostent *server = gethostbyname(host.c_str());
-			if (!server) {
-				errno = h_errno;
-				throw socket_exception("client::gethostbyname()");
+		client(const string& host, unsigned short port, int timeout = -1): socket(), spin(0) {
+			resolver::addresses addresses = resolver::shared().resolve(host, port);
+			chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+			for (size_t i = 0; i < addresses.size(); ++i) {
+				// a failed connect() leaves the socket unusable, so the next address needs a new one
+				if (i) socket::operator = (socket());
+				if (connect(addresses[i], timeout < 0 ? NULL : &deadline))
+					return;
 			}
-			// create socket address
-			struct sockaddr_in sad;
-			memset(&sad, 0, sizeof sad);
-			sad.sin_family = AF_INET;
-			sad.sin_port = htons(port);
-			// setup address structure
-			memcpy(&sad.sin_addr.s_addr, server->h_addr, server->h_length);
-			// connect
-			if (connect(sockfd, (sockaddr*) &sad, sizeof sad) < 0)
-				throw socket_exception("client::connect()");
+			throw socket_exception("client::connect()");
 		}
 
 		/**
@@ -102,9 +522,11 @@ namespace net {
 		 */
 
 		template <typename T>
-		client& send(T* data, size_t bytes) throw(socket_exception) {
+		client& send(T* data, size_t bytes) NET_THROWS(socket_exception) {
 			for (char* buffer = (char*) data; bytes;) {
-				ssize_t sent = ::send(sockfd, buffer, bytes, 0);
+				io_probe probe;
+				ssize_t sent = ::send(sockfd, buffer, bytes, MSG_NOSIGNAL);
+				probe.sent(sockfd, bytes, sent);
 				if (sent < 0)
 					throw socket_exception("client::send()");
 				else if (!sent) {
@@ -127,7 +549,7 @@ namespace net {
 		 */
 
 		template <typename T>
-		inline client& send(T data) throw(socket_exception) {
+		inline client& send(T data) NET_THROWS(socket_exception) {
 			return send(&data, sizeof(data));
 		}
 
@@ -139,7 +561,7 @@ namespace net {
 		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
 		 */
 
-		inline client& send(char data[]) throw(socket_exception) {
+		inline client& send(char data[]) NET_THROWS(socket_exception) {
 			return send(data, strlen(data) + 1);
 		}
 		
@@ -151,7 +573,7 @@ namespace net {
 		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
 		 */
 		
-		inline client& send(const char data[]) throw(socket_exception) {
+		inline client& send(const char data[]) NET_THROWS(socket_exception) {
 			return send(data, strlen(data) + 1);
 		}
 
@@ -163,10 +585,218 @@ namespace net {
 		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
 		 */
 		
-		inline client& send(const string& data) throw(socket_exception) {
+		inline client& send(const string& data) NET_THROWS(socket_exception) {
 			return send(data.c_str(), data.length() + 1);
 		}
 
+		/**
+		 * @brief      sends a message prefixed with its length as a varint
+		 * @details    the header and payload are handed to the kernel in a single sendmsg() call; closes this client socket if the connection was lost
+		 * @param      data   pointer to the payload; may contain any bytes, including '\0'
+		 * @param[in]  bytes  number of bytes in the payload
+		 * @throw      a socket_exception if there was an error in sending
+		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
+		 */
+
+		client& send_frame(const void* data, size_t bytes) NET_THROWS(socket_exception) {
+			char header[VARINT_MAX_BYTES];
+			struct iovec parts[2];
+			parts[0].iov_base = header;
+			parts[0].iov_len = varint_encode(bytes, header);
+			parts[1].iov_base = const_cast<void*>(data);
+			parts[1].iov_len = bytes;
+			struct msghdr message;
+			memset(&message, 0, sizeof message);
+			message.msg_iov = parts;
+			message.msg_iovlen = 2;
+			while (message.msg_iovlen) {
+				size_t pending = 0;
+				for (size_t i = 0; i < message.msg_iovlen; ++i)
+					pending += message.msg_iov[i].iov_len;
+				io_probe probe;
+				ssize_t sent = ::sendmsg(sockfd, &message, MSG_NOSIGNAL);
+				probe.sent(sockfd, pending, sent);
+				if (sent < 0)
+					throw socket_exception("client::send_frame()");
+				else if (!sent) {
+					close();
+					break;
+				}
+				// skip over whatever was sent, in case of a partial send
+				while (message.msg_iovlen && (size_t) sent >= message.msg_iov->iov_len) {
+					sent -= message.msg_iov->iov_len;
+					++message.msg_iov;
+					--message.msg_iovlen;
+				}
+				if (message.msg_iovlen) {
+					message.msg_iov->iov_base = (char*) message.msg_iov->iov_base + sent;
+					message.msg_iov->iov_len -= sent;
+				}
+			}
+			return *this;
+		}
+
+		/**
+		 * @brief      sends a string as a message prefixed with its length as a varint
+		 * @details    does not send a terminating '\0'; closes this client socket if the connection was lost
+		 * @param[in]  data  the string to send
+		 * @throw      a socket_exception if there was an error in sending
+		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
+		 */
+
+		inline client& send_frame(const string& data) NET_THROWS(socket_exception) {
+			return send_frame(data.data(), data.length());
+		}
+
+		/**
+		 * the largest number of bytes handed to a single sendfile() or splice() call
+		 */
+
+		static const size_t FILE_CHUNK_SIZE = 1 << 30;
+
+		/**
+		 * @brief      sends part of a file to the connected socket without copying it through this process
+		 * @details    uses sendfile(), and falls back to splice() through a pipe for files that sendfile() does not
+		 *             support; closes this client socket if the connection was lost
+		 * @param[in]  fd      the file descriptor of the file to send
+		 * @param[in]  offset  the offset of the first byte to send, or -1 to start from (and advance) the current file position
+		 * @param[in]  length  the number of bytes to send
+		 * @throw      a socket_exception if there was an error in sending, or if the file ends before length bytes were sent
+		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
+		 */
+
+		client& send_file(int fd, off_t offset, size_t length) NET_THROWS(socket_exception) {
+			off_t* position = offset < 0 ? NULL : &offset;
+			while (length) {
+				io_probe probe;
+				ssize_t sent = ::sendfile(sockfd, fd, position, length < FILE_CHUNK_SIZE ? length : FILE_CHUNK_SIZE);
+				probe.sent(sockfd, length < FILE_CHUNK_SIZE ? length : FILE_CHUNK_SIZE, sent);
+				if (sent < 0) {
+					if (errno == EINTR)
+						continue;
+					if (errno == EINVAL || errno == ENOSYS)
+						return splice_file(fd, position, length);
+					throw socket_exception("client::send_file()");
+				}
+				if (!sent) {
+					errno = ENODATA; // the file is shorter than expected
+					throw socket_exception("client::send_file()");
+				}
+				length -= sent;
+			}
+			return *this;
+		}
+
+	protected:
+
+		/**
+		 * @brief      sends part of a file to the connected socket by splicing it through a pipe
+		 * @details    the fallback of client::send_file(); the pages move from the file to the pipe to the socket, without being copied to this process
+		 * @param[in]  fd        the file descriptor of the file to send
+		 * @param      position  the offset of the next byte to send, which is advanced; NULL for the current file position
+		 * @param[in]  length    the number of bytes to send
+		 * @throw      a socket_exception if there was an error in sending, or if the file ends before length bytes were sent
+		 * @return     a reference to this client object
+		 */
+
+		client& splice_file(int fd, off_t* position, size_t length) NET_THROWS(socket_exception) {
+			struct pipe_pair {
+				int fds[2];
+				pipe_pair() NET_THROWS(socket_exception) {
+					if (pipe2(fds, O_CLOEXEC) < 0)
+						throw socket_exception("client::send_file()");
+					fcntl(fds[1], F_SETPIPE_SZ, 1 << 20); // fewer round trips through a larger pipe, if allowed
+				}
+				~pipe_pair() {
+					::close(fds[0]);
+					::close(fds[1]);
+				}
+			} channel;
+			while (length) {
+				ssize_t filled = ::splice(fd, position, channel.fds[1], NULL, length < FILE_CHUNK_SIZE ? length : FILE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+				if (filled < 0) {
+					if (errno == EINTR) continue;
+					throw socket_exception("client::send_file()");
+				}
+				if (!filled) {
+					errno = ENODATA; // the file is shorter than expected
+					throw socket_exception("client::send_file()");
+				}
+				length -= filled;
+				while (filled) {
+					io_probe probe;
+					ssize_t sent = ::splice(channel.fds[0], NULL, sockfd, NULL, filled, SPLICE_F_MOVE | (length ? SPLICE_F_MORE : 0));
+					probe.sent(sockfd, filled, sent);
+					if (sent < 0) {
+						if (errno == EINTR) continue;
+						throw socket_exception("client::send_file()");
+					}
+					filled -= sent;
+				}
+			}
+			return *this;
+		}
+
+	public:
+
+		/**
+		 * @brief      makes this client read through a receive buffer
+		 * @details    the buffer is shared with all copies of this client; if it already exists, it is only grown
+		 * @param[in]  bytes  the number of bytes to allocate for the buffer [default: client::DEFAULT_BUFFER_SIZE]
+		 * @return     a reference to this client object
+		 */
+
+		client& buffer(size_t bytes = client::DEFAULT_BUFFER_SIZE) {
+			if (rbuf) rbuf->reserve(bytes);
+			else rbuf = make_shared<recv_buffer>(bytes);
+			rbuf->refill = true;
+			return *this;
+		}
+
+		/**
+		 * @brief      makes this client read straight from the socket again
+		 * @details    bytes that were already buffered are still returned first by the next reads
+		 * @return     a reference to this client object
+		 */
+
+		client& unbuffer() {
+			if (rbuf) {
+				if (rbuf->size()) rbuf->refill = false;
+				else rbuf.reset();
+			}
+			return *this;
+		}
+
+		/**
+		 * @brief      sets the options of a profile on this client, including how long its reads spin
+		 * @details    the spin applies to this copy of the client and to copies made from it afterwards
+		 * @param[in]  profile  the options to set, e.g. socket_profile::low_latency()
+		 * @throw      a socket_exception if an option cannot be set
+		 * @return     a reference to this client object
+		 */
+
+		client& apply(const socket_profile& profile) NET_THROWS(socket_exception) {
+			socket::apply(profile);
+			spin = profile.spin;
+			return *this;
+		}
+
+		/**
+		 * @brief      checks if this client reads through a receive buffer
+		 */
+
+		inline bool buffered() const {
+			return rbuf && rbuf->refill;
+		}
+
+		/**
+		 * @brief      gets the number of bytes that were received but not yet read
+		 */
+
+		inline size_t available() const {
+			return rbuf ? rbuf->size() : 0;
+		}
+
 		/**
 		 * @brief      receives data with a certain number of bytes from the connected socket
 		 * @details    closes this client socket if the connection was lost
@@ -178,15 +808,23 @@ namespace net {
 		 */
 
 		template <typename T>
-		client& read(T* data, size_t bytes) throw(socket_exception) {
-			for (char* buffer = (char*) data; bytes;) {
-				ssize_t received = ::recv(sockfd, buffer, bytes, 0);
-				if (received < 0)
-					throw socket_exception("client::read()");
-				else if (!received) {
-					close();
-					break;
+		client& read(T* data, size_t bytes) NET_THROWS(socket_exception) {
+			char* buffer = (char*) data;
+			if (rbuf) {
+				// drain what was already received
+				size_t taken = rbuf->take(buffer, bytes);
+				buffer += taken;
+				bytes -= taken;
+			}
+			while (bytes) {
+				size_t received;
+				if (buffered() && bytes < rbuf->capacity) {
+					// small reads are served from a large refill
+					if (!fill()) break;
+					received = rbuf->take(buffer, bytes);
 				}
+				else if (!(received = receive(buffer, bytes)))
+					break; // large reads go straight into the destination
 				buffer += received;
 				bytes -= received;
 			}
@@ -203,7 +841,7 @@ namespace net {
 		 */
 		
 		template <typename T>
-		inline client& read(T& data) throw(socket_exception) {
+		inline client& read(T& data) NET_THROWS(socket_exception) {
 			return read(&data, sizeof(data));
 		}
 		
@@ -216,11 +854,12 @@ namespace net {
 		 */
 
 		template <typename T>
-		inline T read() throw(socket_exception) {
-			char buffer[sizeof(T)];
-			if (!read(buffer, sizeof(T)))
+		inline T read() NET_THROWS(socket_exception) {
+			// receive into storage aligned for T, in case T has no default constructor
+			typename aligned_storage<sizeof(T), alignof(T)>::type buffer;
+			if (!read(&buffer, sizeof(T)))
 				throw socket_exception("client::read()");
-			return *(T*) buffer; // return in this manner in case T has no default constructor
+			return *reinterpret_cast<T*>(&buffer);
 		}
 
 		/**
@@ -231,7 +870,20 @@ namespace net {
 		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
 		 */
 
-		inline client& read(char data[]) throw(socket_exception) {
+		client& read(char data[]) NET_THROWS(socket_exception) {
+			while (rbuf && (rbuf->size() || buffered())) {
+				if (!rbuf->size() && !fill())
+					return *this;
+				// copy everything up to the delimiter in one go
+				const char* start = rbuf->data + rbuf->begin;
+				const char* found = (const char*) memchr(start, '\0', rbuf->size());
+				size_t bytes = found ? found - start + 1 : rbuf->size();
+				memcpy(data, start, bytes);
+				data += bytes;
+				rbuf->consume(bytes);
+				if (found)
+					return *this;
+			}
 			while (read(*data) && *data != '\0')
 				++data;
 			return *this;
@@ -245,51 +897,212 @@ namespace net {
 		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
 		 */
 
-		inline client& read(string& data) throw(socket_exception) {
+		client& read(string& data) NET_THROWS(socket_exception) {
 			data.clear();
+			while (rbuf && (rbuf->size() || buffered())) {
+				if (!rbuf->size() && !fill())
+					return *this;
+				// append everything up to the delimiter in one go
+				const char* start = rbuf->data + rbuf->begin;
+				const char* found = (const char*) memchr(start, '\0', rbuf->size());
+				if (found) {
+					data.append(start, found);
+					rbuf->consume(found - start + 1);
+					return *this;
+				}
+				data.append(start, rbuf->size());
+				rbuf->consume(rbuf->size());
+			}
 			char buffer;
 			while (read(buffer) && buffer != '\0')
 				data.push_back(buffer);
 			return *this;
 		}
 
+		/**
+		 * @brief      receives a message that was sent with client::send_frame()
+		 * @details    gives this client a receive buffer if it has none, and grows it to fit the whole message; the view
+		 *             points into that buffer and stays valid until the next read on this client; closes this client
+		 *             socket if the connection was lost
+		 * @param      view  where to put the view of the received payload; left empty if the connection was lost
+		 * @throw      a socket_exception if there was an error in receiving, or if the message is larger than client::MAX_FRAME_SIZE
+		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
+		 */
+
+		client& read_frame(frame& view) NET_THROWS(socket_exception) {
+			view = frame();
+			if (!buffered())
+				buffer();
+			// receive until the header can be decoded
+			uint64_t bytes;
+			size_t header;
+			while (!(header = varint_decode(rbuf->data + rbuf->begin, rbuf->size(), bytes)))
+				if (!fill()) return *this;
+			if (bytes > MAX_FRAME_SIZE) {
+				errno = EMSGSIZE;
+				throw socket_exception("client::read_frame()");
+			}
+			// make the whole message fit contiguously, then receive the rest of it
+			size_t total = header + bytes;
+			if (rbuf->capacity - rbuf->begin < total) {
+				rbuf->reserve(total);
+				rbuf->compact();
+			}
+			while (rbuf->size() < total)
+				if (!fill()) return *this;
+			view = frame(rbuf->data + rbuf->begin + header, bytes);
+			rbuf->consume(total);
+			return *this;
+		}
+
+		/**
+		 * @brief      receives whatever is pending on the socket into the receive buffer, without blocking
+		 * @details    meant for edge-triggered event loops; gives this client a receive buffer if it has none, and
+		 *             doubles it if it is full of a single incomplete message, up to the largest frame that
+		 *             client::read_frame() accepts along with its length (client::MAX_FRAME_SIZE + VARINT_MAX_BYTES),
+		 *             so a peer that never ends its message cannot make it grow without bound; stops when the socket
+		 *             would block, when the buffer is full, or when the connection was lost, in which case this client
+		 *             socket is closed
+		 * @throw      a socket_exception if there was an error in receiving, or with EMSGSIZE if a single incomplete
+		 *             message fills a buffer of the largest size
+		 * @return     true if the buffer was filled up, in which case more bytes may still be pending
+		 */
+
+		bool read_available() NET_THROWS(socket_exception) {
+			if (!buffered())
+				buffer();
+			if (rbuf->begin == 0 && rbuf->end == rbuf->capacity) {
+				const size_t limit = MAX_FRAME_SIZE + VARINT_MAX_BYTES;
+				if (rbuf->capacity >= limit) {
+					errno = EMSGSIZE;
+					throw socket_exception("client::read_available()");
+				}
+				rbuf->reserve(rbuf->capacity * 2 < limit ? rbuf->capacity * 2 : limit);
+			}
+			rbuf->compact();
+			while (rbuf->end < rbuf->capacity) {
+				io_probe probe;
+				ssize_t received = ::recv(sockfd, rbuf->data + rbuf->end, rbuf->capacity - rbuf->end, MSG_DONTWAIT);
+				probe.received(sockfd, rbuf->capacity - rbuf->end, received);
+				if (received < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						return false;
+					if (errno == EINTR)
+						continue;
+					throw socket_exception("client::read_available()");
+				}
+				else if (!received) {
+					close();
+					return false;
+				}
+				rbuf->end += received;
+			}
+			return true;
+		}
+
+		/**
+		 * @brief      receives a string from the receive buffer if a complete one was already received
+		 * @details    never calls recv(); meant to be used after client::read_available()
+		 * @param      data  where to put the received string, without its terminating '\0'
+		 * @return     true if a complete string was found in the buffer
+		 */
+
+		bool try_read(string& data) {
+			if (!rbuf || !rbuf->size()) return false;
+			const char* start = rbuf->data + rbuf->begin;
+			const char* found = (const char*) memchr(start, '\0', rbuf->size());
+			if (!found) return false;
+			data.assign(start, found);
+			rbuf->consume(found - start + 1);
+			return true;
+		}
+
+		/**
+		 * @brief      receives a value of a fixed size from the receive buffer if all of its bytes were already received
+		 * @details    never calls recv(); meant to be used after client::read_available()
+		 * @param      data  where to put the received value
+		 * @tparam     T     the type of data to receive
+		 * @return     true if the whole value was found in the buffer
+		 */
+
+		template <typename T>
+		bool try_read(T& data) {
+			if (available() < sizeof(data)) return false;
+			rbuf->take((char*) &data, sizeof(data));
+			return true;
+		}
+
+		/**
+		 * @brief      receives a message sent with client::send_frame() from the receive buffer if all of it was already received
+		 * @details    never calls recv(); meant to be used after client::read_available(), which grows the buffer for
+		 *             messages that do not fit; the view stays valid until the next read on this client
+		 * @param      view  where to put the view of the received payload
+		 * @throw      a socket_exception if the message is larger than client::MAX_FRAME_SIZE
+		 * @return     true if the whole message was found in the buffer
+		 */
+
+		bool try_read_frame(frame& view) NET_THROWS(socket_exception) {
+			if (!rbuf) return false;
+			uint64_t bytes;
+			size_t header = varint_decode(rbuf->data + rbuf->begin, rbuf->size(), bytes);
+			if (!header) return false;
+			if (bytes > MAX_FRAME_SIZE) {
+				errno = EMSGSIZE;
+				throw socket_exception("client::try_read_frame()");
+			}
+			size_t total = header + bytes;
+			if (rbuf->size() < total) {
+				// make room so that the next read_available() can complete the message
+				rbuf->reserve(total);
+				return false;
+			}
+			view = frame(rbuf->data + rbuf->begin + header, bytes);
+			rbuf->consume(total);
+			return true;
+		}
+
 		/**
 		 * @brief      gets the ip address of the peer socket
 		 * @throw      a socket_exception if the socket cannot get the peer's name
-		 * @return     a const char pointer to the local IPv4 address of the peer socket
+		 * @return     a const char pointer to the local IPv4 address of the peer socket, or its path if it is a Unix domain socket
 		 */
 
-		virtual const char* ip() const throw(socket_exception)  {
-			struct sockaddr_in sad;
+		virtual const char* ip() const NET_THROWS(socket_exception)  {
+			struct sockaddr_storage sad;
 			socklen_t len = sizeof(sad);
 			if (getpeername(sockfd, (sockaddr*) &sad, &len) < 0)
 				throw socket_exception("socket::ip()");
-			return inet_ntoa(sad.sin_addr);
+			return address_name(sad, len);
 		}
 
 		/**
 		 * @brief      gets the port of the peer socket
 		 * @throw      a socket_exception if the socket cannot get the peer's port
-		 * @return     an unsigned short determining the local IPv4 port used by the peer socket
+		 * @return     an unsigned short determining the local IPv4 port used by the peer socket, or 0 if it is a Unix domain socket
 		 */
 
-		virtual unsigned short port() const throw(socket_exception) {
-			struct sockaddr_in sad;
+		virtual unsigned short port() const NET_THROWS(socket_exception) {
+			struct sockaddr_storage sad;
 			socklen_t len = sizeof(sad);
 			if (getpeername(sockfd, (sockaddr*) &sad, &len) < 0)
 				throw socket_exception("client::port()");
-			return ntohs(sad.sin_port);
+			return address_port(sad);
 		}
 
 	};
 
+	// define the static constant so it can be used in the namespace
+	const size_t client::DEFAULT_BUFFER_SIZE;
+	const size_t client::MAX_FRAME_SIZE;
+	const size_t client::FILE_CHUNK_SIZE;
+
 	/**
 	 * @brief      a template specialization for implicitly receiving an anonymous string from the connected socket
 	 * @throw      a socket_exception if there was an error in receiving, or if the socket was unexpectedly closed while reading
 	 * @return     the received string
 	 */
 
-	template<> inline string client::read<string>() throw(socket_exception) {
+	template<> inline string client::read<string>() NET_THROWS(socket_exception) {
 		string data;
 		if (!read(data))
 			throw socket_exception("client::read()");
@@ -301,7 +1114,7 @@ namespace net {
 	 * @return     the received c-string
 	 */
 
-	template<> inline char* client::read<char*>() throw(socket_exception) {
+	template<> inline char* client::read<char*>() NET_THROWS(socket_exception) {
 	 	string data;
 	 	if (!read(data))
 	 		throw socket_exception("client::read()");
@@ -0,0 +1,566 @@
+/**
+ * C++20 coroutines for net::client and net::server, so a connection can be
+ * served in the sequential style of the examples without a thread of its
+ * own. A net::scheduler runs an edge-triggered net::event_loop, and its
+ * async_read(), async_send() and async_accept() operations return a
+ * net::task that can be co_await-ed: the operation is tried right away,
+ * and the coroutine is only suspended, and resumed by the event loop, if
+ * the socket would block.
+ *
+ *     net::task<> serve(net::scheduler& sched, net::client client) {
+ *         string message;
+ *         while (co_await sched.async_read(client, message))
+ *             co_await sched.async_send(client, message);
+ *         sched.close(client);
+ *     }
+ *
+ *     sched.spawn(serve(sched, client));
+ *     sched.run();
+ *
+ * A suspended coroutine only costs its frame and the registration of its
+ * socket, so many idle connections stay cheap. A scheduler is meant to be
+ * run by a single thread, like the event loop under it; every socket it
+ * touches is switched to non-blocking mode.
+ *
+ * Requires C++20 (compile with -std=c++20).
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_COROUTINE__
+#define __INCLUDE_NET_COROUTINE__
+
+#if __cplusplus < 202002L
+#error "net_coroutine.hpp requires C++20, compile with -std=c++20"
+#endif
+
+#include <coroutine>			// std::coroutine_handle, std::suspend_always
+#include <exception>			// std::exception_ptr, std::terminate()
+#include <optional>				// std::optional
+#include <utility>				// std::move(), std::exchange()
+#include <string>				// std::string
+#include <vector>				// std::vector
+#include <fcntl.h>				// fcntl(), O_NONBLOCK
+#include <sys/socket.h>			// recv(), send()
+#include "net_socket.hpp"		// net::socket, net::socket_exception
+#include "net_client.hpp"		// net::client
+#include "net_server.hpp"		// net::server
+#include "net_event_loop.hpp"	// net::event_loop
+
+namespace net {
+
+	using namespace std;
+
+	template <typename T = void> class task;
+
+	/**
+	 * @brief      the part of the promise of a task that holds its result
+	 * @tparam     T     the type of the result
+	 */
+
+	template <typename T>
+	struct task_result {
+		optional<T> value;
+		void return_value(T result) {
+			value = std::move(result);
+		}
+		T take() {
+			return std::move(*value);
+		}
+	};
+
+	/**
+	 * @brief      the part of the promise of a task without a result
+	 */
+
+	template <>
+	struct task_result<void> {
+		void return_void() {}
+		void take() {}
+	};
+
+	/**
+	 * @brief      a lazily started coroutine that resumes its awaiter when it finishes
+	 * @details    a task starts when it is co_await-ed, or when it is given to scheduler::spawn(); exceptions thrown by
+	 *             the coroutine are rethrown to its awaiter
+	 * @tparam     T     the type of the result of the coroutine [default: void]
+	 */
+
+	template <typename T>
+	class task {
+	public:
+
+		/**
+		 * @brief      the promise of the coroutine, which links it to its awaiter
+		 */
+
+		struct promise_type : task_result<T> {
+			coroutine_handle<> continuation;
+			exception_ptr error;
+			bool detached = false;
+
+			task get_return_object() {
+				return task(coroutine_handle<promise_type>::from_promise(*this));
+			}
+
+			suspend_always initial_suspend() noexcept {
+				return suspend_always();
+			}
+
+			/**
+			 * @brief      resumes the awaiter of a finished coroutine, or frees a detached one
+			 */
+
+			struct final_awaiter {
+				bool await_ready() noexcept {
+					return false;
+				}
+				coroutine_handle<> await_suspend(coroutine_handle<promise_type> self) noexcept {
+					promise_type& promise = self.promise();
+					if (promise.detached) {
+						// nobody can receive the exception of a detached coroutine, just like a std::thread
+						if (promise.error) terminate();
+						self.destroy();
+						return noop_coroutine();
+					}
+					return promise.continuation ? promise.continuation : noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+
+			final_awaiter final_suspend() noexcept {
+				return final_awaiter();
+			}
+
+			void unhandled_exception() {
+				error = current_exception();
+			}
+		};
+
+	private:
+
+		/**
+		 * the coroutine, or NULL if this task was moved from or detached
+		 */
+
+		coroutine_handle<promise_type> handle;
+
+		explicit task(coroutine_handle<promise_type> handle): handle(handle) {}
+
+	public:
+
+		task(task&& other) noexcept: handle(exchange(other.handle, nullptr)) {}
+
+		task& operator = (task&& other) noexcept {
+			if (this != &other) {
+				if (handle) handle.destroy();
+				handle = exchange(other.handle, nullptr);
+			}
+			return *this;
+		}
+
+		/**
+		 * @brief      destroys the coroutine if it was never detached
+		 */
+
+		~task() {
+			if (handle) handle.destroy();
+		}
+
+		/**
+		 * @brief      co_await-ing a task always starts it
+		 */
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		/**
+		 * @brief      starts the coroutine, which resumes the awaiter once it finishes
+		 */
+
+		coroutine_handle<> await_suspend(coroutine_handle<> awaiter) noexcept {
+			handle.promise().continuation = awaiter;
+			return handle;
+		}
+
+		/**
+		 * @brief      gets the result of the finished coroutine, or rethrows its exception
+		 */
+
+		T await_resume() {
+			if (handle.promise().error)
+				rethrow_exception(handle.promise().error);
+			return handle.promise().take();
+		}
+
+		/**
+		 * @brief      starts the coroutine without an awaiter; it frees itself once it finishes
+		 */
+
+		void detach() {
+			coroutine_handle<promise_type> started = exchange(handle, nullptr);
+			started.promise().detached = true;
+			started.resume();
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		task(const task&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		task& operator = (const task&);
+
+	};
+
+	/**
+	 * @brief      runs coroutines that wait for sockets on an edge-triggered event loop
+	 */
+
+	class scheduler {
+
+		/**
+		 * @brief      what happened to a socket since a coroutine last waited for it, and who is waiting now
+		 * @details    edge-triggered events are only reported once, so an event with nobody waiting is remembered
+		 */
+
+		struct readiness {
+			bool watched = false;
+			bool readable = false;
+			bool writable = false;
+			coroutine_handle<> reader;
+			coroutine_handle<> writer;
+		};
+
+		/**
+		 * @brief      suspends a coroutine until a socket becomes readable or writable
+		 */
+
+		struct readiness_awaiter {
+			scheduler& owner;
+			int fd;
+			bool reading;
+
+			bool await_ready() {
+				owner.watch(fd);
+				readiness& state = owner.sockets[fd];
+				bool& ready = reading ? state.readable : state.writable;
+				return exchange(ready, false);
+			}
+
+			void await_suspend(coroutine_handle<> waiter) {
+				readiness& state = owner.sockets[fd];
+				(reading ? state.reader : state.writer) = waiter;
+			}
+
+			void await_resume() {
+				readiness& state = owner.sockets[fd];
+				(reading ? state.readable : state.writable) = false;
+			}
+		};
+
+		/**
+		 * the event loop that reports the sockets
+		 */
+
+		event_loop loop;
+
+		/**
+		 * the state of every socket, indexed by file descriptor
+		 */
+
+		vector<readiness> sockets;
+
+		/**
+		 * @brief      starts watching a socket, in non-blocking mode, unless it is already watched
+		 * @param[in]  fd    the file descriptor of the socket
+		 * @throw      a socket_exception if the socket cannot be watched
+		 */
+
+		void watch(int fd) NET_THROWS(socket_exception) {
+			if ((size_t) fd >= sockets.size())
+				sockets.resize(fd + 1);
+			if (sockets[fd].watched)
+				return;
+			int flags = fcntl(fd, F_GETFL, 0);
+			if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+				throw socket_exception("scheduler::watch()");
+			loop.add(fd, [this, fd] {notify(fd, true);}, [this, fd] {notify(fd, false);});
+			sockets[fd].watched = true;
+		}
+
+		/**
+		 * @brief      resumes the coroutine waiting for an event, or remembers the event if none is
+		 * @param[in]  fd       the file descriptor of the socket
+		 * @param[in]  reading  true if the socket became readable, false if it became writable
+		 */
+
+		void notify(int fd, bool reading) {
+			readiness& state = sockets[fd];
+			coroutine_handle<> waiter = exchange(reading ? state.reader : state.writer, nullptr);
+			if (waiter)
+				waiter.resume();
+			else
+				(reading ? state.readable : state.writable) = true;
+		}
+
+		/**
+		 * @brief      stops watching a socket that was closed, so its file descriptor can be reused
+		 * @details    coroutines still waiting for the socket are resumed, and see it closed
+		 * @param[in]  fd    the file descriptor the socket had
+		 */
+
+		void forget(int fd) {
+			if (fd < 0 || (size_t) fd >= sockets.size() || !sockets[fd].watched)
+				return;
+			loop.remove(fd);
+			readiness state = exchange(sockets[fd], readiness());
+			if (state.reader) state.reader.resume();
+			if (state.writer) state.writer.resume();
+		}
+
+		/**
+		 * @brief      waits until a socket may have new data or a new connection
+		 */
+
+		readiness_awaiter readable(int fd) {
+			return readiness_awaiter {*this, fd, true};
+		}
+
+		/**
+		 * @brief      waits until a socket may accept more data
+		 */
+
+		readiness_awaiter writable(int fd) {
+			return readiness_awaiter {*this, fd, false};
+		}
+
+	public:
+
+		scheduler() = default;
+
+		/**
+		 * @brief      starts a coroutine that runs on its own until it finishes
+		 * @details    the coroutine runs until its first suspension before this returns; it must catch its own exceptions
+		 * @param[in]  coroutine  the coroutine to start
+		 */
+
+		void spawn(task<> coroutine) {
+			coroutine.detach();
+		}
+
+		/**
+		 * @brief      resumes coroutines as their sockets become ready, until scheduler::stop() is called
+		 * @throw      a socket_exception if the event loop fails
+		 */
+
+		void run() NET_THROWS(socket_exception) {
+			loop.run();
+		}
+
+		/**
+		 * @brief      makes scheduler::run() return after the current batch of events
+		 */
+
+		void stop() {
+			loop.stop();
+		}
+
+		/**
+		 * @brief      stops watching a socket and closes it
+		 * @details    coroutines still waiting for the socket are resumed, and see it closed
+		 * @param      sock  the socket to close
+		 */
+
+		void close(socket& sock) {
+			int fd = sock;
+			sock.close();
+			forget(fd);
+		}
+
+		/**
+		 * @brief      accepts a connecting socket, waiting for one if none is pending
+		 * @param      listener  the server to accept from
+		 * @throw      a socket_exception if there was a problem in accepting the client socket
+		 * @return     a socket referring to the accepted client
+		 */
+
+		task<socket> async_accept(server& listener) {
+			while (true) {
+				watch(listener);
+				socket accepted = listener.try_accept();
+				if (accepted)
+					co_return accepted;
+				co_await readable(listener);
+			}
+		}
+
+		/**
+		 * @brief      receives a certain number of bytes, waiting for them as needed
+		 * @details    bytes already in the receive buffer of the client are taken first; closes the client if the
+		 *             connection was lost
+		 * @param      sock   the client to receive from
+		 * @param      data   where to put the received bytes; must stay valid until the task finishes
+		 * @param[in]  bytes  the number of bytes to receive
+		 * @throw      a socket_exception if there was an error in receiving
+		 * @return     the number of bytes received, which is less than bytes if the connection was lost
+		 */
+
+		task<size_t> async_read(client& sock, void* data, size_t bytes) {
+			char* buffer = (char*) data;
+			size_t done = 0;
+			if (sock.available()) {
+				done = sock.available() < bytes ? sock.available() : bytes;
+				sock.read(buffer, done);
+			}
+			while (done < bytes && sock.good()) {
+				watch(sock);
+				ssize_t received = ::recv(sock, buffer + done, bytes - done, MSG_DONTWAIT);
+				if (received > 0)
+					done += received;
+				else if (!received)
+					close(sock);
+				else if (errno == EAGAIN || errno == EWOULDBLOCK)
+					co_await readable(sock);
+				else
+					throw socket_exception("scheduler::async_read()");
+			}
+			co_return done;
+		}
+
+		/**
+		 * @brief      receives a value of a certain data type, waiting for it as needed
+		 * @param      sock   the client to receive from
+		 * @param      data   where to put the received value; must stay valid until the task finishes
+		 * @tparam     T      the type of data to receive
+		 * @throw      a socket_exception if there was an error in receiving
+		 * @return     false if the connection was lost before the whole value arrived
+		 */
+
+		template <typename T>
+		task<bool> async_read(client& sock, T& data) {
+			co_return co_await async_read(sock, &data, sizeof data) == sizeof data;
+		}
+
+		/**
+		 * @brief      receives a string sent with client::send(), waiting for it as needed
+		 * @details    gives the client a receive buffer if it has none, so strings are parsed from large reads
+		 * @param      sock   the client to receive from
+		 * @param      data   where to put the received string; must stay valid until the task finishes
+		 * @throw      a socket_exception if there was an error in receiving
+		 * @return     false if the connection was lost before the whole string arrived
+		 */
+
+		task<bool> async_read(client& sock, string& data) {
+			if (!sock.buffered())
+				sock.buffer();
+			int fd = sock;
+			while (sock.good()) {
+				if (sock.try_read(data))
+					co_return true;
+				watch(sock);
+				if (sock.read_available())
+					continue; // the buffer filled up before the socket was drained
+				if (sock.try_read(data))
+					co_return true;
+				if (!sock.good())
+					break;
+				co_await readable(sock);
+			}
+			// read_available() closes the client once the connection is lost
+			forget(fd);
+			co_return false;
+		}
+
+		/**
+		 * @brief      sends a number of bytes, waiting for room in the socket as needed
+		 * @param      sock   the client to send to
+		 * @param      data   the bytes to send; must stay valid until the task finishes
+		 * @param[in]  bytes  the number of bytes to send
+		 * @throw      a socket_exception if there was an error in sending, or the client was closed meanwhile
+		 */
+
+		task<> async_send(client& sock, const void* data, size_t bytes) {
+			const char* buffer = (const char*) data;
+			while (bytes) {
+				if (!sock.good()) {
+					errno = EPIPE;
+					throw socket_exception("scheduler::async_send()");
+				}
+				watch(sock);
+				ssize_t sent = ::send(sock, buffer, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+				if (sent >= 0) {
+					buffer += sent;
+					bytes -= sent;
+				}
+				else if (errno == EAGAIN || errno == EWOULDBLOCK)
+					co_await writable(sock);
+				else
+					throw socket_exception("scheduler::async_send()");
+			}
+		}
+
+		/**
+		 * @brief      sends a string with its terminating '\0', like client::send()
+		 * @param      sock   the client to send to
+		 * @param[in]  data   the string to send
+		 * @throw      a socket_exception if there was an error in sending, or the client was closed meanwhile
+		 */
+
+		task<> async_send(client& sock, string data) {
+			co_await async_send(sock, data.c_str(), data.size() + 1);
+		}
+
+		/**
+		 * @brief      sends a C string with its terminating '\0', like client::send()
+		 */
+
+		task<> async_send(client& sock, const char* data) {
+			co_await async_send(sock, string(data));
+		}
+
+		/**
+		 * @brief      sends the bytes of a value of a certain data type, like client::send()
+		 * @param      sock   the client to send to
+		 * @param[in]  data   the value to send
+		 * @tparam     T      the type of data to send
+		 * @throw      a socket_exception if there was an error in sending, or the client was closed meanwhile
+		 */
+
+		template <typename T>
+		task<> async_send(client& sock, T data) {
+			co_await async_send(sock, &data, sizeof data);
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		scheduler(const scheduler&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		scheduler& operator = (const scheduler&);
+
+	};
+
+}
+
+#endif /* __INCLUDE_NET_COROUTINE__ */
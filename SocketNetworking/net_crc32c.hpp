@@ -0,0 +1,141 @@
+/**
+ * CRC32C (Castagnoli) checksums for verifying data received through a
+ * net::client. On x86 processors with SSE4.2, net::crc32c() uses the
+ * crc32 instruction, which checksums 8 bytes per instruction and easily
+ * keeps up with loopback transfers. Elsewhere it falls back to a portable
+ * slicing-by-8 table implementation that gives the same results.
+ *
+ * Checksums can be computed incrementally by passing the checksum of the
+ * preceding bytes:
+ *
+ *     uint32_t crc = net::crc32c(first, first_bytes);
+ *     crc = net::crc32c(second, second_bytes, crc);
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_CRC32C__
+#define __INCLUDE_NET_CRC32C__
+
+#include <cstring>		// memcpy()
+#include <stddef.h>		// size_t
+#include <stdint.h>		// uint32_t, uint64_t
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>	// _mm_crc32_u8(), _mm_crc32_u64()
+#endif
+
+namespace net {
+
+	/**
+	 * @brief      computes CRC32C without special instructions, eight bytes at a time
+	 * @param[in]  data   the bytes to checksum
+	 * @param[in]  bytes  the number of bytes
+	 * @param[in]  crc    the checksum of the preceding bytes [default: 0]
+	 * @return     the checksum of the preceding bytes followed by these ones
+	 */
+
+	inline uint32_t crc32c_software(const void* data, size_t bytes, uint32_t crc = 0) {
+		// eight lookup tables, one per byte position of a 64-bit word
+		static struct tables {
+			uint32_t entries[8][256];
+			tables() {
+				for (uint32_t i = 0; i < 256; ++i) {
+					uint32_t value = i;
+					for (int bit = 0; bit < 8; ++bit)
+						value = value & 1 ? (value >> 1) ^ 0x82f63b78 : value >> 1;
+					entries[0][i] = value;
+				}
+				for (uint32_t i = 0; i < 256; ++i)
+					for (int k = 1; k < 8; ++k)
+						entries[k][i] = (entries[k - 1][i] >> 8) ^ entries[0][entries[k - 1][i] & 0xff];
+			}
+		} table;
+		const uint32_t (*t)[256] = table.entries;
+		const unsigned char* input = (const unsigned char*) data;
+		crc = ~crc;
+		for (; bytes >= 8; bytes -= 8, input += 8) {
+			uint32_t low, high;
+			memcpy(&low, input, 4);
+			memcpy(&high, input + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			low = __builtin_bswap32(low);
+			high = __builtin_bswap32(high);
+#endif
+			low ^= crc;
+			crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24]
+				^ t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+		}
+		while (bytes--)
+			crc = (crc >> 8) ^ t[0][(crc ^ *input++) & 0xff];
+		return ~crc;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+	/**
+	 * @brief      computes CRC32C with the SSE4.2 crc32 instruction
+	 * @details    must only be called on processors that support SSE4.2
+	 * @param[in]  data   the bytes to checksum
+	 * @param[in]  bytes  the number of bytes
+	 * @param[in]  crc    the checksum of the preceding bytes [default: 0]
+	 * @return     the checksum of the preceding bytes followed by these ones
+	 */
+
+	__attribute__((target("sse4.2")))
+	inline uint32_t crc32c_sse42(const void* data, size_t bytes, uint32_t crc = 0) {
+		const unsigned char* input = (const unsigned char*) data;
+		crc = ~crc;
+		// align the input so the wide loads do not straddle cache lines
+		for (; bytes && ((uintptr_t) input & 7); --bytes)
+			crc = _mm_crc32_u8(crc, *input++);
+#if defined(__x86_64__)
+		uint64_t wide = crc;
+		for (; bytes >= 8; bytes -= 8, input += 8)
+			wide = _mm_crc32_u64(wide, *(const uint64_t*) input);
+		crc = (uint32_t) wide;
+#else
+		for (; bytes >= 4; bytes -= 4, input += 4)
+			crc = _mm_crc32_u32(crc, *(const uint32_t*) input);
+#endif
+		while (bytes--)
+			crc = _mm_crc32_u8(crc, *input++);
+		return ~crc;
+	}
+
+#endif
+
+	/**
+	 * @brief      checks if net::crc32c() uses a hardware instruction on this processor
+	 */
+
+	inline bool crc32c_hardware() {
+#if defined(__x86_64__) || defined(__i386__)
+		static const bool supported = __builtin_cpu_supports("sse4.2");
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * @brief      computes CRC32C, with the fastest implementation supported by this processor
+	 * @param[in]  data   the bytes to checksum
+	 * @param[in]  bytes  the number of bytes
+	 * @param[in]  crc    the checksum of the preceding bytes [default: 0]
+	 * @return     the checksum of the preceding bytes followed by these ones
+	 */
+
+	inline uint32_t crc32c(const void* data, size_t bytes, uint32_t crc = 0) {
+#if defined(__x86_64__) || defined(__i386__)
+		if (crc32c_hardware())
+			return crc32c_sse42(data, bytes, crc);
+#endif
+		return crc32c_software(data, bytes, crc);
+	}
+
+}
+
+#endif /* __INCLUDE_NET_CRC32C__ */
@@ -0,0 +1,338 @@
+/**
+ * A lightweight reactor that waits on many sockets at once using Linux
+ * epoll, so a single thread can serve thousands of net::client and
+ * net::server sockets instead of dedicating a thread to each of them.
+ *
+ * Sockets are registered with event_loop::add() along with a callback
+ * for when they become readable and, optionally, one for when they
+ * become writable. All sockets are watched in edge-triggered mode: a
+ * callback is called once when new data arrives (or when buffer space
+ * frees up), so it must read until the socket would block, e.g. with
+ * net::client::read_available() and net::server::try_accept().
+ *
+ * An event_loop is meant to be run by a single thread. To use multiple
+ * cores, run one event_loop per thread. A listening net::server can be
+ * added to several loops with the EPOLLEXCLUSIVE flag so that only one
+ * of them is woken up per incoming connection.
+ *
+ * Other threads hand work to a loop with event_loop::post(), which queues
+ * the task on a lock-free queue and wakes the loop up to run it on its own
+ * thread, so state owned by a loop never needs a lock.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_EVENT_LOOP__
+#define __INCLUDE_NET_EVENT_LOOP__
+
+#include <vector>			// std::vector
+#include <functional>		// std::function
+#include <memory>			// std::shared_ptr
+#include <atomic>			// std::atomic
+#include <utility>			// std::move()
+#include <stdint.h>			// uint32_t, uint64_t
+#include <unistd.h>			// close(), read(), write()
+#include <sys/epoll.h>		// epoll_create1(), epoll_ctl(), epoll_wait()
+#include <sys/eventfd.h>	// eventfd()
+#include "net_socket.hpp"	// net::socket_exception
+#include "net_mpsc_queue.hpp"	// net::mpsc_queue
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      an edge-triggered epoll reactor that dispatches readable and writable callbacks
+	 */
+
+	class event_loop {
+	public:
+
+		/**
+		 * the type of the callbacks called when a socket becomes readable or writable
+		 */
+
+		typedef function<void()> callback;
+
+		/**
+		 * the default maximum number of events handled per call to epoll_wait()
+		 */
+
+		static const int DEFAULT_MAX_EVENTS = 256;
+
+	private:
+
+		/**
+		 * @brief      the callbacks registered for a single file descriptor
+		 */
+
+		struct handlers {
+			callback readable;
+			callback writable;
+		};
+
+		/**
+		 * @brief      the registration slot of a single file descriptor
+		 * @details    the handlers are shared so that a callback stays alive while it runs, even if it removes its own socket;
+		 *             the generation changes on every removal so that stale events are recognized
+		 */
+
+		struct watcher {
+			shared_ptr<handlers> current;
+			uint32_t generation;
+			watcher(): generation(0) {}
+		};
+
+		/**
+		 * the epoll file descriptor
+		 */
+
+		int epfd;
+
+		/**
+		 * the eventfd used to wake up epoll_wait() from other threads
+		 */
+
+		int wakefd;
+
+		/**
+		 * the registered callbacks, indexed by file descriptor
+		 */
+
+		vector<watcher> watchers;
+
+		/**
+		 * the buffer of events filled by epoll_wait()
+		 */
+
+		vector<epoll_event> events;
+
+		/**
+		 * whether event_loop::run() should keep going; set on construction and cleared for good by event_loop::stop()
+		 */
+
+		atomic<bool> running;
+
+		/**
+		 * the tasks posted from other threads, and whether the loop was woken up for them and has not run them yet
+		 */
+
+		mpsc_queue<callback> posted;
+		atomic<bool> woken;
+
+		/**
+		 * the event data marking the wake-up eventfd
+		 */
+
+		static const uint64_t WAKE_TOKEN = ~(uint64_t) 0;
+
+	public:
+
+		/**
+		 * @brief      creates an epoll instance with no sockets
+		 * @param[in]  max_events  the maximum number of events handled per call to epoll_wait()
+		 * @throw      a socket_exception if the epoll instance cannot be created
+		 */
+
+		explicit event_loop(int max_events = event_loop::DEFAULT_MAX_EVENTS) NET_THROWS(socket_exception):
+			epfd(epoll_create1(EPOLL_CLOEXEC)),
+			wakefd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+			events(max_events),
+			running(true),
+			woken(false) {
+			if (epfd < 0 || wakefd < 0)
+				throw socket_exception("event_loop::event_loop()");
+			struct epoll_event event;
+			event.events = EPOLLIN | EPOLLET;
+			event.data.u64 = WAKE_TOKEN;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &event) < 0)
+				throw socket_exception("event_loop::event_loop()");
+		}
+
+		/**
+		 * @brief      closes the epoll instance; does not close the registered sockets
+		 */
+
+		~event_loop() {
+			::close(wakefd);
+			::close(epfd);
+		}
+
+		/**
+		 * @brief      starts watching a socket
+		 * @details    the socket is watched in edge-triggered mode; errors and hang-ups are reported as readable so
+		 *             that the next read sees them; the socket must stay open until it is removed
+		 * @param[in]  fd           the file descriptor of the socket to watch
+		 * @param[in]  on_readable  called when new data (or a new connection) arrives
+		 * @param[in]  on_writable  called when the socket can be written to again; not watched if empty [default: empty]
+		 * @param[in]  flags        extra epoll flags, e.g. EPOLLEXCLUSIVE for a listening socket shared by many loops [default: 0]
+		 * @throw      a socket_exception if the socket cannot be watched
+		 */
+
+		void add(int fd, callback on_readable, callback on_writable = callback(), uint32_t flags = 0) NET_THROWS(socket_exception) {
+			if (fd < 0) {
+				errno = EBADF;
+				throw socket_exception("event_loop::add()");
+			}
+			if ((size_t) fd >= watchers.size())
+				watchers.resize(fd + 1);
+			watcher& entry = watchers[fd];
+			if (entry.current) {
+				errno = EEXIST;
+				throw socket_exception("event_loop::add()");
+			}
+			struct epoll_event event;
+			event.events = EPOLLIN | EPOLLET | flags;
+			if (!(flags & EPOLLEXCLUSIVE))
+				event.events |= EPOLLRDHUP; // not allowed together with EPOLLEXCLUSIVE
+			if (on_writable)
+				event.events |= EPOLLOUT;
+			event.data.u64 = (uint64_t) fd | (uint64_t) entry.generation << 32;
+			if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+				throw socket_exception("event_loop::add()");
+			entry.current = make_shared<handlers>();
+			entry.current->readable = on_readable;
+			entry.current->writable = on_writable;
+		}
+
+		/**
+		 * @brief      stops watching a socket
+		 * @details    safe to call from within a callback, including the socket's own; pending events for the socket
+		 *             in the current batch are discarded
+		 * @param[in]  fd    the file descriptor of the watched socket
+		 */
+
+		void remove(int fd) {
+			if (!watching(fd)) return;
+			watcher& entry = watchers[fd];
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+			entry.current.reset();
+			++entry.generation;
+		}
+
+		/**
+		 * @brief      checks if a socket is being watched by this loop
+		 * @param[in]  fd    the file descriptor of the socket
+		 */
+
+		inline bool watching(int fd) const {
+			return fd >= 0 && (size_t) fd < watchers.size() && watchers[fd].current;
+		}
+
+		/**
+		 * @brief      waits for events once and dispatches their callbacks
+		 * @param[in]  timeout  the maximum number of milliseconds to wait, or -1 to wait indefinitely [default: -1]
+		 * @throw      a socket_exception if epoll_wait() fails, or whatever a callback or posted task throws
+		 * @return     the number of sockets whose callbacks were dispatched, not counting posted tasks
+		 */
+
+		size_t poll(int timeout = -1) NET_THROWS(socket_exception) {
+			int ready = epoll_wait(epfd, events.data(), events.size(), timeout);
+			if (ready < 0) {
+				if (errno == EINTR) return 0;
+				throw socket_exception("event_loop::poll()");
+			}
+			size_t dispatched = 0;
+			for (int i = 0; i < ready; ++i) {
+				uint64_t token = events[i].data.u64;
+				if (token == WAKE_TOKEN) {
+					uint64_t count;
+					while (::read(wakefd, &count, sizeof count) > 0);
+					// clear the flag before taking the tasks, so a task posted after the last pop wakes the loop again
+					woken = false;
+					callback task;
+					while (posted.pop(task))
+						task();
+					continue;
+				}
+				int fd = (int) (token & 0xffffffff);
+				uint32_t generation = (uint32_t) (token >> 32);
+				uint32_t flags = events[i].events;
+				// skip sockets removed, or replaced, by an earlier callback in this batch
+				if (!watching(fd) || watchers[fd].generation != generation)
+					continue;
+				shared_ptr<handlers> current = watchers[fd].current;
+				if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+					current->readable();
+				if ((flags & EPOLLOUT) && current->writable && watchers[fd].generation == generation)
+					current->writable();
+				++dispatched;
+			}
+			return dispatched;
+		}
+
+		/**
+		 * @brief      dispatches events until event_loop::stop() is called
+		 * @details    returns right away if the loop was stopped before it started running
+		 * @throw      a socket_exception if epoll_wait() fails, or whatever a callback throws
+		 */
+
+		void run() NET_THROWS(socket_exception) {
+			while (running)
+				poll();
+		}
+
+		/**
+		 * @brief      makes event_loop::run() return after the current batch of events
+		 * @details    safe to call from any thread, even before event_loop::run() is called, in which case run()
+		 *             returns right away
+		 */
+
+		void stop() {
+			running = false;
+			wake();
+		}
+
+		/**
+		 * @brief      interrupts a blocking event_loop::poll() from another thread
+		 */
+
+		void wake() {
+			uint64_t one = 1;
+			ssize_t written = ::write(wakefd, &one, sizeof one);
+			(void) written;
+		}
+
+		/**
+		 * @brief      runs a task on the thread of the loop, when the loop handles its wake-up event
+		 * @details    safe to call from any thread; the wake-up is handled in the order epoll reports it, so the task
+		 *             may run before or after the callbacks of other sockets in the same batch. Tasks posted by the
+		 *             same thread run in the order they were posted. The task is queued before the woken flag is set,
+		 *             and the loop clears the flag before taking the tasks, so a burst of posts wakes the loop up only
+		 *             once without a task being left behind (see net_mpsc_queue.hpp)
+		 * @param[in]  task  the task to run
+		 */
+
+		void post(callback task) {
+			posted.push(std::move(task));
+			if (!woken.exchange(true))
+				wake();
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		event_loop(const event_loop&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		event_loop& operator = (const event_loop&);
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const int event_loop::DEFAULT_MAX_EVENTS;
+	const uint64_t event_loop::WAKE_TOKEN;
+
+}
+
+#endif /* __INCLUDE_NET_EVENT_LOOP__ */
@@ -0,0 +1,902 @@
+/**
+ * Asynchronous executors that read from net::client sockets, send to
+ * them, and accept them from a net::server, calling back when each
+ * operation completes. Two backends share one interface:
+ *
+ *  - net::uring_executor, built on Linux io_uring. Every operation
+ *    queued during a loop iteration is submitted together, and the
+ *    completions are waited for, in a single io_uring_enter() call.
+ *    Reads land in a pool of buffers that is registered with the
+ *    kernel once, so it does not have to map them on every read.
+ *
+ *  - net::epoll_executor, built on net::event_loop. Each operation is
+ *    still its own recv(), send() or accept() call, made as soon as the
+ *    socket is ready.
+ *
+ * Call net::make_executor() to get an io_uring executor when the kernel
+ * supports it (io_uring may be missing, or blocked by a seccomp policy),
+ * and an epoll executor otherwise. Both count the system calls they make
+ * in executor::syscalls(), so the two can be compared.
+ *
+ * Executors are not thread-safe; run one per thread. Sockets and sent
+ * data must stay alive until their operations complete. Once a read
+ * reports that a connection is over, the socket should be closed and
+ * not used with the executor anymore.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_EXECUTOR__
+#define __INCLUDE_NET_EXECUTOR__
+
+#include <cstring>				// memset()
+#include <vector>				// std::vector
+#include <deque>				// std::deque
+#include <unordered_set>		// std::unordered_set
+#include <memory>				// std::unique_ptr
+#include <functional>			// std::function
+#include <stdint.h>				// uint64_t
+#include <unistd.h>				// syscall(), close()
+#include <sys/mman.h>			// mmap(), munmap()
+#include <sys/syscall.h>		// __NR_io_uring_setup, __NR_io_uring_enter, __NR_io_uring_register
+#include <sys/uio.h>			// iovec
+#include <linux/io_uring.h>		// io_uring_params, io_uring_sqe, io_uring_cqe
+#include "net_socket.hpp"		// net::socket, net::socket_exception
+#include "net_client.hpp"		// net::client
+#include "net_server.hpp"		// net::server
+#include "net_event_loop.hpp"	// net::event_loop
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      the interface shared by the asynchronous executors
+	 */
+
+	class executor {
+	public:
+
+		/**
+		 * called with the bytes received by executor::async_read(); bytes is 0 when the connection was closed,
+		 * and the negated errno on failure; the data is only valid during the call
+		 */
+
+		typedef function<void(const char* data, ssize_t bytes)> read_callback;
+
+		/**
+		 * called with the number of bytes sent by executor::async_send(), or the negated errno on failure
+		 */
+
+		typedef function<void(ssize_t bytes)> send_callback;
+
+		/**
+		 * called with the socket accepted by executor::async_accept(), or an empty socket on failure (see errno)
+		 */
+
+		typedef function<void(socket sock)> accept_callback;
+
+		/**
+		 * the default number of receive buffers in the pool
+		 */
+
+		static const size_t DEFAULT_BUFFERS = 64;
+
+		/**
+		 * the default size of each receive buffer in bytes
+		 */
+
+		static const size_t DEFAULT_BUFFER_SIZE = 16 * 1024;
+
+	protected:
+
+		/**
+		 * @brief      an operation that was queued but has not completed yet
+		 */
+
+		struct operation {
+			enum {READ, SEND, ACCEPT} type;
+			int fd;
+			char* data;			// receive buffer, or the remaining data to send
+			size_t bytes;		// size of the receive buffer, or the number of bytes left to send
+			size_t done;		// the number of bytes sent so far
+			int buffer;			// index of the pooled receive buffer, or -1 if data was allocated separately
+			read_callback on_read;
+			send_callback on_send;
+			accept_callback on_accept;
+		};
+
+		/**
+		 * the memory of all pooled receive buffers, laid out back to back
+		 */
+
+		vector<char> pool;
+
+		/**
+		 * the size of each pooled receive buffer
+		 */
+
+		size_t buffer_size;
+
+		/**
+		 * the indices of the pooled receive buffers that are not in use
+		 */
+
+		vector<int> free_buffers;
+
+		/**
+		 * the number of operations that were queued but have not completed yet
+		 */
+
+		size_t pending_ops;
+
+		/**
+		 * the number of system calls made by this executor
+		 */
+
+		unsigned long syscall_count;
+
+		/**
+		 * whether executor::run() should stop
+		 */
+
+		bool stopped;
+
+		/**
+		 * @brief      allocates the pool of receive buffers
+		 * @param[in]  buffers      the number of buffers in the pool
+		 * @param[in]  buffer_size  the size of each buffer in bytes
+		 */
+
+		executor(size_t buffers, size_t buffer_size):
+			pool(buffers * buffer_size),
+			buffer_size(buffer_size),
+			pending_ops(0),
+			syscall_count(0),
+			stopped(false) {
+			for (size_t i = buffers; i-- > 0;)
+				free_buffers.push_back(i);
+		}
+
+		/**
+		 * @brief      creates a read operation with a receive buffer from the pool
+		 * @details    allocates a separate buffer if the pool ran out
+		 */
+
+		operation* make_read(int fd, read_callback done) {
+			operation* op = new operation();
+			op->type = operation::READ;
+			op->fd = fd;
+			op->bytes = buffer_size;
+			if (free_buffers.empty()) {
+				op->buffer = -1;
+				op->data = new char[buffer_size];
+			} else {
+				op->buffer = free_buffers.back();
+				op->data = &pool[op->buffer * buffer_size];
+				free_buffers.pop_back();
+			}
+			op->on_read = done;
+			++pending_ops;
+			return op;
+		}
+
+		/**
+		 * @brief      creates a send operation
+		 */
+
+		operation* make_send(int fd, const void* data, size_t bytes, send_callback done) {
+			operation* op = new operation();
+			op->type = operation::SEND;
+			op->fd = fd;
+			op->data = (char*) data;
+			op->bytes = bytes;
+			op->done = 0;
+			op->buffer = -1;
+			op->on_send = done;
+			++pending_ops;
+			return op;
+		}
+
+		/**
+		 * @brief      creates an accept operation
+		 */
+
+		operation* make_accept(int fd, accept_callback done) {
+			operation* op = new operation();
+			op->type = operation::ACCEPT;
+			op->fd = fd;
+			op->data = NULL;
+			op->buffer = -1;
+			op->on_accept = done;
+			++pending_ops;
+			return op;
+		}
+
+		/**
+		 * @brief      calls the callback of a finished operation, then frees it
+		 * @param      op      the finished operation
+		 * @param[in]  result  the number of bytes transferred, the accepted fd, or the negated errno
+		 */
+
+		void finish(operation* op, ssize_t result) {
+			--pending_ops;
+			// free the operation even if the callback throws
+			unique_ptr<operation> owned(op);
+			struct release {
+				executor& self;
+				operation* op;
+				~release() {
+					if (op->type != operation::READ) return;
+					if (op->buffer < 0) delete[] op->data;
+					else self.free_buffers.push_back(op->buffer);
+				}
+			} guard = {*this, op};
+			switch (op->type) {
+				case operation::READ:
+					if (op->on_read) op->on_read(op->data, result);
+					break;
+				case operation::SEND:
+					if (op->on_send) op->on_send(result < 0 ? result : (ssize_t) op->done);
+					break;
+				case operation::ACCEPT:
+					if (result < 0) errno = -result;
+					if (op->on_accept) op->on_accept(result < 0 ? socket(-1) : socket((int) result));
+					break;
+			}
+		}
+
+	public:
+
+		/**
+		 * @brief      frees the executor
+		 */
+
+		virtual ~executor() {}
+
+		/**
+		 * @brief      gets the name of the backend, "io_uring" or "epoll"
+		 */
+
+		virtual const char* name() const = 0;
+
+		/**
+		 * @brief      receives whatever is available from a client, up to the size of one pooled buffer
+		 * @param[in]  sock  the client to read from
+		 * @param[in]  done  called with the received bytes
+		 */
+
+		virtual void async_read(const client& sock, read_callback done) = 0;
+
+		/**
+		 * @brief      sends all bytes to a client, continuing after partial sends
+		 * @param[in]  sock   the client to send to
+		 * @param[in]  data   the data to send; must stay alive until the callback is called
+		 * @param[in]  bytes  the number of bytes to send
+		 * @param[in]  done   called when all bytes were sent, or on failure [default: empty]
+		 */
+
+		virtual void async_send(const client& sock, const void* data, size_t bytes, send_callback done = send_callback()) = 0;
+
+		/**
+		 * @brief      accepts one connecting socket from a server
+		 * @param[in]  sock  the server to accept from
+		 * @param[in]  done  called with the accepted socket
+		 */
+
+		virtual void async_accept(const server& sock, accept_callback done) = 0;
+
+		/**
+		 * @brief      submits all queued operations, waits for at least one to complete, and calls back the completed ones
+		 * @throw      a socket_exception if the backend fails, or whatever a callback throws
+		 * @return     the number of operations that completed
+		 */
+
+		virtual size_t run_once() NET_THROWS(socket_exception) = 0;
+
+		/**
+		 * @brief      runs until there are no more pending operations, or until executor::stop() is called
+		 * @throw      a socket_exception if the backend fails, or whatever a callback throws
+		 */
+
+		void run() NET_THROWS(socket_exception) {
+			stopped = false;
+			while (pending_ops && !stopped)
+				run_once();
+		}
+
+		/**
+		 * @brief      makes executor::run() return after the current batch; must be called from a callback
+		 */
+
+		void stop() {
+			stopped = true;
+		}
+
+		/**
+		 * @brief      gets the number of operations that were queued but have not completed yet
+		 */
+
+		inline size_t pending() const {
+			return pending_ops;
+		}
+
+		/**
+		 * @brief      gets the number of system calls made by this executor so far
+		 */
+
+		inline unsigned long syscalls() const {
+			return syscall_count;
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		executor(const executor&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		executor& operator = (const executor&);
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const size_t executor::DEFAULT_BUFFERS;
+	const size_t executor::DEFAULT_BUFFER_SIZE;
+
+	/**
+	 * @brief      an executor that batches operations through io_uring, with registered receive buffers
+	 */
+
+	class uring_executor : public executor {
+	public:
+
+		/**
+		 * the default number of submission queue entries
+		 */
+
+		static const unsigned DEFAULT_ENTRIES = 256;
+
+	private:
+
+		/**
+		 * the io_uring file descriptor
+		 */
+
+		int ringfd;
+
+		/**
+		 * the parameters filled in by io_uring_setup()
+		 */
+
+		struct io_uring_params params;
+
+		/**
+		 * the mapped submission and completion rings, and their sizes
+		 */
+
+		void* sq_ring;
+		void* cq_ring;
+		size_t sq_ring_size;
+		size_t cq_ring_size;
+
+		/**
+		 * the mapped array of submission queue entries
+		 */
+
+		struct io_uring_sqe* sqes;
+
+		/**
+		 * pointers into the mapped rings
+		 */
+
+		unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+		unsigned *cq_head, *cq_tail, *cq_mask;
+		struct io_uring_cqe* cqes;
+
+		/**
+		 * the number of entries queued since the last io_uring_enter()
+		 */
+
+		unsigned to_submit;
+
+		/**
+		 * the completions taken off the completion ring whose callbacks have not been called yet
+		 */
+
+		deque<struct io_uring_cqe> reaped;
+
+		/**
+		 * the operations handed to the kernel that have not been called back yet, freed on destruction if they never are
+		 */
+
+		unordered_set<operation*> in_flight;
+
+		/**
+		 * @brief      moves every completion off the completion ring, without calling back
+		 * @details    frees the ring for the kernel, and never runs a callback, so it is safe to call while submitting
+		 * @return     the number of completions moved
+		 */
+
+		size_t reap() {
+			size_t moved = 0;
+			unsigned head = *cq_head;
+			while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+				reaped.push_back(cqes[head & *cq_mask]);
+				__atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+				++moved;
+			}
+			return moved;
+		}
+
+		/**
+		 * @brief      calls io_uring_enter(), retrying when interrupted
+		 * @details    the kernel refuses with EBUSY while completions it could not post are waiting for room on the
+		 *             completion ring, so the ring is reaped before retrying
+		 * @param[in]  min_complete  the number of completions to wait for
+		 * @throw      a socket_exception if io_uring_enter() fails, or keeps refusing with nothing left to reap
+		 */
+
+		void enter(unsigned min_complete) NET_THROWS(socket_exception) {
+			while (true) {
+				++syscall_count;
+				int submitted = syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+				if (submitted >= 0) {
+					to_submit -= submitted;
+					return;
+				}
+				if (errno == EBUSY) {
+					if (!reap())
+						throw socket_exception("uring_executor::enter()");
+					min_complete = 0; // the reaped completions are enough to go on with
+					continue;
+				}
+				if (errno != EINTR && errno != EAGAIN)
+					throw socket_exception("uring_executor::enter()");
+			}
+		}
+
+		/**
+		 * @brief      gets a free submission queue entry, submitting the queued ones until one frees up if the ring is full
+		 * @throw      a socket_exception if the queued entries cannot be submitted, or the kernel takes none of them
+		 * @return     a cleared submission queue entry, which is queued once this function returns
+		 */
+
+		struct io_uring_sqe* next_sqe() NET_THROWS(socket_exception) {
+			unsigned tail = *sq_tail;
+			while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries) {
+				unsigned queued = to_submit;
+				enter(0);
+				if (to_submit == queued) {
+					errno = EBUSY;
+					throw socket_exception("uring_executor::next_sqe()");
+				}
+			}
+			unsigned index = tail & *sq_mask;
+			struct io_uring_sqe* sqe = &sqes[index];
+			memset(sqe, 0, sizeof *sqe);
+			sq_array[index] = index;
+			__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+			++to_submit;
+			return sqe;
+		}
+
+		/**
+		 * @brief      records a new operation as in flight until it is called back
+		 * @return     the operation
+		 */
+
+		operation* track(operation* op) {
+			in_flight.insert(op);
+			return op;
+		}
+
+		/**
+		 * @brief      queues a read, send or accept for an operation
+		 * @throw      a socket_exception if the queued entries cannot be submitted
+		 */
+
+		void submit(operation* op) NET_THROWS(socket_exception) {
+			struct io_uring_sqe* sqe = next_sqe();
+			sqe->fd = op->fd;
+			sqe->user_data = (uint64_t) (uintptr_t) op;
+			switch (op->type) {
+				case operation::READ:
+					if (op->buffer >= 0) {
+						sqe->opcode = IORING_OP_READ_FIXED;
+						sqe->buf_index = op->buffer;
+					} else
+						sqe->opcode = IORING_OP_RECV;
+					sqe->addr = (uint64_t) (uintptr_t) op->data;
+					sqe->len = op->bytes;
+					break;
+				case operation::SEND:
+					sqe->opcode = IORING_OP_SEND;
+					sqe->addr = (uint64_t) (uintptr_t) (op->data + op->done);
+					sqe->len = op->bytes - op->done;
+					sqe->msg_flags = MSG_NOSIGNAL;
+					break;
+				case operation::ACCEPT:
+					sqe->opcode = IORING_OP_ACCEPT;
+					break;
+			}
+		}
+
+		/**
+		 * @brief      checks that the kernel supports every opcode used by this executor
+		 * @throw      a socket_exception if the probe fails or an opcode is missing
+		 */
+
+		void probe() NET_THROWS(socket_exception) {
+			size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+			vector<char> memory(size);
+			struct io_uring_probe* result = (struct io_uring_probe*) memory.data();
+			++syscall_count;
+			if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PROBE, result, 256) < 0)
+				throw socket_exception("uring_executor::probe()");
+			const int opcodes[] = {IORING_OP_READ_FIXED, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_ACCEPT};
+			for (size_t i = 0; i < sizeof opcodes / sizeof *opcodes; ++i)
+				if (opcodes[i] > result->last_op || !(result->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED)) {
+					errno = ENOSYS;
+					throw socket_exception("uring_executor::probe()");
+				}
+		}
+
+		/**
+		 * @brief      unmaps the rings and closes the io_uring file descriptor
+		 */
+
+		void destroy() {
+			if (sqes != MAP_FAILED) munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+			if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+			if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+			if (ringfd >= 0) ::close(ringfd);
+		}
+
+	public:
+
+		/**
+		 * @brief      sets up an io_uring instance and registers the pool of receive buffers with it
+		 * @param[in]  entries      the number of submission queue entries [default: uring_executor::DEFAULT_ENTRIES]
+		 * @param[in]  buffers      the number of receive buffers in the pool [default: executor::DEFAULT_BUFFERS]
+		 * @param[in]  buffer_size  the size of each receive buffer in bytes [default: executor::DEFAULT_BUFFER_SIZE]
+		 * @throw      a socket_exception if io_uring is unavailable, or lacks the operations used by this executor
+		 */
+
+		explicit uring_executor(unsigned entries = uring_executor::DEFAULT_ENTRIES, size_t buffers = executor::DEFAULT_BUFFERS, size_t buffer_size = executor::DEFAULT_BUFFER_SIZE) NET_THROWS(socket_exception):
+			executor(buffers, buffer_size),
+			sq_ring(MAP_FAILED),
+			cq_ring(MAP_FAILED),
+			sqes((struct io_uring_sqe*) MAP_FAILED),
+			to_submit(0) {
+			memset(&params, 0, sizeof params);
+			++syscall_count;
+			ringfd = syscall(__NR_io_uring_setup, entries, &params);
+			if (ringfd < 0)
+				throw socket_exception("uring_executor::io_uring_setup()");
+			try {
+				// map the rings, which share one mapping on newer kernels
+				sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+				bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+				if (single && cq_ring_size > sq_ring_size)
+					sq_ring_size = cq_ring_size;
+				sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+				if (sq_ring == MAP_FAILED)
+					throw socket_exception("uring_executor::mmap()");
+				cq_ring = single ? sq_ring : mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+				if (cq_ring == MAP_FAILED)
+					throw socket_exception("uring_executor::mmap()");
+				sqes = (struct io_uring_sqe*) mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+				if (sqes == MAP_FAILED)
+					throw socket_exception("uring_executor::mmap()");
+				char* sq = (char*) sq_ring;
+				char* cq = (char*) cq_ring;
+				sq_head = (unsigned*) (sq + params.sq_off.head);
+				sq_tail = (unsigned*) (sq + params.sq_off.tail);
+				sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+				sq_array = (unsigned*) (sq + params.sq_off.array);
+				cq_head = (unsigned*) (cq + params.cq_off.head);
+				cq_tail = (unsigned*) (cq + params.cq_off.tail);
+				cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+				cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+				probe();
+				// register the receive buffers so the kernel pins them once instead of on every read
+				vector<struct iovec> vectors(pool.size() / buffer_size);
+				for (size_t i = 0; i < vectors.size(); ++i) {
+					vectors[i].iov_base = &pool[i * buffer_size];
+					vectors[i].iov_len = buffer_size;
+				}
+				++syscall_count;
+				if (!vectors.empty() && syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, vectors.data(), vectors.size()) < 0)
+					throw socket_exception("uring_executor::io_uring_register()");
+			} catch (...) {
+				destroy();
+				throw;
+			}
+		}
+
+		/**
+		 * @brief      closes the io_uring instance; operations still pending are dropped without calling back
+		 */
+
+		~uring_executor() {
+			destroy();
+			// the ring is gone, so the kernel no longer writes into the buffers of the operations it never completed
+			for (unordered_set<operation*>::iterator it = in_flight.begin(); it != in_flight.end(); ++it) {
+				operation* op = *it;
+				if (op->type == operation::READ && op->buffer < 0) delete[] op->data;
+				delete op;
+			}
+		}
+
+		virtual const char* name() const {
+			return "io_uring";
+		}
+
+		virtual void async_read(const client& sock, read_callback done) {
+			submit(track(make_read(sock, done)));
+		}
+
+		virtual void async_send(const client& sock, const void* data, size_t bytes, send_callback done = send_callback()) {
+			submit(track(make_send(sock, data, bytes, done)));
+		}
+
+		virtual void async_accept(const server& sock, accept_callback done) {
+			submit(track(make_accept(sock, done)));
+		}
+
+		virtual size_t run_once() NET_THROWS(socket_exception) {
+			// submit everything queued since the last batch and wait, in one system call, unless completions are already waiting
+			enter(reaped.empty() ? 1 : 0);
+			reap();
+			size_t completed = 0;
+			while (!reaped.empty()) {
+				// callbacks may submit, which may reap more completions onto the back
+				struct io_uring_cqe cqe = reaped.front();
+				reaped.pop_front();
+				operation* op = (operation*) (uintptr_t) cqe.user_data;
+				ssize_t result = cqe.res;
+				if (op->type == operation::SEND && result > 0 && op->done + result < op->bytes) {
+					// partial send, queue the rest for the next batch
+					op->done += result;
+					submit(op);
+					continue;
+				}
+				if (op->type == operation::SEND && result > 0)
+					op->done += result;
+				in_flight.erase(op);
+				finish(op, result);
+				++completed;
+			}
+			return completed;
+		}
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const unsigned uring_executor::DEFAULT_ENTRIES;
+
+	/**
+	 * @brief      an executor that makes one system call per operation, as soon as epoll reports the socket ready
+	 */
+
+	class epoll_executor : public executor {
+	private:
+
+		/**
+		 * @brief      the operations waiting on a single file descriptor
+		 */
+
+		struct waiting {
+			deque<operation*> reads;	// reads and accepts
+			deque<operation*> sends;
+			bool watched;
+			waiting(): watched(false) {}
+		};
+
+		/**
+		 * the event loop reporting readiness
+		 */
+
+		event_loop loop;
+
+		/**
+		 * the waiting operations, indexed by file descriptor
+		 */
+
+		vector<waiting> fds;
+
+		/**
+		 * file descriptors with operations that may complete without waiting
+		 */
+
+		vector<int> ready;
+
+		/**
+		 * @brief      gets the operations waiting on a file descriptor, watching it on first use
+		 */
+
+		waiting& watch(int fd) {
+			if ((size_t) fd >= fds.size())
+				fds.resize(fd + 1);
+			waiting& entry = fds[fd];
+			if (!entry.watched) {
+				++syscall_count;
+				loop.add(fd, [this, fd] {attempt(fd);}, [this, fd] {attempt(fd);});
+				entry.watched = true;
+			}
+			return entry;
+		}
+
+		/**
+		 * @brief      attempts the first operation of a queue once, without blocking
+		 * @return     false if the socket would block, in which case the operation stays queued
+		 */
+
+		bool attempt(deque<operation*>& queue) {
+			operation* op = queue.front();
+			ssize_t result;
+			++syscall_count;
+			switch (op->type) {
+				case operation::READ:
+					result = ::recv(op->fd, op->data, op->bytes, MSG_DONTWAIT);
+					break;
+				case operation::SEND:
+					result = ::send(op->fd, op->data + op->done, op->bytes - op->done, MSG_DONTWAIT | MSG_NOSIGNAL);
+					break;
+				default:
+					result = ::accept(op->fd, NULL, NULL);
+					break;
+			}
+			if (result < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+					return false;
+				result = -errno;
+			}
+			else if (op->type == operation::SEND) {
+				op->done += result;
+				if (result > 0 && op->done < op->bytes)
+					return true; // partial send, keep going
+			}
+			queue.pop_front();
+			if (op->type == operation::READ && result <= 0)
+				forget(op->fd); // the connection is over, and its fd may be reused once the caller closes it
+			finish(op, result);
+			return true;
+		}
+
+		/**
+		 * @brief      stops watching a file descriptor, failing the operations still waiting on it with ECONNRESET
+		 */
+
+		void forget(int fd) {
+			waiting& entry = fds[fd];
+			if (!entry.watched) return;
+			++syscall_count;
+			loop.remove(fd);
+			entry.watched = false;
+			deque<operation*> orphans;
+			orphans.insert(orphans.end(), entry.reads.begin(), entry.reads.end());
+			orphans.insert(orphans.end(), entry.sends.begin(), entry.sends.end());
+			entry.reads.clear();
+			entry.sends.clear();
+			for (size_t i = 0; i < orphans.size(); ++i)
+				finish(orphans[i], -ECONNRESET);
+		}
+
+		/**
+		 * @brief      attempts every queued operation of a file descriptor until the socket would block
+		 */
+
+		void attempt(int fd) {
+			while (fds[fd].watched && fds[fd].reads.size() && attempt(fds[fd].reads));
+			while (fds[fd].watched && fds[fd].sends.size() && attempt(fds[fd].sends));
+		}
+
+		/**
+		 * @brief      queues an operation, and remembers to attempt it right away in case the socket is already ready
+		 */
+
+		void enqueue(operation* op) {
+			waiting& entry = watch(op->fd);
+			(op->type == operation::SEND ? entry.sends : entry.reads).push_back(op);
+			ready.push_back(op->fd);
+		}
+
+	public:
+
+		/**
+		 * @brief      creates an epoll executor
+		 * @param[in]  buffers      the number of receive buffers in the pool [default: executor::DEFAULT_BUFFERS]
+		 * @param[in]  buffer_size  the size of each receive buffer in bytes [default: executor::DEFAULT_BUFFER_SIZE]
+		 * @throw      a socket_exception if the epoll instance cannot be created
+		 */
+
+		explicit epoll_executor(size_t buffers = executor::DEFAULT_BUFFERS, size_t buffer_size = executor::DEFAULT_BUFFER_SIZE) NET_THROWS(socket_exception):
+			executor(buffers, buffer_size) {}
+
+		/**
+		 * @brief      frees the operations that are still pending, without calling back
+		 */
+
+		~epoll_executor() {
+			for (size_t fd = 0; fd < fds.size(); ++fd) {
+				while (!fds[fd].reads.empty()) {
+					operation* op = fds[fd].reads.front();
+					if (op->type == operation::READ && op->buffer < 0) delete[] op->data;
+					delete op;
+					fds[fd].reads.pop_front();
+				}
+				while (!fds[fd].sends.empty()) {
+					delete fds[fd].sends.front();
+					fds[fd].sends.pop_front();
+				}
+			}
+		}
+
+		virtual const char* name() const {
+			return "epoll";
+		}
+
+		virtual void async_read(const client& sock, read_callback done) {
+			enqueue(make_read(sock, done));
+		}
+
+		virtual void async_send(const client& sock, const void* data, size_t bytes, send_callback done = send_callback()) {
+			enqueue(make_send(sock, data, bytes, done));
+		}
+
+		/**
+		 * @details    accept() is called on the server's fd without waiting, so the server is put in non-blocking mode
+		 */
+
+		virtual void async_accept(const server& sock, accept_callback done) {
+			int fd = sock;
+			if (fd >= 0 && ((size_t) fd >= fds.size() || !fds[fd].watched))
+				server(sock).set_blocking(false);
+			enqueue(make_accept(sock, done));
+		}
+
+		virtual size_t run_once() NET_THROWS(socket_exception) {
+			size_t before = pending_ops;
+			// sockets with newly queued operations may already be ready, so try them before waiting
+			vector<int> attempts;
+			attempts.swap(ready);
+			for (size_t i = 0; i < attempts.size(); ++i)
+				attempt(attempts[i]);
+			if (pending_ops == before) {
+				++syscall_count;
+				loop.poll(ready.empty() ? -1 : 0);
+			}
+			return before > pending_ops ? before - pending_ops : 0;
+		}
+
+	};
+
+	/**
+	 * @brief      creates the fastest executor supported by this kernel
+	 * @param[in]  prefer_uring  whether to try io_uring before falling back to epoll [default: true]
+	 * @return     an io_uring executor if io_uring is available and preferred, otherwise an epoll executor
+	 */
+
+	inline unique_ptr<executor> make_executor(bool prefer_uring = true) {
+		if (prefer_uring) {
+			try {return unique_ptr<executor>(new uring_executor());}
+			catch (socket_exception&) {}
+		}
+		return unique_ptr<executor>(new epoll_executor());
+	}
+
+}
+
+#endif /* __INCLUDE_NET_EXECUTOR__ */
@@ -0,0 +1,200 @@
+/**
+ * This header helps receive files of any size from a net::client with
+ * constant memory. A net::mapped_file preallocates its output on disk
+ * with fallocate(), then maps it one window at a time, so the bytes read
+ * from the socket land directly in the page cache of the file. Unmapping
+ * each window once it is full keeps the resident memory of the process
+ * bounded by the size of a window, however large the file is.
+ *
+ * Use net::receive_file() to read a range of the file from a client
+ * straight into its windows.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_FILE__
+#define __INCLUDE_NET_FILE__
+
+#include <stdint.h>			// uint64_t
+#include <fcntl.h>			// open(), fallocate()
+#include <unistd.h>			// close(), ftruncate(), sysconf()
+#include <sys/mman.h>		// mmap(), munmap()
+#include "net_socket.hpp"	// net::socket_exception
+#include "net_client.hpp"	// net::client
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      a preallocated output file that is written through a sliding memory map
+	 */
+
+	class mapped_file {
+	public:
+
+		/**
+		 * the default number of bytes mapped at once
+		 */
+
+		static const size_t DEFAULT_WINDOW = 32 * 1024 * 1024;
+
+	private:
+
+		/**
+		 * the file descriptor of the file
+		 */
+
+		int fd;
+
+		/**
+		 * the size of the file in bytes
+		 */
+
+		uint64_t bytes;
+
+		/**
+		 * the start of the current mapping, which is page-aligned, or NULL if nothing is mapped
+		 */
+
+		char* mapping;
+
+		/**
+		 * the length of the current mapping
+		 */
+
+		size_t mapped;
+
+	public:
+
+		/**
+		 * @brief      opens a file for writing and preallocates it to its final size
+		 * @details    falls back to ftruncate(), which leaves the file sparse, on file systems without fallocate()
+		 * @param[in]  path      the path of the file; created if it does not exist
+		 * @param[in]  size      the final size of the file in bytes
+		 * @param[in]  truncate  whether existing contents should be discarded first [default: true]
+		 * @throw      a socket_exception if the file cannot be opened or allocated
+		 */
+
+		mapped_file(const char* path, uint64_t size, bool truncate = true) NET_THROWS(socket_exception):
+			fd(open(path, O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644)),
+			bytes(size),
+			mapping(NULL),
+			mapped(0) {
+			if (fd < 0)
+				throw socket_exception("mapped_file::open()");
+			if (size && fallocate(fd, 0, 0, size) < 0 && (errno != EOPNOTSUPP || ftruncate(fd, size) < 0)) {
+				::close(fd);
+				throw socket_exception("mapped_file::fallocate()");
+			}
+		}
+
+		/**
+		 * @brief      unmaps the current window and closes the file
+		 */
+
+		~mapped_file() {
+			unmap();
+			::close(fd);
+		}
+
+		/**
+		 * @brief      gets the size of the file in bytes
+		 */
+
+		inline uint64_t size() const {
+			return bytes;
+		}
+
+		/**
+		 * @brief      gets the file descriptor of the file
+		 */
+
+		inline operator int() const {
+			return fd;
+		}
+
+		/**
+		 * @brief      maps a range of the file, replacing the current window
+		 * @param[in]  offset  the offset of the first byte of the range
+		 * @param[in]  length  the number of bytes in the range; must not go past the end of the file
+		 * @throw      a socket_exception if the range cannot be mapped
+		 * @return     a pointer to the byte at offset
+		 */
+
+		char* map(uint64_t offset, size_t length) NET_THROWS(socket_exception) {
+			unmap();
+			if (!length) return NULL;
+			// mappings must start on a page boundary
+			static const uint64_t page = sysconf(_SC_PAGESIZE);
+			uint64_t start = offset - offset % page;
+			mapped = length + (offset - start);
+			void* memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, start);
+			if (memory == MAP_FAILED) {
+				mapped = 0;
+				throw socket_exception("mapped_file::map()");
+			}
+			mapping = (char*) memory;
+			return mapping + (offset - start);
+		}
+
+		/**
+		 * @brief      unmaps the current window, which releases its pages from the memory of this process
+		 * @details    written pages stay in the page cache, and are written back to disk by the kernel
+		 */
+
+		void unmap() {
+			if (mapping) munmap(mapping, mapped);
+			mapping = NULL;
+			mapped = 0;
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		mapped_file(const mapped_file&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		mapped_file& operator = (const mapped_file&);
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const size_t mapped_file::DEFAULT_WINDOW;
+
+	/**
+	 * @brief      receives a range of a file from a client directly into the file's memory map, one window at a time
+	 * @details    closes the client socket if the connection was lost
+	 * @param      sock    the client to receive from
+	 * @param      file    the file to write into
+	 * @param[in]  offset  the offset in the file of the first byte received
+	 * @param[in]  length  the number of bytes to receive
+	 * @param[in]  window  the number of bytes mapped at once [default: mapped_file::DEFAULT_WINDOW]
+	 * @throw      a socket_exception if there was an error in receiving or mapping the file
+	 * @return     a reference to the client, which can be used to detect if the connection was unexpectedly closed or not
+	 */
+
+	inline client& receive_file(client& sock, mapped_file& file, uint64_t offset, uint64_t length, size_t window = mapped_file::DEFAULT_WINDOW) NET_THROWS(socket_exception) {
+		while (length && sock) {
+			size_t chunk = length < window ? length : window;
+			sock.read(file.map(offset, chunk), chunk);
+			file.unmap();
+			offset += chunk;
+			length -= chunk;
+		}
+		return sock;
+	}
+
+}
+
+#endif /* __INCLUDE_NET_FILE__ */
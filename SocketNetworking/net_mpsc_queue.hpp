@@ -0,0 +1,146 @@
+/**
+ * A lock-free, unbounded queue with many producers and a single consumer,
+ * for handing work to a thread that owns some state, e.g. an event loop,
+ * without a mutex that every producer would contend on.
+ *
+ * Producers link a new node to the head with a single atomic exchange,
+ * so pushing never waits on the consumer or on other producers. Only the
+ * consumer thread may pop. Items pushed by the same thread are popped in
+ * the order they were pushed.
+ *
+ * A push that is in the middle of linking its node hides the nodes after
+ * it for a moment, so a pop may return false while the queue is not quite
+ * empty. The consumer must therefore be woken up again by any push it may
+ * have missed. event_loop::post() does this with a flag: the producer
+ * links its node first, then sets the flag and wakes the loop only if the
+ * flag was clear, and the loop clears the flag before it pops. A push that
+ * was hidden from those pops finds the flag clear once it has linked its
+ * node, and wakes the loop again; pushes that land while the flag is set
+ * are seen by the pops of the wake-up already pending, so a burst of them
+ * costs a single wake-up.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_MPSC_QUEUE__
+#define __INCLUDE_NET_MPSC_QUEUE__
+
+#include <atomic>			// std::atomic
+#include <utility>			// std::move()
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      a lock-free queue that any thread may push to and a single thread pops from
+	 * @tparam     T     the type of the items, which must be default-constructible and movable
+	 */
+
+	template<class T>
+	class mpsc_queue {
+
+		/**
+		 * @brief      a queued item and the link to the item pushed after it
+		 */
+
+		struct node {
+			atomic<node*> next;
+			T value;
+			node(): next(NULL) {}
+			explicit node(T value): next(NULL), value(std::move(value)) {}
+		};
+
+		/**
+		 * the last node pushed, exchanged by the producers
+		 */
+
+		atomic<node*> head;
+
+		/**
+		 * the node before the oldest item, owned by the consumer; its value was already popped
+		 */
+
+		node* tail;
+
+	public:
+
+		/**
+		 * @brief      constructs an empty queue
+		 */
+
+		mpsc_queue(): head(new node()), tail(head.load()) {}
+
+		/**
+		 * @brief      frees the items that were not popped
+		 */
+
+		~mpsc_queue() {
+			while (tail) {
+				node* next = tail->next.load(memory_order_relaxed);
+				delete tail;
+				tail = next;
+			}
+		}
+
+		/**
+		 * @brief      adds an item to the back of the queue
+		 * @details    safe to call from any thread
+		 * @param[in]  value  the item, which is moved into the queue
+		 */
+
+		void push(T value) {
+			node* item = new node(std::move(value));
+			node* previous = head.exchange(item, memory_order_acq_rel);
+			previous->next.store(item, memory_order_release);
+		}
+
+		/**
+		 * @brief      takes the item at the front of the queue
+		 * @details    must only be called by the consumer thread
+		 * @param[out] value  set to the item if there is one
+		 * @return     false if there is no item to take yet
+		 */
+
+		bool pop(T& value) {
+			node* next = tail->next.load(memory_order_acquire);
+			if (!next)
+				return false;
+			value = std::move(next->value);
+			delete tail;
+			tail = next;
+			return true;
+		}
+
+		/**
+		 * @brief      checks if there is no item to take yet
+		 * @details    must only be called by the consumer thread
+		 */
+
+		inline bool empty() const {
+			return !tail->next.load(memory_order_acquire);
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		mpsc_queue(const mpsc_queue&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		mpsc_queue& operator = (const mpsc_queue&);
+
+	};
+
+}
+
+#endif /* __INCLUDE_NET_MPSC_QUEUE__ */
@@ -0,0 +1,321 @@
+/**
+ * This header helps programs that connect to the same servers over and
+ * over. A net::connection_pool keeps idle connections to every endpoint
+ * warm, so a connection can be reused instead of paying for a new
+ * handshake, and opens new ones with a deadline so a dead server never
+ * stalls the caller for longer than the timeout.
+ *
+ * A net::backoff spaces out retries exponentially, with random jitter so
+ * that many clients that lost the same server do not all reconnect at the
+ * same moment:
+ *
+ *     net::backoff retry;
+ *     while (!client) {
+ *         try {client = net::client(host, port, timeout);}
+ *         catch (net::socket_exception&) {retry.wait();}
+ *     }
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_POOL__
+#define __INCLUDE_NET_POOL__
+
+#include <cerrno>			// errno
+#include <string>			// std::string, std::to_string()
+#include <vector>			// std::vector
+#include <map>				// std::map
+#include <mutex>			// std::mutex, std::lock_guard
+#include <random>			// std::minstd_rand, std::random_device
+#include <thread>			// std::this_thread::sleep_for()
+#include <chrono>			// std::chrono::milliseconds
+#include <utility>			// std::move()
+#include <sys/socket.h>		// recv()
+#include "net_socket.hpp"	// net::socket_exception
+#include "net_client.hpp"	// net::client
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      exponentially growing delays between retries, with jitter
+	 */
+
+	class backoff {
+	public:
+
+		/**
+		 * the default first delay in milliseconds
+		 */
+
+		static const int DEFAULT_INITIAL = 100;
+
+		/**
+		 * the default longest delay in milliseconds
+		 */
+
+		static const int DEFAULT_MAXIMUM = 10000;
+
+	private:
+
+		/**
+		 * the first delay in milliseconds
+		 */
+
+		int initial;
+
+		/**
+		 * the longest delay in milliseconds
+		 */
+
+		int maximum;
+
+		/**
+		 * the upper bound of the next delay in milliseconds
+		 */
+
+		int current;
+
+		/**
+		 * picks the jitter of each delay
+		 */
+
+		minstd_rand random;
+
+	public:
+
+		/**
+		 * @brief      constructs a backoff that starts at its first delay
+		 * @param[in]  initial  the first delay in milliseconds [default: DEFAULT_INITIAL]
+		 * @param[in]  maximum  the longest delay in milliseconds [default: DEFAULT_MAXIMUM]
+		 */
+
+		backoff(int initial = DEFAULT_INITIAL, int maximum = DEFAULT_MAXIMUM):
+			initial(initial > 0 ? initial : 1),
+			maximum(maximum > initial ? maximum : initial),
+			current(this->initial),
+			random(random_device()()) {}
+
+		/**
+		 * @brief      gets the next delay, then doubles the delay after it up to the maximum
+		 * @details    the delay is picked at random between half and all of the current bound
+		 * @return     the number of milliseconds to wait before the next retry
+		 */
+
+		int next() {
+			int delay = current / 2 + random() % (current - current / 2 + 1);
+			current = current < maximum / 2 ? current * 2 : maximum;
+			return delay;
+		}
+
+		/**
+		 * @brief      sleeps for the next delay
+		 */
+
+		void wait() {
+			this_thread::sleep_for(chrono::milliseconds(next()));
+		}
+
+		/**
+		 * @brief      starts over from the first delay, e.g. after a retry succeeded
+		 */
+
+		void reset() {
+			current = initial;
+		}
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const int backoff::DEFAULT_INITIAL;
+	const int backoff::DEFAULT_MAXIMUM;
+
+	/**
+	 * @brief      a thread-safe pool of idle connections, grouped by host and port
+	 */
+
+	class connection_pool {
+	public:
+
+		/**
+		 * the default number of idle connections kept for each endpoint
+		 */
+
+		static const size_t DEFAULT_MAX_IDLE = 8;
+
+		/**
+		 * the default number of milliseconds a new connection may take
+		 */
+
+		static const int DEFAULT_TIMEOUT = 3000;
+
+	private:
+
+		/**
+		 * guards the idle connections
+		 */
+
+		mutable mutex lock;
+
+		/**
+		 * the idle connections of every "host:port", most recently used last
+		 */
+
+		map<string, vector<client> > idle;
+
+		/**
+		 * the number of idle connections kept for each endpoint
+		 */
+
+		size_t max_idle;
+
+		/**
+		 * the number of milliseconds a new connection may take
+		 */
+
+		int timeout;
+
+		/**
+		 * @brief      gets the key of an endpoint in the pool
+		 */
+
+		static string endpoint(const string& host, unsigned short port) {
+			return host + ":" + to_string(port);
+		}
+
+		/**
+		 * @brief      checks if an idle connection can still be used
+		 * @details    an idle connection must have nothing to read: end of file means the server closed it, and
+		 *             unexpected data means it is no longer in step with the protocol
+		 * @param[in]  sock  the idle connection
+		 */
+
+		static bool reusable(const client& sock) {
+			if (!sock.good() || sock.available())
+				return false;
+			char byte;
+			return recv(sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+
+	public:
+
+		/**
+		 * @brief      constructs an empty pool
+		 * @param[in]  max_idle  the number of idle connections kept for each endpoint [default: DEFAULT_MAX_IDLE]
+		 * @param[in]  timeout   the number of milliseconds a new connection may take [default: DEFAULT_TIMEOUT]
+		 */
+
+		connection_pool(size_t max_idle = DEFAULT_MAX_IDLE, int timeout = DEFAULT_TIMEOUT):
+			max_idle(max_idle),
+			timeout(timeout) {}
+
+		/**
+		 * @brief      gets a connection to an endpoint, reusing an idle one if possible
+		 * @details    idle connections that were closed in the meantime are dropped
+		 * @param[in]  host  the host server to connect to
+		 * @param[in]  port  the host port to connect to
+		 * @throw      a socket_exception if a new connection cannot be made within the timeout
+		 * @return     a connected client, which can be given back with release() when the caller is done with it
+		 */
+
+		client acquire(const string& host, unsigned short port) NET_THROWS(socket_exception) {
+			{
+				lock_guard<mutex> guard(lock);
+				vector<client>& connections = idle[endpoint(host, port)];
+				while (!connections.empty()) {
+					client sock = std::move(connections.back());
+					connections.pop_back();
+					if (reusable(sock))
+						return sock;
+				}
+			}
+			// connect outside of the lock, so a slow server does not stall other endpoints
+			return client(host, port, timeout);
+		}
+
+		/**
+		 * @brief      gives a connection back to the pool, so it can be reused
+		 * @details    the connection is closed instead if it is no longer usable or the endpoint already has enough
+		 *             idle connections
+		 * @param[in]  host  the host the connection was acquired for
+		 * @param[in]  port  the port the connection was acquired for
+		 * @param[in]  sock  the connection, which must have nothing left to read
+		 */
+
+		void release(const string& host, unsigned short port, client sock) {
+			if (!reusable(sock))
+				return;
+			lock_guard<mutex> guard(lock);
+			vector<client>& connections = idle[endpoint(host, port)];
+			if (connections.size() < max_idle)
+				connections.push_back(std::move(sock));
+		}
+
+		/**
+		 * @brief      opens connections ahead of time until an endpoint has a number of idle connections
+		 * @param[in]  host   the host server to connect to
+		 * @param[in]  port   the host port to connect to
+		 * @param[in]  count  the number of idle connections wanted, up to the maximum of the pool
+		 * @throw      a socket_exception if a connection cannot be made within the timeout
+		 * @return     the number of idle connections to the endpoint
+		 */
+
+		size_t warm(const string& host, unsigned short port, size_t count) NET_THROWS(socket_exception) {
+			if (count > max_idle)
+				count = max_idle;
+			for (size_t have = idle_count(host, port); have < count;) {
+				release(host, port, client(host, port, timeout));
+				size_t now = idle_count(host, port);
+				if (now <= have) break; // the server does not leave new connections idle
+				have = now;
+			}
+			return idle_count(host, port);
+		}
+
+		/**
+		 * @brief      gets the number of idle connections to an endpoint
+		 */
+
+		size_t idle_count(const string& host, unsigned short port) const {
+			lock_guard<mutex> guard(lock);
+			map<string, vector<client> >::const_iterator it = idle.find(endpoint(host, port));
+			return it == idle.end() ? 0 : it->second.size();
+		}
+
+		/**
+		 * @brief      closes every idle connection
+		 */
+
+		void clear() {
+			lock_guard<mutex> guard(lock);
+			idle.clear();
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		connection_pool(const connection_pool&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		connection_pool& operator = (const connection_pool&);
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const size_t connection_pool::DEFAULT_MAX_IDLE;
+	const int connection_pool::DEFAULT_TIMEOUT;
+
+}
+
+#endif /* __INCLUDE_NET_POOL__ */
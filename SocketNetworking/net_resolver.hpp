@@ -0,0 +1,210 @@
+/**
+ * This header resolves host names into IPv4 addresses for net::client,
+ * with getaddrinfo() instead of gethostbyname(), which is not thread-safe.
+ * A net::resolver caches every answer for a fixed time to live, so a burst
+ * of reconnects to the same host only performs one lookup. Lookups run on
+ * their own thread and are shared through a std::shared_future: concurrent
+ * callers asking for the same host wait on the same lookup, and callers
+ * that must not block can start one with resolver::resolve_async().
+ *
+ * net::client uses the process-wide resolver::shared() cache.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_RESOLVER__
+#define __INCLUDE_NET_RESOLVER__
+
+#include <cstring>			// memset()
+#include <cerrno>			// errno
+#include <string>			// std::string, std::to_string()
+#include <vector>			// std::vector
+#include <map>				// std::map
+#include <mutex>			// std::mutex, std::lock_guard
+#include <future>			// std::async(), std::shared_future
+#include <chrono>			// std::chrono::steady_clock
+#include <sys/socket.h>		// AF_INET, SOCK_STREAM
+#include <netinet/in.h>		// sockaddr_in
+#include <netdb.h>			// getaddrinfo(), freeaddrinfo()
+#include "net_socket.hpp"	// net::socket_exception
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      a thread-safe cache of host name lookups with a time to live
+	 */
+
+	class resolver {
+	public:
+
+		/**
+		 * the IPv4 addresses of a host, in the order they should be tried
+		 */
+
+		typedef vector<sockaddr_in> addresses;
+
+		/**
+		 * the default number of seconds an answer is cached
+		 */
+
+		static const int DEFAULT_TTL = 60;
+
+	private:
+
+		/**
+		 * @brief      a cached lookup, which may still be in progress
+		 */
+
+		struct record {
+			shared_future<addresses> answer;
+			chrono::steady_clock::time_point expires;
+		};
+
+		/**
+		 * guards the cache
+		 */
+
+		mutex lock;
+
+		/**
+		 * the lookups of every "host:port"
+		 */
+
+		map<string, record> cache;
+
+		/**
+		 * the number of seconds an answer is cached
+		 */
+
+		int ttl;
+
+		/**
+		 * @brief      looks up the addresses of a host with getaddrinfo(), which blocks
+		 * @param[in]  host  the host name or dotted IPv4 address
+		 * @param[in]  port  the port to put in the addresses
+		 * @throw      a socket_exception if the host cannot be resolved
+		 * @return     the addresses of the host
+		 */
+
+		static addresses lookup(const string& host, unsigned short port) NET_THROWS(socket_exception) {
+			struct addrinfo hints;
+			memset(&hints, 0, sizeof hints);
+			hints.ai_family = AF_INET;
+			hints.ai_socktype = SOCK_STREAM;
+			struct addrinfo* found = NULL;
+			int error = getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &found);
+			if (error) {
+				// only system errors come with an errno
+				if (error != EAI_SYSTEM)
+					errno = error == EAI_AGAIN ? EAGAIN : EHOSTUNREACH;
+				throw socket_exception("resolver::getaddrinfo()");
+			}
+			addresses result;
+			for (struct addrinfo* it = found; it; it = it->ai_next)
+				result.push_back(*(sockaddr_in*) it->ai_addr);
+			freeaddrinfo(found);
+			return result;
+		}
+
+		/**
+		 * @brief      checks if a cached lookup failed
+		 * @param[in]  answer  a lookup that has already finished
+		 */
+
+		static bool failed(const shared_future<addresses>& answer) {
+			try {answer.get();}
+			catch (...) {return true;}
+			return false;
+		}
+
+	public:
+
+		/**
+		 * @brief      constructs an empty cache
+		 * @param[in]  ttl   the number of seconds an answer is cached [default: DEFAULT_TTL]
+		 */
+
+		resolver(int ttl = DEFAULT_TTL): ttl(ttl) {}
+
+		/**
+		 * @brief      gets the process-wide cache used by net::client
+		 */
+
+		static resolver& shared() {
+			static resolver instance;
+			return instance;
+		}
+
+		/**
+		 * @brief      starts resolving a host, unless an answer is already cached or on its way
+		 * @details    failed lookups are not cached, so the next call tries again
+		 * @param[in]  host  the host name or dotted IPv4 address
+		 * @param[in]  port  the port to put in the addresses
+		 * @return     a future holding the addresses, or a socket_exception if the host cannot be resolved
+		 */
+
+		shared_future<addresses> resolve_async(const string& host, unsigned short port) {
+			string key = host + ":" + to_string(port);
+			chrono::steady_clock::time_point now = chrono::steady_clock::now();
+			lock_guard<mutex> guard(lock);
+			map<string, record>::iterator it = cache.find(key);
+			if (it != cache.end() && now < it->second.expires) {
+				const shared_future<addresses>& answer = it->second.answer;
+				if (answer.wait_for(chrono::seconds(0)) != future_status::ready || !failed(answer))
+					return answer;
+			}
+			record& entry = cache[key];
+			entry.answer = async(launch::async, &resolver::lookup, host, port).share();
+			entry.expires = now + chrono::seconds(ttl);
+			return entry.answer;
+		}
+
+		/**
+		 * @brief      resolves a host, waiting for the lookup if it is not cached yet
+		 * @param[in]  host  the host name or dotted IPv4 address
+		 * @param[in]  port  the port to put in the addresses
+		 * @throw      a socket_exception if the host cannot be resolved
+		 * @return     the addresses of the host
+		 */
+
+		addresses resolve(const string& host, unsigned short port) NET_THROWS(socket_exception) {
+			return resolve_async(host, port).get();
+		}
+
+		/**
+		 * @brief      forgets every cached answer
+		 */
+
+		void clear() {
+			lock_guard<mutex> guard(lock);
+			cache.clear();
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		resolver(const resolver&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		resolver& operator = (const resolver&);
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const int resolver::DEFAULT_TTL;
+
+}
+
+#endif /* __INCLUDE_NET_RESOLVER__ */
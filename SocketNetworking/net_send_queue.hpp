@@ -0,0 +1,394 @@
+/**
+ * A bounded queue of outbound messages for one socket, so a server that
+ * sends the same message to many clients never waits on the slowest of
+ * them. Messages are written right away with non-blocking sends, and
+ * whatever the socket cannot take yet is queued until the socket becomes
+ * writable, when the thread of its event loop calls send_queue::flush().
+ *
+ * The queue holds at most a fixed number of bytes. When a message does
+ * not fit, the overflow policy decides what happens:
+ *
+ *     DROP_OLDEST  the oldest queued messages are dropped to make room
+ *     DISCONNECT   the connection is shut down, so its reader sees the
+ *                  end of file and cleans it up
+ *     BLOCK        the sender waits until the socket has taken enough,
+ *                  for at most a timeout, after which the connection is
+ *                  shut down like DISCONNECT
+ *
+ * A blocked sender does not hold the lock of the queue while it waits, so
+ * the event loop of the socket keeps flushing it, and closing the queue
+ * wakes the sender up instead of waiting behind it.
+ *
+ * Messages are held as shared_buffer, an immutable refcounted string, so
+ * a broadcast is framed once and then referenced by the queue of every
+ * client it goes to; it is freed once the last of them has written it.
+ *
+ * A send_queue may be pushed to from any thread. It never closes its
+ * socket: the owner calls send_queue::close() before closing the socket,
+ * so that a late push from another thread cannot write into a new socket
+ * that reuses the same file descriptor.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_SEND_QUEUE__
+#define __INCLUDE_NET_SEND_QUEUE__
+
+#include <string>			// std::string
+#include <memory>			// std::shared_ptr, std::make_shared()
+#include <deque>			// std::deque
+#include <mutex>			// std::mutex, std::lock_guard, std::unique_lock
+#include <chrono>			// std::chrono::steady_clock
+#include <utility>			// std::move()
+#include <cerrno>			// errno
+#include <climits>			// IOV_MAX
+#include <sys/socket.h>		// sendmsg(), shutdown()
+#include <sys/uio.h>		// iovec
+#include <poll.h>			// poll()
+#include "net_stats.hpp"	// net::io_probe
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * an immutable message that can be queued to many sockets without being copied
+	 */
+
+	typedef shared_ptr<const string> shared_buffer;
+
+	/**
+	 * @brief      makes a shared_buffer out of a message
+	 * @param[in]  bytes  the message, which is moved into the buffer
+	 */
+
+	inline shared_buffer make_shared_buffer(string bytes) {
+		return make_shared<const string>(std::move(bytes));
+	}
+
+	/**
+	 * @brief      a thread-safe, bounded queue of messages that are written to a socket without blocking
+	 */
+
+	class send_queue {
+	public:
+
+		/**
+		 * @brief      what happens when a message does not fit in the queue
+		 */
+
+		enum overflow_policy {
+			DROP_OLDEST,	// drop the oldest messages that were not started yet
+			DISCONNECT,		// shut down the connection
+			BLOCK			// wait until the socket has taken enough of the queue, or shut down the connection on timeout
+		};
+
+		/**
+		 * the default number of bytes a queue holds
+		 */
+
+		static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+		/**
+		 * the default number of milliseconds a push waits under the BLOCK policy
+		 */
+
+		static const int DEFAULT_BLOCK_TIMEOUT = 5000;
+
+	private:
+
+		/**
+		 * guards everything below
+		 */
+
+		mutable mutex lock;
+
+		/**
+		 * the socket the messages are written to, or -1 once the queue was closed
+		 */
+
+		int sockfd;
+
+		/**
+		 * the queued messages, oldest first, and the number of bytes of the oldest one that were already written
+		 */
+
+		deque<shared_buffer> messages;
+		size_t offset;
+
+		/**
+		 * the number of bytes queued and not written yet
+		 */
+
+		size_t queued;
+
+		/**
+		 * the maximum number of bytes queued, and what happens when a message does not fit
+		 */
+
+		size_t capacity;
+		overflow_policy policy;
+
+		/**
+		 * the maximum number of milliseconds a push waits under the BLOCK policy
+		 */
+
+		int block_timeout;
+
+		/**
+		 * the number of threads waiting for the socket without holding the lock
+		 */
+
+		int waiters;
+
+		/**
+		 * the number of messages dropped by the DROP_OLDEST policy
+		 */
+
+		unsigned long drops;
+
+		/**
+		 * whether the connection failed or was shut down, after which messages are discarded
+		 */
+
+		bool failed;
+
+		/**
+		 * @brief      gives up on the connection, so its reader sees the end of file
+		 */
+
+		void fail() {
+			failed = true;
+			::shutdown(sockfd, SHUT_RDWR);
+			messages.clear();
+			offset = queued = 0;
+		}
+
+		/**
+		 * @brief      writes queued messages until the queue is empty or the socket would block; the lock must be held
+		 * @return     false if the connection failed
+		 */
+
+		bool drain() {
+			while (!messages.empty()) {
+				struct iovec parts[64 < IOV_MAX ? 64 : IOV_MAX];
+				int count = 0;
+				for (deque<shared_buffer>::iterator it = messages.begin(); it != messages.end() && count < (int) (sizeof parts / sizeof *parts); ++it, ++count) {
+					size_t skip = count ? 0 : offset;
+					parts[count].iov_base = (char*) (*it)->data() + skip;
+					parts[count].iov_len = (*it)->size() - skip;
+				}
+				struct msghdr message = {};
+				message.msg_iov = parts;
+				message.msg_iovlen = count;
+				size_t pending = 0;
+				for (int i = 0; i < count; ++i)
+					pending += parts[i].iov_len;
+				io_probe probe;
+				ssize_t sent = ::sendmsg(sockfd, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+				probe.sent(sockfd, pending, sent);
+				if (sent < 0) {
+					if (errno == EINTR) continue;
+					if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+					fail();
+					return false;
+				}
+				// pop the messages that were written completely
+				queued -= sent;
+				sent += offset;
+				while (!messages.empty() && (size_t) sent >= messages.front()->size()) {
+					sent -= messages.front()->size();
+					messages.pop_front();
+				}
+				offset = sent;
+			}
+			return true;
+		}
+
+		/**
+		 * @brief      waits until the socket can take more bytes, releasing the lock while waiting
+		 * @details    the queue may have been closed, flushed or failed by the time this returns
+		 * @param      guard    the held lock, which is held again on return
+		 * @param[in]  timeout  the maximum number of milliseconds to wait
+		 * @return     false if the wait timed out or failed
+		 */
+
+		bool wait_writable(unique_lock<mutex>& guard, int timeout) {
+			struct pollfd watched = {sockfd, POLLOUT, 0};
+			++waiters;
+			guard.unlock();
+			int ready;
+			while ((ready = ::poll(&watched, 1, timeout)) < 0 && errno == EINTR);
+			guard.lock();
+			--waiters;
+			return ready > 0;
+		}
+
+	public:
+
+		/**
+		 * @brief      constructs an empty queue for a connected socket
+		 * @param[in]  sockfd    the file descriptor of the socket
+		 * @param[in]  capacity  the maximum number of bytes queued [default: DEFAULT_CAPACITY]
+		 * @param[in]  policy    what happens when a message does not fit [default: DROP_OLDEST]
+		 * @param[in]  block_timeout  the maximum number of milliseconds a push waits under the BLOCK policy before
+		 *                            it shuts the connection down [default: DEFAULT_BLOCK_TIMEOUT]
+		 */
+
+		send_queue(int sockfd, size_t capacity = DEFAULT_CAPACITY, overflow_policy policy = DROP_OLDEST, int block_timeout = DEFAULT_BLOCK_TIMEOUT):
+			sockfd(sockfd), offset(0), queued(0), capacity(capacity), policy(policy), block_timeout(block_timeout),
+			waiters(0), drops(0), failed(false) {}
+
+		/**
+		 * @brief      sends a message, or queues what the socket cannot take yet
+		 * @details    a message larger than the whole capacity is still queued once the queue is empty, or dropped
+		 *             first under DROP_OLDEST; does nothing once the queue was closed or the connection failed
+		 * @param[in]  message  the bytes to send, which are shared and not copied
+		 * @return     false if the connection failed or was shut down by the DISCONNECT policy
+		 */
+
+		bool push(const shared_buffer& message) {
+			unique_lock<mutex> guard(lock);
+			chrono::steady_clock::time_point deadline;
+			bool blocked = false;
+			// make room according to the policy
+			while (true) {
+				if (sockfd < 0 || failed)
+					return !failed;
+				if (messages.empty() || queued + message->size() <= capacity)
+					break;
+				if (policy == DISCONNECT) {
+					fail();
+					return false;
+				}
+				if (policy == BLOCK) {
+					if (!drain()) return false;
+					if (queued + message->size() <= capacity)
+						continue;
+					chrono::steady_clock::time_point now = chrono::steady_clock::now();
+					if (!blocked) {
+						deadline = now + chrono::milliseconds(block_timeout);
+						blocked = true;
+					}
+					if (now >= deadline) {
+						// the peer stopped reading, give up on it rather than stall the sender
+						fail();
+						return false;
+					}
+					wait_writable(guard, (int) chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1);
+					continue;
+				}
+				// drop the oldest message, unless it was partly written already, which would corrupt the stream
+				deque<shared_buffer>::iterator oldest = messages.begin() + (offset ? 1 : 0);
+				if (oldest == messages.end())
+					break;
+				queued -= (*oldest)->size();
+				messages.erase(oldest);
+				++drops;
+			}
+			queued += message->size();
+			messages.push_back(message);
+			return drain();
+		}
+
+		/**
+		 * @brief      sends a message that only goes to this socket, or queues what the socket cannot take yet
+		 * @param[in]  message  the bytes to send
+		 * @return     false if the connection failed or was shut down by the DISCONNECT policy
+		 */
+
+		bool push(string message) {
+			return push(make_shared_buffer(std::move(message)));
+		}
+
+		/**
+		 * @brief      writes queued messages until the queue is empty or the socket would block
+		 * @details    meant to be called by the event loop of the socket when it becomes writable
+		 * @return     false if the connection failed
+		 */
+
+		bool flush() {
+			lock_guard<mutex> guard(lock);
+			if (sockfd < 0 || failed)
+				return !failed;
+			return drain();
+		}
+
+		/**
+		 * @brief      waits until every queued message was written, e.g. before shutting down
+		 * @param[in]  timeout  the maximum number of milliseconds to wait in all, however often the socket fills up
+		 * @return     true if the queue is empty
+		 */
+
+		bool wait(int timeout) {
+			unique_lock<mutex> guard(lock);
+			chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout);
+			while (sockfd >= 0 && !failed && drain() && !messages.empty()) {
+				chrono::steady_clock::time_point now = chrono::steady_clock::now();
+				if (now >= deadline)
+					return false;
+				wait_writable(guard, (int) chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1);
+			}
+			return sockfd >= 0 && !failed && messages.empty();
+		}
+
+		/**
+		 * @brief      discards the queue and forgets the socket; call it before the socket is closed
+		 * @details    never waits behind a blocked push: the connection is shut down to wake up any thread that waits
+		 *             for the socket, since it is about to be closed anyway
+		 */
+
+		void close() {
+			lock_guard<mutex> guard(lock);
+			if (waiters && sockfd >= 0)
+				::shutdown(sockfd, SHUT_RDWR);
+			sockfd = -1;
+			messages.clear();
+			offset = queued = 0;
+		}
+
+		/**
+		 * @brief      gets the number of bytes queued and not written yet
+		 */
+
+		size_t size() const {
+			lock_guard<mutex> guard(lock);
+			return queued;
+		}
+
+		/**
+		 * @brief      gets the number of messages dropped by the DROP_OLDEST policy
+		 */
+
+		unsigned long dropped() const {
+			lock_guard<mutex> guard(lock);
+			return drops;
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		send_queue(const send_queue&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		send_queue& operator = (const send_queue&);
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const size_t send_queue::DEFAULT_CAPACITY;
+	const int send_queue::DEFAULT_BLOCK_TIMEOUT;
+
+}
+
+#endif /* __INCLUDE_NET_SEND_QUEUE__ */
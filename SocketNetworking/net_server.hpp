@@ -18,11 +18,26 @@
  * You cannot send data using the server's sockfd, ergo wrapping it with
  * a socket stream will be pointless (you can try and see for yourself).
  * 
+ * To accept on several cores, a net::listener_group binds one server per
+ * worker to the same port with SO_REUSEPORT, and the kernel spreads the
+ * incoming connections across them. Every server counts the connections
+ * it accepted, which shows how evenly the load is spread.
+ * 
  * @namespace  	net
  * @author 		Rico Tiongson
  * @package  	SocketNetworking
  */
 
+#ifndef __INCLUDE_NET_SERVER__
+#define __INCLUDE_NET_SERVER__
+
+#include <utility>		// std::move()
+#include <memory>		// std::shared_ptr
+#include <atomic>		// std::atomic
+#include <vector>		// std::vector
+#include <mutex>		// std::mutex, std::lock_guard
+#include <unistd.h>		// sysconf(), close()
+#include <fcntl.h>		// open()
 #include "net_socket.hpp"
 
 namespace net {
@@ -40,6 +55,16 @@ namespace net {
 
 		static const int DEFAULT_MAXCONN = SOMAXCONN;
 
+	protected:
+
+		/**
+		 * the number of connections accepted through this server socket, shared by all of its copies
+		 */
+
+		shared_ptr<atomic<unsigned long> > accepts;
+
+	public:
+
 		/**
 		 * @brief      constructs an empty server socket
 		 */
@@ -51,7 +76,30 @@ namespace net {
 		 * @param[in]  sock  the server socket to copy; must already be bound in order to accept connections
 		 */
 
-		server(const server& sock): socket(sock) {}
+		server(const server& sock): socket(sock), accepts(sock.accepts) {}
+
+		/**
+		 * @brief      constructs a server socket by taking over the file descriptor of another server socket
+		 * @param[in]  sock  the server socket to move from; left empty afterwards
+		 */
+
+		server(server&& sock): socket(std::move(sock)), accepts(std::move(sock.accepts)) {}
+
+		/**
+		 * @brief      copies the file descriptor of another server socket
+		 * @param[in]  sock  the server socket to copy
+		 * @return     a reference to this server object
+		 */
+
+		server& operator = (const server& sock) = default;
+
+		/**
+		 * @brief      takes over the file descriptor of another server socket
+		 * @param[in]  sock  the server socket to move from; left empty afterwards
+		 * @return     a reference to this server object
+		 */
+
+		server& operator = (server&& sock) = default;
 
 		/**
 		 * @brief      constructs a server socket and binds it to a specific port in the local host
@@ -59,10 +107,14 @@ namespace net {
 		 * @param[in]  port     the port that this server socket will bind to
 		 * @param[in]  maxconn  the backlog parameter on listen(); default value is server::DEFAULT_MAXCONN
 		 * @param[in]  host		the specific IP address the network card should to bind to; will bind to any local port when NULL [default: NULL]
+		 * @param[in]  reuse_port  whether other server sockets may bind to the same port with SO_REUSEPORT, in which
+		 *                         case the kernel spreads incoming connections across all of them [default: false]
 		 * @throw      a socket_exception if there server could not bind to the port or listen to connections
 		 */
 
-		explicit server(unsigned short port, int maxconn = server::DEFAULT_MAXCONN, const char* host = NULL): socket() {
+		explicit server(unsigned short port, int maxconn = server::DEFAULT_MAXCONN, const char* host = NULL, bool reuse_port = false):
+			socket(),
+			accepts(new atomic<unsigned long>(0)) {
 			// create socket address
 			struct sockaddr_in sad;
 			memset(&sad, 0, sizeof sad);
@@ -73,6 +125,9 @@ namespace net {
 			int unbind = 1;
 			if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &unbind, sizeof(unbind)) < 0)
 				throw socket_exception("server::setsockopt()");
+			// share the port with the other listeners of a group
+			if (reuse_port && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &unbind, sizeof(unbind)) < 0)
+				throw socket_exception("server::setsockopt()");
 			// bind to port
 			if (bind(sockfd, (sockaddr*) &sad, sizeof sad) < 0)
 				throw socket_exception("server::bind()");
@@ -88,15 +143,53 @@ namespace net {
 		 * @return     a socket referring to the accepted client
 		 */
 
-		socket accept() const throw(socket_exception) {
+		socket accept() const NET_THROWS(socket_exception) {
 			struct sockaddr_in address;
 			socklen_t length = sizeof(address);
 			int clientsock = ::accept(sockfd, (sockaddr*) &address, &length);
 			if (clientsock < 0)
 				throw socket_exception("server::accept()");
+			if (accepts) accepts->fetch_add(1, memory_order_relaxed);
 			return clientsock;
 		}
 
+		/**
+		 * @brief      accepts a connecting socket if one is pending, without blocking
+		 * @details    meant for a server in non-blocking mode (see socket::set_blocking()) that is driven by an event loop;
+		 *             a connection that was aborted before it could be accepted, or an interrupted call, is skipped and
+		 *             the next pending connection is tried, so an empty socket always means that the queue is drained.
+		 *             When the process runs out of file descriptors, the pending connection is refused by briefly
+		 *             giving up a reserved descriptor, and a socket_exception with code EMFILE (or ENFILE) is thrown
+		 *             after it, so the caller can log it and keep draining. If not even that descriptor is left, an
+		 *             empty socket is returned and the remaining connections wait for the next readiness event.
+		 * @throw      a socket_exception if there was a problem in accepting the client socket
+		 * @return     a socket referring to the accepted client, or an empty socket if no connection is pending
+		 */
+
+		socket try_accept() const NET_THROWS(socket_exception) {
+			reserve_fd(); // opened on first use, while descriptors are still available
+			while (true) {
+				struct sockaddr_in address;
+				socklen_t length = sizeof(address);
+				int clientsock = ::accept(sockfd, (sockaddr*) &address, &length);
+				if (clientsock >= 0) {
+					if (accepts) accepts->fetch_add(1, memory_order_relaxed);
+					return clientsock;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return -1;
+				if (errno == EINTR || errno == ECONNABORTED)
+					continue;
+				if (errno == EMFILE || errno == ENFILE) {
+					int error = errno;
+					if (!refuse_pending())
+						return -1;
+					errno = error;
+				}
+				throw socket_exception("server::try_accept()");
+			}
+		}
+
 		/**
 		 * @brief      gets the ip address of the host socket
 		 * @details    uses net::ip_address() by default instead of socket::ip(), because the latter usually gives a loopback ip
@@ -104,13 +197,129 @@ namespace net {
 		 * @return     a const char pointer to the local ip address of the host socket
 		 */
 
-		virtual const char* ip() const throw(socket_exception) {
+		virtual const char* ip() const NET_THROWS(socket_exception) {
 			return net::ip_address();
 		}
 
+		/**
+		 * @brief      gets the number of connections accepted through this server socket and its copies
+		 */
+
+		unsigned long accepted() const {
+			return accepts ? accepts->load(memory_order_relaxed) : 0;
+		}
+
+	protected:
+
+		/**
+		 * @brief      gets the descriptor kept open so that a connection can still be refused when the process runs out of them
+		 * @details    shared by every server socket, and guarded by reserve_lock()
+		 * @return     a reference to the reserved descriptor, which is -1 if it could not be opened
+		 */
+
+		static int& reserve_fd() {
+			static int reserve = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+			return reserve;
+		}
+
+		/**
+		 * @brief      gets the lock guarding the reserved descriptor
+		 */
+
+		static mutex& reserve_lock() {
+			static mutex lock;
+			return lock;
+		}
+
+		/**
+		 * @brief      refuses the first pending connection by closing the reserved descriptor to accept it, then reopens it
+		 * @return     true if a pending connection was refused, false if no descriptor could be freed for it
+		 */
+
+		bool refuse_pending() const {
+			lock_guard<mutex> guard(reserve_lock());
+			int& reserve = reserve_fd();
+			if (reserve < 0)
+				reserve = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+			if (reserve < 0)
+				return false;
+			::close(reserve);
+			int refused = ::accept(sockfd, NULL, NULL);
+			if (refused >= 0)
+				::close(refused);
+			reserve = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+			return refused >= 0;
+		}
+
 	};
 
 	// define the static constant so it can be used in the namespace
 	const int server::DEFAULT_MAXCONN;
 
-}
\ No newline at end of file
+	/**
+	 * @brief      server sockets bound to the same port with SO_REUSEPORT, meant to be accepted from by one worker each
+	 * @details    the kernel hashes every incoming connection to one of the listeners, so each worker accepts from its
+	 *             own queue instead of all of them contending on a single one
+	 */
+
+	class listener_group {
+
+		/**
+		 * the listeners of the group
+		 */
+
+		vector<server> listeners;
+
+	public:
+
+		/**
+		 * @brief      binds a number of server sockets to the same port
+		 * @param[in]  port     the port that every server socket will bind to
+		 * @param[in]  count    the number of server sockets, or 0 for one per core [default: 0]
+		 * @param[in]  maxconn  the backlog parameter on listen() of each server socket [default: server::DEFAULT_MAXCONN]
+		 * @param[in]  host     the specific IP address to bind to; will bind to any local port when NULL [default: NULL]
+		 * @throw      a socket_exception if a server socket could not bind to the port or listen to connections
+		 */
+
+		explicit listener_group(unsigned short port, size_t count = 0, int maxconn = server::DEFAULT_MAXCONN, const char* host = NULL) {
+			if (!count) {
+				long cores = sysconf(_SC_NPROCESSORS_ONLN);
+				count = cores < 1 ? 1 : cores;
+			}
+			for (size_t i = 0; i < count; ++i)
+				listeners.push_back(server(port, maxconn, host, true));
+		}
+
+		/**
+		 * @brief      gets the number of server sockets in the group
+		 */
+
+		inline size_t size() const {
+			return listeners.size();
+		}
+
+		/**
+		 * @brief      gets a server socket of the group
+		 * @param[in]  index  the index of the server socket, from 0 to size() - 1
+		 */
+
+		inline server& operator [] (size_t index) {
+			return listeners[index];
+		}
+
+		/**
+		 * @brief      gets the number of connections accepted by each server socket, in order
+		 */
+
+		vector<unsigned long> accepted() const {
+			vector<unsigned long> counts;
+			for (size_t i = 0; i < listeners.size(); ++i)
+				counts.push_back(listeners[i].accepted());
+			return counts;
+		}
+
+	};
+
+}
+
+#endif /* __INCLUDE_NET_SERVER__ */
\ No newline at end of file
@@ -4,10 +4,20 @@
  * includes a socket exception class for error handling.
  * 
  * This socket wrapper performs automatic garbage collection for
- * multiple copies of the same socket using a map of file descriptors.
- * Only the last instance of the socket will close the socket file
- * descriptor. Forking is safe as long as socket::close() was not run
- * prematurely.
+ * multiple copies of the same socket using a lock-free table of atomic
+ * reference counts, indexed by file descriptor. Only the last instance
+ * of the socket will close the socket file descriptor. Copies can be
+ * made and destroyed from multiple threads at once, and moving a socket
+ * transfers ownership without touching the table at all. Forking is safe
+ * as long as socket::close() was not run prematurely.
+ * 
+ * Socket options are set and read in a typed way with socket::set() and
+ * socket::get(), e.g. sock.set<net::tcp_nodelay>(true). A socket_profile
+ * sets several of them at once; socket_profile::low_latency() turns off
+ * Nagle's algorithm and delayed acknowledgements for small messages.
+ * 
+ * When compiled with NET_STATS, the system calls on every socket are
+ * counted by file descriptor; see net_stats.hpp.
  * 
  * Also in this header are two namespace function that can get the
  * ip address of your network card. To get the default ip address
@@ -28,13 +38,33 @@
 #include <cerrno>		// std::errno
 #include <string>		// std::string
 #include <map>			// std::map
+#include <atomic>		// std::atomic
+#include <new>			// placement new
+#include <cstdlib>		// posix_memalign()
+#include <cstddef>		// offsetof()
 #include <exception>	// std::exception
 #include <unistd.h>		// close()
+#include <fcntl.h>		// fcntl(), O_NONBLOCK
 #include <sys/types.h>	// sockaddr, sockaddr_in, socklen_t
 #include <sys/socket.h>	// socket()
+#include <sys/un.h>		// sockaddr_un
 #include <sys/ioctl.h>	// ioctl()
+#include <netinet/in.h>	// IPPROTO_TCP
+#include <netinet/tcp.h>	// TCP_NODELAY, TCP_CORK, TCP_QUICKACK
 #include <arpa/inet.h> 	// inet_ntoa(), ntohs(), inet_ntop()
 #include <linux/netdevice.h> // ifconf, ifreq
+#include "net_stats.hpp"	// net::io_stats
+
+/**
+ * documents that a function may throw the listed exceptions; dynamic exception
+ * specifications were removed in C++17, so newer standards only keep the documentation
+ */
+
+#if __cplusplus >= 201703L
+#define NET_THROWS(...)
+#else
+#define NET_THROWS(...) throw(__VA_ARGS__)
+#endif
 
 namespace net {
 
@@ -47,10 +77,277 @@ namespace net {
 	class socket_exception : public exception {
 	public:
 		const char* linker;
-		socket_exception(const char* linker): linker(linker) {}
-		virtual const char* what() const throw() {return (string(linker) + ": " + strerror(errno)).c_str();}
+		int code;		// the errno value, captured on construction before it can change
+		string message;	// captured on construction, before errno can change
+		socket_exception(const char* linker): linker(linker), code(errno), message(string(linker) + ": " + strerror(errno)) {}
+		virtual ~socket_exception() throw() {}
+		virtual const char* what() const throw() {return message.c_str();}
+	};
+
+	/**
+	 * @brief      a lock-free table of atomic reference counts, indexed by file descriptor
+	 * @details    file descriptors are small dense integers, so each count lives in a slot
+	 *             addressed directly by its fd instead of a tree lookup. Slots are grouped in
+	 *             pages that are allocated lazily and published with a single compare-and-swap,
+	 *             so the table grows with the highest fd in use and never takes a lock. Each slot
+	 *             is padded to a cache line so that threads working on neighbouring sockets do
+	 *             not contend on the same line. Pages are never freed.
+	 */
+
+	class refcount_table {
+	public:
+
+		/**
+		 * the size of a cache line in bytes; each slot is padded to this size
+		 */
+
+		static const size_t CACHE_LINE = 64;
+
+		/**
+		 * the number of slots in a single page
+		 */
+
+		static const size_t PAGE_SLOTS = 256;
+
+		/**
+		 * the maximum number of pages, which bounds the largest fd at MAX_PAGES * PAGE_SLOTS - 1
+		 */
+
+		static const size_t MAX_PAGES = 4096;
+
+	private:
+
+		/**
+		 * @brief      a reference count padded to a full cache line
+		 */
+
+		struct slot {
+			atomic<int> count;
+			char padding[CACHE_LINE - sizeof(atomic<int>)];
+		};
+
+		/**
+		 * @brief      a lazily allocated block of consecutive slots
+		 */
+
+		struct page {
+			slot slots[PAGE_SLOTS];
+		};
+
+		/**
+		 * the page directory; a null entry means that no fd in that page was ever counted
+		 */
+
+		atomic<page*> pages[MAX_PAGES];
+
+		/**
+		 * @brief      finds the reference count of a file descriptor
+		 * @param[in]  fd      the file descriptor to look up
+		 * @param[in]  create  whether the page holding the fd should be allocated if it does not exist yet
+		 * @throw      a socket_exception if the fd is out of range, or if a page cannot be allocated
+		 * @return     a pointer to the atomic reference count, or NULL if it does not exist and create was false
+		 */
+
+		atomic<int>* find(int fd, bool create) {
+			size_t index = fd / PAGE_SLOTS;
+			if (index >= MAX_PAGES) {
+				if (!create) return NULL;
+				errno = EMFILE;
+				throw socket_exception("refcount_table::find()");
+			}
+			page* p = pages[index].load(memory_order_acquire);
+			if (p == NULL) {
+				if (!create) return NULL;
+				// allocate a cache-aligned page, then race to publish it
+				void* memory;
+				if ((errno = posix_memalign(&memory, CACHE_LINE, sizeof(page))) != 0)
+					throw socket_exception("refcount_table::find()");
+				page* fresh = static_cast<page*>(memory);
+				for (size_t i = 0; i < PAGE_SLOTS; ++i)
+					new (&fresh->slots[i].count) atomic<int>(0);
+				if (pages[index].compare_exchange_strong(p, fresh, memory_order_acq_rel))
+					p = fresh;
+				else
+					free(fresh); // another thread published first, p now holds its page
+			}
+			return &p->slots[fd % PAGE_SLOTS].count;
+		}
+
+	public:
+
+		/**
+		 * @brief      adds a reference to a file descriptor
+		 * @param[in]  fd    the file descriptor
+		 */
+
+		void acquire(int fd) {
+			find(fd, true)->fetch_add(1, memory_order_relaxed);
+		}
+
+		/**
+		 * @brief      removes a reference to a file descriptor, if it still has any
+		 * @param[in]  fd    the file descriptor
+		 * @return     true if the removed reference was the last one
+		 */
+
+		bool release(int fd) {
+			atomic<int>* count = find(fd, false);
+			if (count == NULL) return false;
+			// never go below zero, the fd may have been closed forcefully by another copy
+			int current = count->load(memory_order_relaxed);
+			while (current > 0 && !count->compare_exchange_weak(current, current - 1, memory_order_acq_rel));
+			return current == 1;
+		}
+
+		/**
+		 * @brief      drops all references to a file descriptor at once
+		 * @param[in]  fd    the file descriptor
+		 * @return     the number of references the fd had before it was reset
+		 */
+
+		int reset(int fd) {
+			atomic<int>* count = find(fd, false);
+			return count == NULL ? 0 : count->exchange(0, memory_order_acq_rel);
+		}
+
+		/**
+		 * @brief      gets the number of references to a file descriptor
+		 * @param[in]  fd    the file descriptor
+		 * @return     the number of references, which is 0 if the fd was never counted
+		 */
+
+		int count(int fd) {
+			atomic<int>* count = find(fd, false);
+			return count == NULL ? 0 : count->load(memory_order_acquire);
+		}
+
+	};
+
+	/**
+	 * @brief      a socket option that can be written with socket::set() and read with socket::get()
+	 * @tparam     Level  the protocol level of the option, e.g. SOL_SOCKET or IPPROTO_TCP
+	 * @tparam     Name   the name of the option at that level
+	 * @tparam     T      the type of the value of the option, which is passed to the kernel as an int
+	 */
+
+	template <int Level, int Name, typename T = int>
+	struct socket_option {
+		typedef T value_type;
+		static const int level = Level;
+		static const int name = Name;
+	};
+
+	/**
+	 * sends small writes right away instead of coalescing them until earlier data is acknowledged (Nagle's algorithm)
+	 */
+
+	typedef socket_option<IPPROTO_TCP, TCP_NODELAY, bool> tcp_nodelay;
+
+	/**
+	 * holds back partial segments until it is turned off, so several writes leave as full segments
+	 */
+
+	typedef socket_option<IPPROTO_TCP, TCP_CORK, bool> tcp_cork;
+
+	/**
+	 * acknowledges received data right away instead of delaying the acknowledgement; the kernel may turn it off again
+	 */
+
+	typedef socket_option<IPPROTO_TCP, TCP_QUICKACK, bool> tcp_quickack;
+
+	/**
+	 * the size of the send buffer in bytes; the kernel doubles the value that is set
+	 */
+
+	typedef socket_option<SOL_SOCKET, SO_SNDBUF> so_sndbuf;
+
+	/**
+	 * the size of the receive buffer in bytes; the kernel doubles the value that is set
+	 */
+
+	typedef socket_option<SOL_SOCKET, SO_RCVBUF> so_rcvbuf;
+
+	/**
+	 * the number of microseconds a blocking read busy polls the device queue before sleeping
+	 */
+
+	typedef socket_option<SOL_SOCKET, SO_BUSY_POLL> so_busy_poll;
+
+	/**
+	 * the address family of the socket, e.g. AF_INET or AF_UNIX; can only be read
+	 */
+
+	typedef socket_option<SOL_SOCKET, SO_DOMAIN> so_domain;
+
+	/**
+	 * @brief      a set of socket options that are applied together with socket::apply()
+	 * @details    false flags, and zero sizes and durations, leave the corresponding option untouched, so a profile only
+	 *             ever turns options on
+	 */
+
+	struct socket_profile {
+		bool nodelay;		// set tcp_nodelay
+		bool quickack;		// set tcp_quickack
+		int busy_poll;		// microseconds of so_busy_poll; needs CAP_NET_ADMIN above net.core.busy_read, skipped otherwise
+		int sndbuf;			// bytes of so_sndbuf
+		int rcvbuf;			// bytes of so_rcvbuf
+		unsigned spin;		// microseconds a net::client polls without blocking before a read sleeps
+
+		/**
+		 * @brief      constructs a profile that leaves every option as it is
+		 */
+
+		socket_profile(): nodelay(false), quickack(false), busy_poll(0), sndbuf(0), rcvbuf(0), spin(0) {}
+
+		/**
+		 * @brief      gets a profile for small request and reply messages, which trades CPU time for latency
+		 * @details    disables Nagle's algorithm and delayed acknowledgements, and busy polls reads; reads only spin
+		 *             when there is more than one core, since spinning on a single core just delays the peer
+		 */
+
+		static socket_profile low_latency() {
+			socket_profile profile;
+			profile.nodelay = true;
+			profile.quickack = true;
+			profile.busy_poll = 50;
+			profile.spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 50 : 0;
+			return profile;
+		}
+
 	};
 
+	/**
+	 * @brief      describes a socket address: its IPv4 address, or the path of a Unix domain socket
+	 * @details    an abstract Unix socket name is shown with a leading '@'; like inet_ntoa(), the result is overwritten by the next call on the same thread
+	 * @param[in]  address  the address, as filled in by getsockname() or getpeername()
+	 * @param[in]  length   the length of the address, as filled in by getsockname() or getpeername()
+	 * @return     a c-string describing the address, which is empty for an unnamed Unix domain socket
+	 */
+
+	inline const char* address_name(const sockaddr_storage& address, socklen_t length) {
+		if (address.ss_family != AF_UNIX)
+			return inet_ntoa(((const sockaddr_in&) address).sin_addr);
+		static thread_local char path[sizeof(sockaddr_un::sun_path) + 1];
+		const sockaddr_un& local = (const sockaddr_un&) address;
+		size_t bytes = length > offsetof(sockaddr_un, sun_path) ? length - offsetof(sockaddr_un, sun_path) : 0;
+		if (bytes > sizeof local.sun_path)
+			bytes = sizeof local.sun_path;
+		memcpy(path, local.sun_path, bytes);
+		path[bytes] = '\0';
+		if (bytes && path[0] == '\0')
+			path[0] = '@'; // abstract names start with a '\0' and are not terminated
+		return path;
+	}
+
+	/**
+	 * @brief      gets the port of a socket address, which is 0 for a Unix domain socket
+	 * @param[in]  address  the address, as filled in by getsockname() or getpeername()
+	 */
+
+	inline unsigned short address_port(const sockaddr_storage& address) {
+		return address.ss_family == AF_INET ? ntohs(((const sockaddr_in&) address).sin_port) : 0;
+	}
+
 	/**
 	 * @brief       a lightweight wrapper class for TCP IPv4 sockets
 	 */
@@ -60,10 +357,26 @@ namespace net {
 	private:
 
 		/**
-		 * @brief      a map of the number of socket instances for each socket file descriptor
+		 * @brief      gets the table of the number of socket instances for each socket file descriptor
+		 * @return     a reference to the process-wide reference count table
 		 */
 
-		static map<int, int> instances;
+		static refcount_table& instances() {
+			static refcount_table table;
+			return table;
+		}
+
+		/**
+		 * @brief      drops this instance's reference, closing the file descriptor if it was the last one
+		 */
+
+		void release() {
+			if (sockfd >= 0 && instances().release(sockfd)) {
+				io_stats::reset(sockfd);
+				::close(sockfd);
+			}
+			sockfd = -1;
+		}
 
 	protected:
 
@@ -80,7 +393,7 @@ namespace net {
 		 */
 
 		socket(): sockfd(::socket(AF_INET, SOCK_STREAM, 0)) {
-			if (sockfd >= 0) ++instances[sockfd];
+			if (sockfd >= 0) instances().acquire(sockfd);
 		}
 
 		/**
@@ -89,7 +402,7 @@ namespace net {
 		 */
 
 		socket(int sockfd): sockfd(sockfd) {
-			if (sockfd >= 0) ++instances[sockfd];
+			if (sockfd >= 0) instances().acquire(sockfd);
 		}
 
 		/**
@@ -98,18 +411,47 @@ namespace net {
 		 */
 
 		socket(const socket& sock): sockfd(sock.sockfd) {
-			if (sockfd >= 0) ++instances[sockfd];
+			if (sockfd >= 0) instances().acquire(sockfd);
+		}
+
+		/**
+		 * @brief      constructs a socket by taking over the file descriptor of another socket
+		 * @details    does not touch the reference count; the other socket is left empty
+		 * @param[in]  sock  the socket to move from
+		 */
+
+		socket(socket&& sock): sockfd(sock.sockfd) {
+			sock.sockfd = -1;
 		}
 
 		/**
 		 * @brief      copies another socket object
+		 * @details    releases the file descriptor previously held by this socket
 		 * @param[in]  sock  the socket to copy
 		 * @return     a reference to the current socket object
 		 */
 
 		socket& operator = (const socket& sock) {
+			// acquire first so that self-assignment never drops the last reference
+			if (sock.sockfd >= 0) instances().acquire(sock.sockfd);
+			release();
 			sockfd = sock.sockfd;
-			if (sockfd >= 0) ++instances[sockfd];
+			return *this;
+		}
+
+		/**
+		 * @brief      takes over the file descriptor of another socket
+		 * @details    releases the file descriptor previously held by this socket; the other socket is left empty
+		 * @param[in]  sock  the socket to move from
+		 * @return     a reference to the current socket object
+		 */
+
+		socket& operator = (socket&& sock) {
+			if (this != &sock) {
+				release();
+				sockfd = sock.sockfd;
+				sock.sockfd = -1;
+			}
 			return *this;
 		}
 
@@ -118,8 +460,7 @@ namespace net {
 		 */
 
 		~socket() {
-			if (good() && --instances[sockfd] == 0)
-				close();
+			release();
 		}
 
 		/**
@@ -128,7 +469,7 @@ namespace net {
 		 */
 
 		virtual bool good() const {
-			return sockfd >= 0 && instances.count(sockfd);
+			return sockfd >= 0 && instances().count(sockfd) > 0;
 		}
 
 		/**
@@ -154,8 +495,8 @@ namespace net {
 		 */
 
 		virtual void close() {
-			if (good()) {
-				instances.erase(sockfd);
+			if (sockfd >= 0 && instances().reset(sockfd) > 0) {
+				io_stats::reset(sockfd);
 				::close(sockfd);
 				// if (::close(sockfd) < 0)
 					// throw socket_exception("socket::close()");
@@ -163,6 +504,86 @@ namespace net {
 			sockfd = -1;
 		}
 
+		/**
+		 * @brief      checks if operations on this socket block until they can complete
+		 * @throw      a socket_exception if the file status flags cannot be read
+		 * @return     false if the socket is in non-blocking mode (O_NONBLOCK)
+		 */
+
+		bool blocking() const NET_THROWS(socket_exception) {
+			int flags = fcntl(sockfd, F_GETFL, 0);
+			if (flags < 0)
+				throw socket_exception("socket::blocking()");
+			return !(flags & O_NONBLOCK);
+		}
+
+		/**
+		 * @brief      switches this socket between blocking and non-blocking mode (O_NONBLOCK)
+		 * @details    the mode belongs to the file descriptor, so it applies to all copies of this socket
+		 * @param[in]  enabled  true to make operations block, false to make them fail with EAGAIN instead
+		 * @throw      a socket_exception if the file status flags cannot be changed
+		 */
+
+		void set_blocking(bool enabled) NET_THROWS(socket_exception) {
+			int flags = fcntl(sockfd, F_GETFL, 0);
+			if (flags < 0 || fcntl(sockfd, F_SETFL, enabled ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) < 0)
+				throw socket_exception("socket::set_blocking()");
+		}
+
+		/**
+		 * @brief      sets an option of this socket
+		 * @param[in]  value   the new value of the option
+		 * @tparam     Option  the option to set, e.g. net::tcp_nodelay
+		 * @throw      a socket_exception if the option cannot be set
+		 */
+
+		template <typename Option>
+		void set(typename Option::value_type value) NET_THROWS(socket_exception) {
+			int raw = value;
+			if (setsockopt(sockfd, Option::level, Option::name, &raw, sizeof raw) < 0)
+				throw socket_exception("socket::set()");
+		}
+
+		/**
+		 * @brief      gets an option of this socket
+		 * @tparam     Option  the option to get, e.g. net::tcp_nodelay
+		 * @throw      a socket_exception if the option cannot be read
+		 * @return     the value of the option
+		 */
+
+		template <typename Option>
+		typename Option::value_type get() const NET_THROWS(socket_exception) {
+			int raw = 0;
+			socklen_t length = sizeof raw;
+			if (getsockopt(sockfd, Option::level, Option::name, &raw, &length) < 0)
+				throw socket_exception("socket::get()");
+			return (typename Option::value_type) raw;
+		}
+
+		/**
+		 * @brief      sets the options of a profile on this socket
+		 * @details    options of a listening socket are inherited by the sockets it accepts; the TCP options are skipped
+		 *             on a Unix domain socket, which has no Nagle's algorithm or acknowledgements to begin with
+		 * @param[in]  profile  the options to set
+		 * @throw      a socket_exception if an option cannot be set
+		 */
+
+		void apply(const socket_profile& profile) NET_THROWS(socket_exception) {
+			if (get<so_domain>() != AF_UNIX) {
+				if (profile.nodelay) set<tcp_nodelay>(true);
+				if (profile.quickack) set<tcp_quickack>(true);
+			}
+			if (profile.sndbuf) set<so_sndbuf>(profile.sndbuf);
+			if (profile.rcvbuf) set<so_rcvbuf>(profile.rcvbuf);
+			if (profile.busy_poll) {
+				// busy polling is best effort: unprivileged processes may not raise it
+				try {set<so_busy_poll>(profile.busy_poll);}
+				catch (socket_exception&) {
+					if (errno != EPERM && errno != ENOPROTOOPT) throw;
+				}
+			}
+		}
+
 		/**
 		 * @brief      checks if this socket's file descriptor is less than another's file descriptor
 		 * @param[in]  sock  the socket to compare with
@@ -176,35 +597,33 @@ namespace net {
 		/**
 		 * @brief      gets the local IP address of the host socket
 		 * @throw      a socket_exception if the socket cannot get the host's name
-		 * @return     a const char pointer to the local IPv4 address of the host socket
+		 * @return     a const char pointer to the local IPv4 address of the host socket, or its path if it is a Unix domain socket
 		 */
 
-		virtual const char* ip() const throw(socket_exception)  {
-			struct sockaddr_in sad;
+		virtual const char* ip() const NET_THROWS(socket_exception)  {
+			struct sockaddr_storage sad;
 			socklen_t len = sizeof(sad);
 			if (getsockname(sockfd, (sockaddr*) &sad, &len) < 0)
 				throw socket_exception("socket::ip()");
-			return inet_ntoa(sad.sin_addr);
+			return address_name(sad, len);
 		}
 
 		/**
 		 * @brief      gets the local port of the socket
 		 * @throw      a socket_exception if the socket cannot get the port
-		 * @return     an unsigned short determining the local IPv4 port used by the socket
+		 * @return     an unsigned short determining the local IPv4 port used by the socket, or 0 if it is a Unix domain socket
 		 */
 
-		virtual unsigned short port() const throw(socket_exception) {
-			struct sockaddr_in sad;
+		virtual unsigned short port() const NET_THROWS(socket_exception) {
+			struct sockaddr_storage sad;
 			socklen_t len = sizeof(sad);
 			if (getsockname(sockfd, (sockaddr*) &sad, &len) < 0)
 				throw socket_exception("socket::port()");
-			return ntohs(sad.sin_port);
+			return address_port(sad);
 		}
 
 	};
 
-	map<int, int> socket::instances;
-
 	/**
 	 * @brief      ask for a map of all available ip addresses
 	 * @param[in]  ipver      [default: AF_INET] the version of the ip address to return; can be AF_INET or AF_INET6
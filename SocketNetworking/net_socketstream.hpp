@@ -14,6 +14,15 @@
  * Socket streams can use flags and iostream methods from STL,
  * and is capable of buffering unlike the standalone net::client.
  * 
+ * A net::iosocketstream reads and writes the same socket through
+ * separate get and put areas, and keeps a separate stream for each
+ * direction, in() and out(), so one thread may read from it while
+ * another writes to it, without a second process or a dup()-ed fd.
+ * Reaching the end of the input, e.g. after the peer calls shutdown(),
+ * leaves the output usable.
+ * The socket streams do not own their file descriptor: close the
+ * socket after the streams are done with it.
+ * 
  * This is a STANDALONE header file. You can use it without
  * importing net::socket or the other headers. You can wrap it
  * to any file descriptor, as long as it is standard for your C++
@@ -27,120 +36,330 @@
  * @example    // Server and client chat
  * 
 	#include <iostream>					// std::cout, std::cin, std::getline(), std::endl, std::flush
-	#include <unistd.h>					// fork()
+	#include <thread>					// std::thread
+	#include <sys/socket.h>				// shutdown()
 	#include "../net_server.hpp"		// net::server, net::socket
 	#include "../net_client.hpp"		// net::client, net::socket
-	#include "../net_socketstream.hpp" 	// net::isocketstream, net::osocketstream
+	#include "../net_socketstream.hpp" 	// net::iosocketstream
 
 	using namespace std;
 
 	int main() {
 	#ifdef SERVER // compile with -DSERVER option
+		const char* me = "Server: ", * peer = "Client: ";
 		cout << "Accepting client..." << endl;
 		net::server server(4000);
 		net::socket socket = server.accept();
 		cout << "Client has joined." << endl;
- 		cout << "Server: " << flush;
-		if (fork()) {
-			net::isocketstream sockin(socket);
-			string message;
-			while (getline(sockin, message))
-				if (!message.empty())
-					cout << "\rClient: " << message << "\nServer: " << flush;
-		} else {
-			net::osocketstream sockout(socket);
-			string message;
-			while (getline(cin, message)) {
-				sockout << message << endl;
-				cout << "Server: " << flush;
-			}
-		}
 	#else // CLIENT
+		const char* me = "Client: ", * peer = "Server: ";
 		cout << "Connecting to server..." << endl;
 		net::client socket("localhost", 4000);
 		cout << "Server has joined." << endl;
- 		cout << "Client: " << flush;
-		if (fork()) {
-			net::isocketstream sockin(socket);
+	#endif
+		net::iosocketstream sockio(socket);
+		cout << me << flush;
+		// receive on another thread while this one sends
+		thread receiver([&] {
 			string message;
-			while (getline(sockin, message))
+			while (getline(sockio.in(), message))
 				if (!message.empty())
-					cout << "\rServer: " << message << "\nClient: " << flush;
-		} else {
-			net::osocketstream sockout(socket);
-			string message;
-			while (getline(cin, message)) {
-				sockout << message << endl;
-				cout << "Client: " << flush;
-			}
+					cout << "\r" << peer << message << "\n" << me << flush;
+		});
+		string message;
+		while (getline(cin, message)) {
+			sockio.out() << message << endl;
+			cout << me << flush;
 		}
-	#endif
+		shutdown(socket, SHUT_WR);
+		receiver.join();
 	}
  
  */
 
-#include <streambuf>	// std::streambuf, std::streamsize, std::size_t, std::memmove()
+#ifndef __INCLUDE_NET_SOCKETSTREAM__
+#define __INCLUDE_NET_SOCKETSTREAM__
+
+#include <streambuf>	// std::streambuf, std::streamsize, std::size_t
 #include <istream>		// std::istream
 #include <ostream>		// std::ostream
-#include <sys/socket.h>		// send(), recv()
-#include <unistd.h>		// dup()
+#include <cstring>		// std::memcpy(), std::memmove()
+#include <cerrno>		// errno, EINTR
+#include <sys/uio.h>	// writev(), iovec
+#include <unistd.h>		// read()
 
 namespace net {
 
 	using namespace std;
 
 	/**
-	 * the output socket buffer object
+	 * the input/output socket buffer object
+	 * @details  reading and writing use separate get and put areas, which share no state, so one thread may read
+	 *           while another writes. Every refill reads as much as is available, up to the size of the get area.
+	 *           Characters are staged in the put area and written when it is full, on sync() (e.g. std::flush,
+	 *           std::endl) and on destruction. Transfers at least as large as an area bypass it.
 	 * @extends  std::streambuf
 	 */
-	
-	class osocketbuf : public streambuf {
+
+	class iosocketbuf : public streambuf {
 
 	protected:
 
 		/**
-		 * socket file descriptor (sockfd)
+		 * socket file descriptor (sockfd), which is not owned by this buffer
 		 */
 		
 		int sockfd;
 
+		/**
+		 * putback size in bytes
+		 * consumes first part of the input buffer
+		 * @see http://www.cplusplus.com/reference/istream/istream/putback/
+		 */
+		
+		const size_t pback;
+
+		/**
+		 * total input buffer size in bytes
+		 * usable buffer length is (bsize - pback)
+		 */
+
+		const size_t bsize;
+
+		/**
+		 * output buffer size in bytes
+		 */
+
+		const size_t psize;
+
+		/**
+		 * input byte buffer used for putback and data input
+		 */
+
+		char* buffer;
+
+		/**
+		 * output byte buffer used as the put area
+		 */
+
+		char* pbuffer;
+
+		/**
+		 * @brief      reads whatever is available, waiting until at least one byte arrives
+		 * @param      data   where to put the bytes
+		 * @param[in]  bytes  the maximum number of bytes to read
+		 * @return     the number of bytes read, or 0 on end of file or error
+		 */
+
+		size_t receive(char* data, size_t bytes) {
+			ssize_t received;
+			while ((received = ::read(sockfd, data, bytes)) < 0 && errno == EINTR);
+			return received < 0 ? 0 : received;
+		}
+
+		/**
+		 * @brief      writes a number of byte ranges completely, retrying short writes
+		 * @param      parts  the byte ranges to write; advanced past what was written
+		 * @param[in]  count  the number of byte ranges
+		 * @return     true if every byte was written
+		 */
+
+		bool write_all(struct iovec* parts, int count) {
+			while (count > 0) {
+				ssize_t written = ::writev(sockfd, parts, count);
+				if (written < 0) {
+					if (errno == EINTR) continue;
+					return false;
+				}
+				// skip the ranges that were written completely, then advance into the first partial one
+				while (count > 0 && (size_t) written >= parts->iov_len) {
+					written -= parts->iov_len;
+					++parts;
+					--count;
+				}
+				if (count > 0) {
+					parts->iov_base = (char*) parts->iov_base + written;
+					parts->iov_len -= written;
+				}
+			}
+			return true;
+		}
+
+		/**
+		 * @brief      writes the staged characters and empties the put area
+		 * @return     true if every staged character was written
+		 */
+
+		bool flush_buffer() {
+			struct iovec staged = {pbase(), (size_t) (pptr() - pbase())};
+			setp(pbuffer, pbuffer + psize);
+			return !staged.iov_len || write_all(&staged, 1);
+		}
+
 	public:
 
 		/**
-		 * @brief      constructs an output socket buffer to wrap a socket file descriptor; can be used for regular files
-		 * @param[in]  sockfd   a file descriptor describing the connecting socket
+		 * @brief      constructs an input/output socket buffer to wrap a socket file descriptor; can be used for regular files
+		 * @param[in]  sockfd  a file descriptor describing the connecting socket
+		 * @param[in]  pback   putback size in bytes [default: 4]
+		 * @param[in]  bsize   total input buffer size in bytes, or 0 for a buffer that cannot read [default: 4096]
+		 * @param[in]  psize   output buffer size in bytes, or 0 to write every character as it comes [default: 4096]
 		 */
-		
-		osocketbuf(int sockfd): sockfd(dup(sockfd)) {}
+
+		iosocketbuf(int sockfd, size_t pback = 4, size_t bsize = 4096, size_t psize = 4096):
+			sockfd(sockfd),
+			pback(pback),
+			bsize(bsize > pback ? bsize : pback),
+			psize(psize),
+			buffer(new char[this->bsize + 1]),
+			pbuffer(new char[psize + 1]) {
+			char* start = buffer + pback;
+			setg(start, start, start);
+			setp(pbuffer, pbuffer + psize);
+		}
 
 		/**
-		 * @brief      syncs then destructs the output socket buffer object
+		 * @brief      syncs, then destroys the buffers and destructs the socket buffer object
 		 */
-		
-		~osocketbuf() {
+
+		~iosocketbuf() {
 			sync();
-			::close(sockfd);
+			delete[] buffer;
+			delete[] pbuffer;
 		}
+
+	protected:
+
+		/**
+		 * @brief      controls putback and how data is received from the connecting socket
+		 * @return     a streambuf::int_type describing how much input was taken
+		 */
 		
+		virtual int_type underflow() {
+
+			// check if there's still input in the buffer so we can return immediately
+			
+			if (gptr() < egptr())
+				return traits_type::to_int_type(*gptr());
+
+			// if not, refill the buffer's reserved space
+			// putback some characters if needed
+			
+			char* start = buffer + pback;
+			
+			size_t pbacks = gptr() - eback();
+			if (pbacks > pback)
+				pbacks = pback;
+
+			if (pbacks > 0)
+				memmove(start - pbacks, gptr() - pbacks, pbacks);
+
+			// fill the buffer with as much new data as is available
+			// read() will block itself until new data can be received
+			
+			size_t received = bsize > pback ? receive(start, bsize - pback) : 0;
+
+			// EOF or error
+			
+			if (!received) return traits_type::eof();
+
+			// reupdate pointers
+			setg(start - pbacks, start, start + received);
+			return traits_type::to_int_type(*gptr());
+
+		}
+
+		/**
+		 * @brief      receives an array of characters, straight into the destination if it is large
+		 * @param      data   where to put the received characters
+		 * @param[in]  bytes  the number of characters to receive
+		 * @return     the number of characters received, which is less than bytes on end of file or error
+		 */
+
+		virtual streamsize xsgetn(char* data, streamsize bytes) {
+			streamsize done = 0;
+			while (done < bytes) {
+				size_t buffered = egptr() - gptr();
+				if (buffered) {
+					size_t taken = (size_t) (bytes - done) < buffered ? bytes - done : buffered;
+					memcpy(data + done, gptr(), taken);
+					gbump(taken);
+					done += taken;
+				}
+				else if (bsize > pback && (size_t) (bytes - done) >= bsize - pback) {
+					size_t received = receive(data + done, bytes - done);
+					if (!received) break;
+					done += received;
+					// keep the last characters for putback
+					size_t pbacks = received < pback ? received : pback;
+					memcpy(buffer + pback - pbacks, data + done - pbacks, pbacks);
+					setg(buffer + pback - pbacks, buffer + pback, buffer + pback);
+				}
+				else if (traits_type::eq_int_type(underflow(), traits_type::eof()))
+					break;
+			}
+			return done;
+		}
+
 		/**
-		 * @brief      sends a single character to the connecting socket
+		 * @brief      writes the full put area, then stages a single character
 		 * @param[in]  c     the character to send as a streambuf::int_type
 		 * @return     a streambuf::int_type describing whether the character was sent or the end of file was reached
 		 */
 		
-		virtual int_type overflow (int_type c) {
-			return c != traits_type::eof() && send(sockfd, &c, 1, 0) <= 0 ? traits_type::eof() : c;
+		virtual int_type overflow(int_type c) {
+			if (!flush_buffer())
+				return traits_type::eof();
+			if (traits_type::eq_int_type(c, traits_type::eof()))
+				return traits_type::not_eof(c);
+			// the extra byte of the put area makes room for a character even without buffering
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+			if (!psize && !flush_buffer())
+				return traits_type::eof();
+			return c;
 		}
 
 		/**
-		 * @brief      sends an array of characters to the connecting socket
+		 * @brief      stages an array of characters, or writes it along with the staged ones if it is large
 		 * @param[in]  data   the data to send
 		 * @param[in]  bytes  the number of bytes to send
 		 * @return     a streambuf::streamsize describing the number of bytes successfully sent
 		 */
 		
-		virtual streamsize xsputn (const char* data, streamsize bytes) {
-			return send(sockfd, data, bytes, 0);
+		virtual streamsize xsputn(const char* data, streamsize bytes) {
+			size_t room = epptr() - pptr();
+			if ((size_t) bytes <= room) {
+				memcpy(pptr(), data, bytes);
+				pbump(bytes);
+				return bytes;
+			}
+			if ((size_t) bytes < psize) {
+				// fill the put area, write it, then stage the rest
+				memcpy(pptr(), data, room);
+				pbump(room);
+				if (!flush_buffer())
+					return room;
+				memcpy(pptr(), data + room, bytes - room);
+				pbump(bytes - room);
+				return bytes;
+			}
+			// large writes go straight to the socket, after the staged characters
+			struct iovec parts[2] = {
+				{pbase(), (size_t) (pptr() - pbase())},
+				{(void*) data, (size_t) bytes}
+			};
+			setp(pbuffer, pbuffer + psize);
+			return write_all(parts, 2) ? bytes : 0;
+		}
+
+		/**
+		 * @brief      writes the staged characters, e.g. on std::flush or std::endl
+		 * @return     0 on success, or -1 if the characters could not be written
+		 */
+
+		virtual int sync() {
+			return flush_buffer() ? 0 : -1;
 		}
 
 	private:
@@ -150,14 +369,33 @@ namespace net {
 		 * @param[in]  <unnamed>
 		 */
 		
-		osocketbuf(const osocketbuf&);
+		iosocketbuf(const iosocketbuf&);
 
 		/**
 		 * @brief      deleted assignment operator
 		 * @param[in]  <unnamed>
 		 */
 		
-		osocketbuf& operator = (const osocketbuf&);
+		iosocketbuf& operator = (const iosocketbuf&);
+
+	};
+
+	/**
+	 * the output socket buffer object, which cannot read
+	 * @extends  net::iosocketbuf
+	 */
+	
+	class osocketbuf : public iosocketbuf {
+	public:
+
+		/**
+		 * @brief      constructs an output socket buffer to wrap a socket file descriptor; can be used for regular files
+		 * @param[in]  sockfd   a file descriptor describing the connecting socket
+		 * @param[in]  bsize    total buffer size in bytes [default: 4096]
+		 */
+		
+		osocketbuf(int sockfd, size_t bsize = 4096): iosocketbuf(sockfd, 0, 0, bsize) {}
+
 	};
 
 	/**
@@ -180,9 +418,10 @@ namespace net {
 		/**
 		 * @brief      constructs an output socket stream to wrap a socket file descriptor; can be used for regular files
 		 * @param[in]  sockfd  a file descriptor describing the connecting socket
+		 * @param[in]  bsize   the number of bytes staged before they are written [default: 4096]
 		 */
 
-		osocketstream(int sockfd): buf(sockfd), ostream(0) {rdbuf(&buf);}
+		osocketstream(int sockfd, size_t bsize = 4096): buf(sockfd, bsize), ostream(0) {rdbuf(&buf);}
 
 	private:
 
@@ -204,41 +443,11 @@ namespace net {
 	};
 	
 	/**
-	 * the input socket buffer object
-	 * @extends  std::streambuf
+	 * the input socket buffer object, which writes without staging
+	 * @extends  net::iosocketbuf
 	 */
 	
-	class isocketbuf : public streambuf {
-
-	protected:
-
-		/**
-		 * socket file descriptor (sockfd)
-		 */
-		
-		int sockfd;
-
-		/**
-		 * putback size in bytes
-		 * consumes first part of the buffer
-		 * @see http://www.cplusplus.com/reference/istream/istream/putback/
-		 */
-		
-		const size_t pback;
-
-		/**
-		 * total buffer size in bytes
-		 * usable buffer length is (bsize - pback)
-		 */
-
-		const size_t bsize;
-
-		/**
-		 * input byte buffer used for putback and data input
-		 */
-
-		char* buffer;
-
+	class isocketbuf : public iosocketbuf {
 	public:
 
 		/**
@@ -248,65 +457,35 @@ namespace net {
 		 * @param[in]  bsize   total buffer size in bytes
 		 */
 
-		isocketbuf(int sockfd, size_t pback, size_t bsize):
-			sockfd(dup(sockfd)),
-			pback(pback),
-			bsize(bsize),
-			buffer(new char[bsize]) {
-			char* start = buffer + pback;
-			setg(start, start, start);
-		}
+		isocketbuf(int sockfd, size_t pback, size_t bsize): iosocketbuf(sockfd, pback, bsize, 0) {}
 
-		/**
-		 * @brief      destroys the buffer and destructs the input socket buffer object
-		 */
+	};
 
-		~isocketbuf() {
-			delete[] buffer;
-			::close(sockfd);
-		}
+	/**
+	 * the input socket stream object
+	 * @extends  std::istream
+	 */
+	
+	class isocketstream : public istream {
 
 	protected:
 
 		/**
-		 * @brief      controls putback and how data is received from the connecting socket
-		 * @return     a streambuf::int_type describing how much input was taken
+		 * The input socket buffer object wrapped by this stream
 		 */
-		
-		virtual int_type underflow() {
-
-			// check if there's still input in the buffer so we can return immediately
-			
-			if (gptr() < egptr())
-				return traits_type::to_int_type(*gptr());
 
-			// if not, refill the buffer's reserved space
-			// putback some characters if needed
-			
-			char* start = buffer + pback;
-			
-			int pbacks = gptr() - eback();
-			if (pbacks > pback)
-				pbacks = pback;
-
-			if (pbacks > 0)
-				memmove(start - pbacks, gptr() - pbacks, pbacks);
-
-			// fill the buffer with new data
-			// recv() will block itself until new data can be received
-			
-			int received = recv(sockfd, start, 1, 0);
+		isocketbuf buf;
 
-			// error: received < 0
-			// EOF:   received == 0 
-			
-			if (received <= 0) return traits_type::eof();
+	public:
 
-			// reupdate pointers
-			setg(start - pbacks, start, start + received);
-			return traits_type::to_int_type(*gptr());
+		/**
+		 * @brief      constructs an input socket stream to wrap a socket file descriptor; can be used for regular files
+		 * @param[in]  sockfd  a file descriptor describing the connecting socket
+		 * @param[in]  pback   the number of bytes allocated for putback()
+		 * @param[in]  bsize   the total number of bytes allocated for the buffer [default: 4096]
+		 */
 
-		}
+		isocketstream(int sockfd, size_t pback = 4, size_t bsize = 4096): buf(sockfd, pback, bsize), istream(0) {rdbuf(&buf);}
 
 	private:
 
@@ -316,60 +495,93 @@ namespace net {
 		 * @param[in]  <unnamed>
 		 */
 		
-		isocketbuf(const isocketbuf&);
+		isocketstream(const isocketstream&);
 
 		/**
 		 * @brief      deleted assignment operator
 		 * @param[in]  <unnamed>
 		 */
 		
-		isocketbuf& operator = (const isocketbuf&);
+		isocketstream& operator = (const isocketstream&);
 
 	};
 
 	/**
-	 * the input socket stream object
-	 * @extends  std::istream
+	 * the input/output socket stream object
+	 * @details  keeps an input stream and an output stream over one socket buffer, each with its own state, so one
+	 *           thread may read from in() while another writes to out(); the end of the input, e.g. after the peer
+	 *           calls shutdown(), does not stop the output
 	 */
-	
-	class isocketstream : public istream {
+
+	class iosocketstream {
 
 	protected:
 
 		/**
-		 * The input socket buffer object wrapped by this stream
+		 * The input/output socket buffer object shared by both streams
 		 */
 
-		isocketbuf buf;
+		iosocketbuf buf;
+
+		/**
+		 * The stream reading from the buffer
+		 */
+
+		istream input;
+
+		/**
+		 * The stream writing to the buffer
+		 */
+
+		ostream output;
 
 	public:
 
 		/**
-		 * @brief      constructs an input socket stream to wrap a socket file descriptor; can be used for regular files
+		 * @brief      constructs an input/output socket stream to wrap a socket file descriptor; can be used for regular files
 		 * @param[in]  sockfd  a file descriptor describing the connecting socket
-		 * @param[in]  pback   the number of bytes allocated for putback()
-		 * @param[in]  bsize   the total number of bytes allocated for the buffer
+		 * @param[in]  pback   the number of bytes allocated for putback() [default: 4]
+		 * @param[in]  bsize   the total number of bytes allocated for the input buffer [default: 4096]
+		 * @param[in]  psize   the number of bytes staged before they are written [default: 4096]
+		 */
+
+		iosocketstream(int sockfd, size_t pback = 4, size_t bsize = 4096, size_t psize = 4096):
+			buf(sockfd, pback, bsize, psize), input(&buf), output(&buf) {}
+
+		/**
+		 * @brief      gets the stream that reads from the socket
 		 */
 
-		isocketstream(int sockfd, size_t pback = 4, size_t bsize = 64): buf(sockfd, pback, bsize), istream(0) {rdbuf(&buf);}
+		inline istream& in() {
+			return input;
+		}
+
+		/**
+		 * @brief      gets the stream that writes to the socket
+		 */
+
+		inline ostream& out() {
+			return output;
+		}
 
 	private:
 
-		
 		/**
 		 * @brief      deleted copy constructor
 		 * @param[in]  <unnamed>
 		 */
 		
-		isocketstream(const isocketstream&);
+		iosocketstream(const iosocketstream&);
 
 		/**
 		 * @brief      deleted assignment operator
 		 * @param[in]  <unnamed>
 		 */
 		
-		isocketstream& operator = (const isocketstream&);
+		iosocketstream& operator = (const iosocketstream&);
 
 	};
 
-}
\ No newline at end of file
+}
+
+#endif /* __INCLUDE_NET_SOCKETSTREAM__ */
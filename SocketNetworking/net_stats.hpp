@@ -0,0 +1,388 @@
+/**
+ * Optional counters of the system calls made on every socket: the bytes
+ * moved in and out, the number of calls, the calls that moved fewer bytes
+ * than they asked for, the calls that would have blocked, the errors, and
+ * histograms of how long the reads and the writes took.
+ *
+ * The counters are only compiled in when NET_STATS is defined, e.g. with
+ * g++ -DNET_STATS. Otherwise every io_probe is an empty inline class that
+ * the compiler removes, and io_stats reports zeros, so instrumented code
+ * costs nothing when the counters are disabled.
+ *
+ * When enabled, the counters of a socket live in a lock-free table indexed
+ * by its file descriptor, laid out like the reference counts of
+ * net::socket, and are updated with relaxed atomic increments. They start
+ * over when the last net::socket of the file descriptor closes it. The
+ * totals of the process are kept as well, and are never reset.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_STATS__
+#define __INCLUDE_NET_STATS__
+
+#include <string>			// std::string
+#include <vector>			// std::vector
+#include <utility>			// std::pair
+#include <atomic>			// std::atomic
+#include <chrono>			// std::chrono::steady_clock
+#include <new>				// placement new
+#include <cstdlib>			// posix_memalign(), free()
+#include <cstdio>			// std::snprintf()
+#include <cerrno>			// errno
+#include <sys/types.h>		// ssize_t
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      a snapshot of the counters of a socket, or of every socket of the process
+	 */
+
+	struct socket_stats {
+
+		/**
+		 * the number of buckets of the time histograms; bucket i counts calls that took less than 2^i microseconds,
+		 * and the last one counts every call that took longer
+		 */
+
+		static const int TIME_BUCKETS = 20;
+
+		unsigned long bytes_in, bytes_out;
+		unsigned long reads, writes;				// the number of system calls
+		unsigned long short_reads, short_writes;	// calls that moved fewer bytes than they asked for
+		unsigned long would_block;					// calls that failed with EAGAIN
+		unsigned long errors;						// calls that failed otherwise, not counting EINTR
+		unsigned long read_time[TIME_BUCKETS];
+		unsigned long write_time[TIME_BUCKETS];
+
+		/**
+		 * @brief      constructs a snapshot with every counter at zero
+		 */
+
+		socket_stats(): bytes_in(0), bytes_out(0), reads(0), writes(0), short_reads(0), short_writes(0), would_block(0), errors(0) {
+			for (int i = 0; i < TIME_BUCKETS; ++i)
+				read_time[i] = write_time[i] = 0;
+		}
+
+		/**
+		 * @brief      checks if no call was counted
+		 */
+
+		inline bool empty() const {
+			return !reads && !writes;
+		}
+
+		/**
+		 * @brief      estimates a percentile of a time histogram
+		 * @param[in]  histogram  read_time or write_time
+		 * @param[in]  fraction   the percentile as a fraction, e.g. 0.99
+		 * @return     the upper bound in microseconds of the bucket that holds the percentile, or 0 if nothing was counted
+		 */
+
+		static unsigned long percentile(const unsigned long* histogram, double fraction) {
+			unsigned long count = 0, seen = 0;
+			for (int i = 0; i < TIME_BUCKETS; ++i)
+				count += histogram[i];
+			if (!count)
+				return 0;
+			for (int i = 0; i < TIME_BUCKETS; ++i)
+				if ((seen += histogram[i]) >= fraction * count)
+					return 1ul << i;
+			return 1ul << (TIME_BUCKETS - 1);
+		}
+
+		/**
+		 * @brief      describes the counters in a single line of key=value pairs
+		 */
+
+		string str() const {
+			char line[512];
+			snprintf(line, sizeof line,
+				"in=%lu out=%lu reads=%lu writes=%lu short_reads=%lu short_writes=%lu eagain=%lu errors=%lu "
+				"read_p50<%luus read_p99<%luus write_p50<%luus write_p99<%luus",
+				bytes_in, bytes_out, reads, writes, short_reads, short_writes, would_block, errors,
+				percentile(read_time, 0.5), percentile(read_time, 0.99), percentile(write_time, 0.5), percentile(write_time, 0.99));
+			return line;
+		}
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const int socket_stats::TIME_BUCKETS;
+
+	/**
+	 * @brief      the counters of every socket of the process, indexed by file descriptor
+	 */
+
+	class io_stats {
+	public:
+
+		/**
+		 * whether the counters were compiled in with NET_STATS
+		 */
+
+#ifdef NET_STATS
+		static const bool enabled = true;
+#else
+		static const bool enabled = false;
+#endif
+
+#ifdef NET_STATS
+	private:
+
+		/**
+		 * the positions of the counters in a block
+		 */
+
+		enum {
+			BYTES_IN, BYTES_OUT, READS, WRITES, SHORT_READS, SHORT_WRITES, WOULD_BLOCK, ERRORS,
+			READ_TIME, WRITE_TIME = READ_TIME + socket_stats::TIME_BUCKETS, COUNTERS = WRITE_TIME + socket_stats::TIME_BUCKETS
+		};
+
+		/**
+		 * the number of file descriptors in a single page, and the maximum number of pages
+		 */
+
+		static const size_t PAGE_SLOTS = 256;
+		static const size_t MAX_PAGES = 4096;
+
+		/**
+		 * @brief      the counters of a single socket
+		 */
+
+		struct block {
+			atomic<unsigned long> values[COUNTERS];
+		};
+
+		/**
+		 * @brief      a lazily allocated block of counters for consecutive file descriptors
+		 */
+
+		struct page {
+			block slots[PAGE_SLOTS];
+		};
+
+		/**
+		 * @brief      the page directory and the totals of the process
+		 */
+
+		struct table {
+			atomic<page*> pages[MAX_PAGES];
+			block totals;
+		};
+
+		/**
+		 * @brief      gets the process-wide table, which is zeroed before first use like any static object
+		 */
+
+		static table& counters() {
+			static table instance;
+			return instance;
+		}
+
+		/**
+		 * @brief      finds the counters of a file descriptor
+		 * @details    never throws nor changes errno, so that it can be called between a system call and its error check
+		 * @param[in]  fd      the file descriptor
+		 * @param[in]  create  whether the page holding the fd should be allocated if it does not exist yet
+		 * @return     the counters, or NULL if they do not exist and create was false, or if they cannot be allocated
+		 */
+
+		static block* find(int fd, bool create) {
+			size_t index = fd / PAGE_SLOTS;
+			if (fd < 0 || index >= MAX_PAGES)
+				return NULL;
+			page* p = counters().pages[index].load(memory_order_acquire);
+			if (p == NULL) {
+				if (!create) return NULL;
+				// allocate a zeroed page, then race to publish it
+				void* memory;
+				if (posix_memalign(&memory, 64, sizeof(page)) != 0)
+					return NULL;
+				page* fresh = static_cast<page*>(memory);
+				for (size_t i = 0; i < PAGE_SLOTS; ++i)
+					for (int j = 0; j < COUNTERS; ++j)
+						new (&fresh->slots[i].values[j]) atomic<unsigned long>(0);
+				if (counters().pages[index].compare_exchange_strong(p, fresh, memory_order_acq_rel))
+					p = fresh;
+				else
+					free(fresh); // another thread published first, p now holds its page
+			}
+			return &p->slots[fd % PAGE_SLOTS];
+		}
+
+		/**
+		 * @brief      adds to a counter of a socket and to the same counter of the totals
+		 */
+
+		static void add(block* socket, int counter, unsigned long amount = 1) {
+			if (socket)
+				socket->values[counter].fetch_add(amount, memory_order_relaxed);
+			counters().totals.values[counter].fetch_add(amount, memory_order_relaxed);
+		}
+
+		/**
+		 * @brief      copies a block of counters into a snapshot
+		 */
+
+		static socket_stats snapshot(const block& counters) {
+			socket_stats stats;
+			stats.bytes_in = counters.values[BYTES_IN].load(memory_order_relaxed);
+			stats.bytes_out = counters.values[BYTES_OUT].load(memory_order_relaxed);
+			stats.reads = counters.values[READS].load(memory_order_relaxed);
+			stats.writes = counters.values[WRITES].load(memory_order_relaxed);
+			stats.short_reads = counters.values[SHORT_READS].load(memory_order_relaxed);
+			stats.short_writes = counters.values[SHORT_WRITES].load(memory_order_relaxed);
+			stats.would_block = counters.values[WOULD_BLOCK].load(memory_order_relaxed);
+			stats.errors = counters.values[ERRORS].load(memory_order_relaxed);
+			for (int i = 0; i < socket_stats::TIME_BUCKETS; ++i) {
+				stats.read_time[i] = counters.values[READ_TIME + i].load(memory_order_relaxed);
+				stats.write_time[i] = counters.values[WRITE_TIME + i].load(memory_order_relaxed);
+			}
+			return stats;
+		}
+
+		/**
+		 * @brief      counts a single read or write call
+		 * @param[in]  fd       the file descriptor of the socket
+		 * @param[in]  write    whether the call was a write
+		 * @param[in]  asked    the number of bytes the call asked for
+		 * @param[in]  result   what the call returned, with errno set if it is negative
+		 * @param[in]  micros   how long the call took
+		 */
+
+		static void record(int fd, bool write, size_t asked, ssize_t result, unsigned long micros) {
+			block* socket = find(fd, true);
+			add(socket, write ? WRITES : READS);
+			if (result < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					add(socket, WOULD_BLOCK);
+				else if (errno != EINTR)
+					add(socket, ERRORS);
+			} else {
+				add(socket, write ? BYTES_OUT : BYTES_IN, result);
+				if ((size_t) result < asked)
+					add(socket, write ? SHORT_WRITES : SHORT_READS);
+			}
+			int bucket = 0;
+			while (bucket < socket_stats::TIME_BUCKETS - 1 && micros >= 1ul << bucket)
+				++bucket;
+			add(socket, (write ? WRITE_TIME : READ_TIME) + bucket);
+		}
+
+		friend class io_probe;
+
+	public:
+
+		/**
+		 * @brief      gets the counters of a socket since its file descriptor was opened
+		 * @param[in]  fd    the file descriptor of the socket
+		 */
+
+		static socket_stats of(int fd) {
+			block* socket = find(fd, false);
+			return socket ? snapshot(*socket) : socket_stats();
+		}
+
+		/**
+		 * @brief      gets the counters of every socket of the process since it started
+		 */
+
+		static socket_stats total() {
+			return snapshot(counters().totals);
+		}
+
+		/**
+		 * @brief      gets the counters of every open socket that made at least one call
+		 * @return     pairs of file descriptors and their counters, by increasing file descriptor
+		 */
+
+		static vector<pair<int, socket_stats> > active() {
+			vector<pair<int, socket_stats> > sockets;
+			for (size_t index = 0; index < MAX_PAGES; ++index) {
+				page* p = counters().pages[index].load(memory_order_acquire);
+				if (p == NULL) continue;
+				for (size_t i = 0; i < PAGE_SLOTS; ++i) {
+					socket_stats stats = snapshot(p->slots[i]);
+					if (!stats.empty())
+						sockets.push_back(make_pair((int) (index * PAGE_SLOTS + i), stats));
+				}
+			}
+			return sockets;
+		}
+
+		/**
+		 * @brief      sets the counters of a socket back to zero, e.g. when its file descriptor is closed
+		 * @param[in]  fd    the file descriptor of the socket
+		 */
+
+		static void reset(int fd) {
+			block* socket = find(fd, false);
+			if (socket)
+				for (int i = 0; i < COUNTERS; ++i)
+					socket->values[i].store(0, memory_order_relaxed);
+		}
+#else
+		static socket_stats of(int) {return socket_stats();}
+		static socket_stats total() {return socket_stats();}
+		static vector<pair<int, socket_stats> > active() {return vector<pair<int, socket_stats> >();}
+		static void reset(int) {}
+#endif
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const bool io_stats::enabled;
+
+	/**
+	 * @brief      times a single system call on a socket and counts it when it returns
+	 * @details    constructed right before the call; when NET_STATS is not defined it does nothing and takes no space
+	 */
+
+	class io_probe {
+#ifdef NET_STATS
+		chrono::steady_clock::time_point start;
+
+		unsigned long elapsed() const {
+			return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+		}
+
+	public:
+
+		io_probe(): start(chrono::steady_clock::now()) {}
+
+		/**
+		 * @brief      counts a read call
+		 * @param[in]  fd      the file descriptor of the socket
+		 * @param[in]  asked   the number of bytes the call asked for
+		 * @param[in]  result  what the call returned, with errno set if it is negative
+		 */
+
+		void received(int fd, size_t asked, ssize_t result) const {
+			io_stats::record(fd, false, asked, result, elapsed());
+		}
+
+		/**
+		 * @brief      counts a write call
+		 * @param[in]  fd      the file descriptor of the socket
+		 * @param[in]  asked   the number of bytes the call asked for
+		 * @param[in]  result  what the call returned, with errno set if it is negative
+		 */
+
+		void sent(int fd, size_t asked, ssize_t result) const {
+			io_stats::record(fd, true, asked, result, elapsed());
+		}
+#else
+	public:
+		inline void received(int, size_t, ssize_t) const {}
+		inline void sent(int, size_t, ssize_t) const {}
+#endif
+	};
+
+}
+
+#endif /* __INCLUDE_NET_STATS__ */
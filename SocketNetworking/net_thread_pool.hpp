@@ -0,0 +1,401 @@
+/**
+ * A work-stealing thread pool with one thread per core, for running the
+ * work of many sockets on a bounded number of threads instead of one
+ * std::thread per client.
+ *
+ * Every worker has its own deque of tasks. Tasks submitted from a worker
+ * go to the back of its own deque, and the worker takes its newest task
+ * first, while it is still in its cache. Tasks submitted from other
+ * threads, e.g. an event loop, go to a shared queue and are run in the
+ * order they were submitted. A worker whose deque is empty takes from the
+ * shared queue, then steals the oldest task of another worker before it
+ * goes to sleep, so a burst of work on one worker is shared with the idle
+ * ones.
+ *
+ * The pool measures how long each task waited in a deque before it ran,
+ * which thread_pool::stats() reports along with the number of tasks that
+ * were run and stolen.
+ *
+ * Tasks must not throw, and should not block for long: a task that waits
+ * on a socket holds one of the few threads of the pool while it waits.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_THREAD_POOL__
+#define __INCLUDE_NET_THREAD_POOL__
+
+#include <deque>				// std::deque
+#include <vector>				// std::vector
+#include <memory>				// std::unique_ptr
+#include <functional>			// std::function
+#include <thread>				// std::thread
+#include <mutex>				// std::mutex, std::lock_guard, std::unique_lock
+#include <condition_variable>	// std::condition_variable
+#include <atomic>				// std::atomic
+#include <chrono>				// std::chrono::steady_clock
+#include <utility>				// std::move(), std::pair
+#include <unistd.h>				// sysconf()
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      a fixed number of threads that run submitted tasks, stealing from each other when idle
+	 */
+
+	class thread_pool {
+	public:
+
+		/**
+		 * the type of the tasks run by the pool
+		 */
+
+		typedef function<void()> task;
+
+		/**
+		 * the number of buckets of the task latency histogram; bucket i counts latencies below 2^i microseconds
+		 */
+
+		static const int LATENCY_BUCKETS = 32;
+
+		/**
+		 * @brief      counters of the tasks run by the pool
+		 */
+
+		struct statistics {
+			unsigned long executed;		// the number of tasks run
+			unsigned long stolen;		// the number of tasks run by a worker other than the one they were queued on
+			double mean_latency;		// the mean number of microseconds a task waited before it ran
+			double max_latency;			// the longest number of microseconds a task waited before it ran
+			unsigned long histogram[LATENCY_BUCKETS];	// the number of tasks that waited less than 2^i microseconds, and more than half that
+
+			/**
+			 * @brief      estimates a percentile of the task latency from the histogram
+			 * @param[in]  fraction  the percentile as a fraction, e.g. 0.99
+			 * @return     an upper bound of the percentile in microseconds
+			 */
+
+			double percentile(double fraction) const {
+				unsigned long seen = 0;
+				for (int i = 0; i < LATENCY_BUCKETS; ++i)
+					if ((seen += histogram[i]) >= fraction * executed)
+						return (double) (1UL << i);
+				return max_latency;
+			}
+		};
+
+	private:
+
+		/**
+		 * @brief      a queued task, stamped with the time it was queued
+		 */
+
+		struct job {
+			task run;
+			chrono::steady_clock::time_point queued;
+		};
+
+		/**
+		 * @brief      the deque and counters of one thread of the pool
+		 * @details    the counters are only written by the worker itself, and are atomic so stats() can read them
+		 */
+
+		struct worker {
+			mutex lock;
+			deque<job> jobs;
+			thread runner;
+			atomic<unsigned long> executed;
+			atomic<unsigned long> stolen;
+			atomic<unsigned long> latency_total;	// in nanoseconds
+			atomic<unsigned long> latency_max;		// in nanoseconds
+			atomic<unsigned long> histogram[LATENCY_BUCKETS];
+			worker(): executed(0), stolen(0), latency_total(0), latency_max(0) {
+				for (int i = 0; i < LATENCY_BUCKETS; ++i)
+					histogram[i] = 0;
+			}
+		};
+
+		/**
+		 * the workers of the pool
+		 */
+
+		vector<unique_ptr<worker> > workers;
+
+		/**
+		 * the tasks submitted from outside of the pool, oldest first, guarded by inbox_lock
+		 */
+
+		deque<job> inbox;
+		mutex inbox_lock;
+
+		/**
+		 * the number of queued tasks that no worker has taken yet
+		 */
+
+		atomic<size_t> queued;
+
+		/**
+		 * the number of submitted tasks that have not finished yet
+		 */
+
+		atomic<size_t> unfinished;
+
+		/**
+		 * the number of workers waiting for tasks
+		 */
+
+		atomic<size_t> sleepers;
+
+		/**
+		 * whether the workers should exit once every task has run
+		 */
+
+		atomic<bool> stopping;
+
+		/**
+		 * guards sleeping and waking up workers, and waiting for the pool to be idle
+		 */
+
+		mutex sleep_lock;
+		condition_variable wakeup;
+		condition_variable idle;
+
+		/**
+		 * @brief      gets the pool and worker index of the calling thread, if it is a worker of a pool
+		 */
+
+		static pair<thread_pool*, size_t>& current() {
+			static thread_local pair<thread_pool*, size_t> self(NULL, 0);
+			return self;
+		}
+
+		/**
+		 * @brief      pops a queued task from one end of the deque of a worker
+		 * @param[in]  index   the index of the worker
+		 * @param[in]  newest  true to take the newest task, as the owner does, or false to take the oldest, as thieves do
+		 * @param      out     where to put the task
+		 * @return     true if a task was taken
+		 */
+
+		bool take(size_t index, bool newest, job& out) {
+			worker& self = *workers[index];
+			lock_guard<mutex> guard(self.lock);
+			return pop(self.jobs, newest, out);
+		}
+
+		/**
+		 * @brief      pops a queued task from one end of a deque, whose lock must be held
+		 * @param      jobs    the deque
+		 * @param[in]  newest  true to take the newest task, or false to take the oldest
+		 * @param      out     where to put the task
+		 * @return     true if a task was taken
+		 */
+
+		bool pop(deque<job>& jobs, bool newest, job& out) {
+			if (jobs.empty())
+				return false;
+			if (newest) {
+				out = std::move(jobs.back());
+				jobs.pop_back();
+			} else {
+				out = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			--queued;
+			return true;
+		}
+
+		/**
+		 * @brief      runs a task on a worker and records how long it waited
+		 * @param[in]  index   the index of the worker running the task
+		 * @param      next    the task
+		 * @param[in]  stolen  whether the task was taken from another worker
+		 */
+
+		void execute(size_t index, job& next, bool stolen) {
+			worker& self = *workers[index];
+			unsigned long waited = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - next.queued).count();
+			int bucket = 0;
+			while (bucket < LATENCY_BUCKETS - 1 && (1000UL << bucket) <= waited)
+				++bucket;
+			self.histogram[bucket].fetch_add(1, memory_order_relaxed);
+			self.latency_total.fetch_add(waited, memory_order_relaxed);
+			if (waited > self.latency_max.load(memory_order_relaxed))
+				self.latency_max.store(waited, memory_order_relaxed);
+			if (stolen)
+				self.stolen.fetch_add(1, memory_order_relaxed);
+			next.run();
+			next.run = task();
+			self.executed.fetch_add(1, memory_order_relaxed);
+			if (--unfinished == 0) {
+				lock_guard<mutex> guard(sleep_lock);
+				idle.notify_all();
+			}
+		}
+
+		/**
+		 * @brief      the loop of a worker: runs its own tasks, then shared ones, then steals, then sleeps until more tasks are queued
+		 * @param[in]  index  the index of the worker
+		 */
+
+		void work(size_t index) {
+			current() = make_pair(this, index);
+			job next;
+			while (true) {
+				if (take(index, true, next)) {
+					execute(index, next, false);
+					continue;
+				}
+				bool found;
+				{
+					lock_guard<mutex> guard(inbox_lock);
+					found = pop(inbox, false, next);
+				}
+				if (found) {
+					execute(index, next, false);
+					continue;
+				}
+				for (size_t i = 1; i < workers.size() && !found; ++i)
+					found = take((index + i) % workers.size(), false, next);
+				if (found) {
+					execute(index, next, true);
+					continue;
+				}
+				unique_lock<mutex> guard(sleep_lock);
+				++sleepers;
+				wakeup.wait(guard, [this] {return queued > 0 || stopping;});
+				--sleepers;
+				if (stopping && queued == 0)
+					return;
+			}
+		}
+
+	public:
+
+		/**
+		 * @brief      starts the threads of the pool
+		 * @param[in]  threads  the number of threads, or 0 for one per core [default: 0]
+		 */
+
+		explicit thread_pool(size_t threads = 0): queued(0), unfinished(0), sleepers(0), stopping(false) {
+			if (!threads) {
+				long cores = sysconf(_SC_NPROCESSORS_ONLN);
+				threads = cores < 1 ? 1 : cores;
+			}
+			for (size_t i = 0; i < threads; ++i)
+				workers.push_back(unique_ptr<worker>(new worker()));
+			for (size_t i = 0; i < threads; ++i)
+				workers[i]->runner = thread(&thread_pool::work, this, i);
+		}
+
+		/**
+		 * @brief      runs every queued task, then stops the threads of the pool
+		 */
+
+		~thread_pool() {
+			{
+				lock_guard<mutex> guard(sleep_lock);
+				stopping = true;
+				wakeup.notify_all();
+			}
+			for (size_t i = 0; i < workers.size(); ++i)
+				workers[i]->runner.join();
+		}
+
+		/**
+		 * @brief      queues a task to be run by one of the threads of the pool
+		 * @details    safe to call from any thread, including from a task
+		 * @param[in]  run   the task
+		 */
+
+		void submit(task run) {
+			job next = {std::move(run), chrono::steady_clock::now()};
+			pair<thread_pool*, size_t>& self = current();
+			++unfinished;
+			// count the task before it can be taken, so the count never goes below zero
+			++queued;
+			if (self.first == this) {
+				lock_guard<mutex> guard(workers[self.second]->lock);
+				workers[self.second]->jobs.push_back(std::move(next));
+			} else {
+				lock_guard<mutex> guard(inbox_lock);
+				inbox.push_back(std::move(next));
+			}
+			// only take the lock when a worker may be asleep
+			if (sleepers > 0) {
+				lock_guard<mutex> guard(sleep_lock);
+				wakeup.notify_one();
+			}
+		}
+
+		/**
+		 * @brief      waits until every submitted task has finished
+		 * @details    must not be called from a task
+		 */
+
+		void wait() {
+			unique_lock<mutex> guard(sleep_lock);
+			idle.wait(guard, [this] {return unfinished == 0;});
+		}
+
+		/**
+		 * @brief      gets the number of threads of the pool
+		 */
+
+		inline size_t size() const {
+			return workers.size();
+		}
+
+		/**
+		 * @brief      gets the counters of the tasks run so far
+		 */
+
+		statistics stats() const {
+			statistics total;
+			total.executed = total.stolen = 0;
+			unsigned long latency_total = 0, latency_max = 0;
+			for (int b = 0; b < LATENCY_BUCKETS; ++b)
+				total.histogram[b] = 0;
+			for (size_t i = 0; i < workers.size(); ++i) {
+				const worker& self = *workers[i];
+				total.executed += self.executed.load(memory_order_relaxed);
+				total.stolen += self.stolen.load(memory_order_relaxed);
+				latency_total += self.latency_total.load(memory_order_relaxed);
+				if (self.latency_max.load(memory_order_relaxed) > latency_max)
+					latency_max = self.latency_max.load(memory_order_relaxed);
+				for (int b = 0; b < LATENCY_BUCKETS; ++b)
+					total.histogram[b] += self.histogram[b].load(memory_order_relaxed);
+			}
+			total.mean_latency = total.executed ? latency_total / 1000.0 / total.executed : 0;
+			total.max_latency = latency_max / 1000.0;
+			return total;
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		thread_pool(const thread_pool&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		thread_pool& operator = (const thread_pool&);
+
+	};
+
+	// define the static constant so it can be used in the namespace
+	const int thread_pool::LATENCY_BUCKETS;
+
+}
+
+#endif /* __INCLUDE_NET_THREAD_POOL__ */
@@ -0,0 +1,381 @@
+/**
+ * A hierarchical timer wheel for the deadlines of many connections, such
+ * as heartbeats and idle timeouts, with constant-time scheduling and
+ * cancelling and no heap or sleeping thread per connection.
+ *
+ * Time advances in ticks of a fixed number of milliseconds. The wheel has
+ * LEVELS levels of SLOTS slots each: a timer that expires within SLOTS
+ * ticks goes in the slot of its tick on the first level, and later timers
+ * go on a higher level, in a slot that covers SLOTS times as many ticks as
+ * a slot of the level below. Every time the first level wraps around, the
+ * timers of the next slot of the level above are moved down, so each timer
+ * is moved at most LEVELS - 1 times before it expires.
+ *
+ * A timer is a list node owned by its user, e.g. a member of the state of
+ * a connection, so scheduling and cancelling it never allocates. A timer
+ * is cancelled when it is destroyed, and its callback may destroy it.
+ *
+ * The wheel owns a timerfd that becomes readable every tick, so it is
+ * driven by the event loop of the thread that owns it:
+ *
+ *     loop.add(wheel.fd(), [&wheel] {wheel.expire();});
+ *
+ * A timer_wheel, and every timer on it, must only be used by that thread.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_TIMER_WHEEL__
+#define __INCLUDE_NET_TIMER_WHEEL__
+
+#include <functional>		// std::function
+#include <chrono>			// std::chrono::steady_clock
+#include <stdint.h>			// uint64_t
+#include <unistd.h>			// close(), read()
+#include <sys/timerfd.h>	// timerfd_create(), timerfd_settime()
+#include "net_socket.hpp"	// net::socket_exception
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      schedules callbacks on the ticks of a fixed interval, with constant-time insertion and cancellation
+	 */
+
+	class timer_wheel {
+	public:
+
+		/**
+		 * the type of the callbacks run when a timer expires
+		 */
+
+		typedef function<void()> callback;
+
+		/**
+		 * the number of levels, and the number of slots per level as a power of two
+		 */
+
+		static const int LEVELS = 4;
+		static const int SLOT_BITS = 8;
+		static const int SLOTS = 1 << SLOT_BITS;
+
+		/**
+		 * the number of milliseconds per tick used by default
+		 */
+
+		static const unsigned DEFAULT_TICK = 100;
+
+	private:
+
+		/**
+		 * @brief      a node of a circular doubly linked list; a slot is the head of the list of its timers
+		 */
+
+		struct link {
+			link* prev;
+			link* next;
+			link(): prev(NULL), next(NULL) {}
+		};
+
+	public:
+
+		/**
+		 * @brief      a deadline that runs a callback when it expires, scheduled with timer_wheel::schedule()
+		 */
+
+		class timer : private link {
+			friend class timer_wheel;
+
+			/**
+			 * the tick at which this timer expires
+			 */
+
+			uint64_t expiry;
+
+		public:
+
+			/**
+			 * the callback run when this timer expires; may be changed while the timer is not pending
+			 */
+
+			callback action;
+
+			/**
+			 * @brief      constructs a timer that is not scheduled yet
+			 * @param[in]  action  the callback run when the timer expires [default: empty]
+			 */
+
+			explicit timer(callback action = callback()): expiry(0), action(action) {}
+
+			/**
+			 * @brief      cancels this timer if it is still pending
+			 */
+
+			~timer() {
+				cancel();
+			}
+
+			/**
+			 * @brief      checks if this timer is scheduled and has not expired yet
+			 */
+
+			inline bool pending() const {
+				return next != NULL;
+			}
+
+			/**
+			 * @brief      unschedules this timer, if it was pending
+			 */
+
+			void cancel() {
+				if (next) {
+					prev->next = next;
+					next->prev = prev;
+					prev = next = NULL;
+				}
+			}
+
+		private:
+
+			/**
+			 * @brief      deleted copy constructor
+			 * @param[in]  <unnamed>
+			 */
+
+			timer(const timer&);
+
+			/**
+			 * @brief      deleted assignment operator
+			 * @param[in]  <unnamed>
+			 */
+
+			timer& operator = (const timer&);
+
+		};
+
+	private:
+
+		/**
+		 * the heads of the lists of timers of every slot
+		 */
+
+		link slots[LEVELS][SLOTS];
+
+		/**
+		 * the next tick to be processed
+		 */
+
+		uint64_t current;
+
+		/**
+		 * the number of milliseconds per tick, and when the first tick started
+		 */
+
+		unsigned tick_ms;
+		chrono::steady_clock::time_point origin;
+
+		/**
+		 * the timerfd that becomes readable every tick
+		 */
+
+		int timerfd;
+
+		/**
+		 * @brief      appends a node to the end of a list
+		 */
+
+		static void append(link& head, link* node) {
+			node->prev = head.prev;
+			node->next = &head;
+			head.prev->next = node;
+			head.prev = node;
+		}
+
+		/**
+		 * @brief      puts a timer in the slot of its expiry, on the lowest level that reaches it
+		 */
+
+		void place(timer& t) {
+			uint64_t delta = t.expiry > current ? t.expiry - current : 0;
+			if (delta >> (LEVELS * SLOT_BITS)) {
+				// beyond the last level: expire as late as the wheel can reach, the callback can schedule the rest
+				delta = ((uint64_t) 1 << (LEVELS * SLOT_BITS)) - 1;
+				t.expiry = current + delta;
+			}
+			int level = 0;
+			while (delta >> ((level + 1) * SLOT_BITS))
+				++level;
+			uint64_t tick = delta ? t.expiry : current;
+			append(slots[level][(tick >> (level * SLOT_BITS)) & (SLOTS - 1)], &t);
+		}
+
+		/**
+		 * @brief      moves the timers of a slot of a higher level down to the levels below
+		 * @return     the index of the slot, which is 0 when the level above should cascade as well
+		 */
+
+		int cascade(int level) {
+			int index = (current >> (level * SLOT_BITS)) & (SLOTS - 1);
+			link& head = slots[level][index];
+			while (head.next != &head) {
+				timer* t = static_cast<timer*>(head.next);
+				t->cancel();
+				place(*t);
+			}
+			return index;
+		}
+
+	public:
+
+		/**
+		 * @brief      constructs an empty wheel whose ticks start now
+		 * @param[in]  tick_ms  the number of milliseconds per tick [default: DEFAULT_TICK]
+		 * @throw      a socket_exception if the timerfd cannot be created
+		 */
+
+		explicit timer_wheel(unsigned tick_ms = DEFAULT_TICK) NET_THROWS(socket_exception):
+			current(1),
+			tick_ms(tick_ms ? tick_ms : 1),
+			origin(chrono::steady_clock::now()),
+			timerfd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+			if (timerfd < 0)
+				throw socket_exception("timer_wheel::timer_wheel()");
+			for (int level = 0; level < LEVELS; ++level)
+				for (int i = 0; i < SLOTS; ++i)
+					slots[level][i].prev = slots[level][i].next = &slots[level][i];
+			struct itimerspec interval;
+			interval.it_interval.tv_sec = this->tick_ms / 1000;
+			interval.it_interval.tv_nsec = this->tick_ms % 1000 * 1000000L;
+			interval.it_value = interval.it_interval;
+			if (timerfd_settime(timerfd, 0, &interval, NULL) < 0) {
+				::close(timerfd);
+				throw socket_exception("timer_wheel::timer_wheel()");
+			}
+		}
+
+		/**
+		 * @brief      closes the timerfd, and leaves every pending timer unscheduled
+		 */
+
+		~timer_wheel() {
+			for (int level = 0; level < LEVELS; ++level)
+				for (int i = 0; i < SLOTS; ++i)
+					while (slots[level][i].next != &slots[level][i])
+						static_cast<timer*>(slots[level][i].next)->cancel();
+			::close(timerfd);
+		}
+
+		/**
+		 * @brief      gets the timerfd, which becomes readable every tick, to be watched by an event loop
+		 */
+
+		inline int fd() const {
+			return timerfd;
+		}
+
+		/**
+		 * @brief      gets the number of ticks processed so far
+		 */
+
+		inline uint64_t now() const {
+			return current - 1;
+		}
+
+		/**
+		 * @brief      gets the number of milliseconds per tick
+		 */
+
+		inline unsigned tick() const {
+			return tick_ms;
+		}
+
+		/**
+		 * @brief      schedules a timer, replacing its previous deadline if it was pending
+		 * @details    the delay is rounded up to whole ticks, and is at least one tick
+		 * @param      t             the timer, which must stay alive until it expires or is cancelled
+		 * @param[in]  milliseconds  how long from now the timer expires
+		 */
+
+		void schedule(timer& t, uint64_t milliseconds) {
+			uint64_t ticks = (milliseconds + tick_ms - 1) / tick_ms;
+			t.cancel();
+			t.expiry = now() + (ticks ? ticks : 1);
+			place(t);
+		}
+
+		/**
+		 * @brief      runs the callbacks of every timer that is due up to a certain tick
+		 * @details    a callback may schedule, cancel or destroy any timer, including its own
+		 * @param[in]  target  the last tick to process
+		 * @return     the number of timers that expired
+		 */
+
+		size_t advance(uint64_t target) {
+			size_t expired = 0;
+			while (current <= target) {
+				int index = current & (SLOTS - 1);
+				for (int level = 1; !index && level < LEVELS; ++level)
+					index = cascade(level);
+				// take the due timers out first, so that a callback rescheduling into the same slot waits a full turn
+				link due;
+				due.prev = due.next = &due;
+				link& head = slots[0][current & (SLOTS - 1)];
+				while (head.next != &head) {
+					link* node = head.next;
+					static_cast<timer*>(node)->cancel();
+					append(due, node);
+				}
+				++current;
+				while (due.next != &due) {
+					timer* t = static_cast<timer*>(due.next);
+					t->cancel();
+					callback action = t->action; // the timer may be destroyed by its own callback
+					if (action) action();
+					++expired;
+				}
+			}
+			return expired;
+		}
+
+		/**
+		 * @brief      runs the callbacks of every timer that is due by now; meant to be called when the timerfd is readable
+		 * @return     the number of timers that expired
+		 */
+
+		size_t expire() {
+			uint64_t count;
+			while (::read(timerfd, &count, sizeof count) > 0);
+			uint64_t elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - origin).count();
+			return advance(elapsed / tick_ms);
+		}
+
+	private:
+
+		/**
+		 * @brief      deleted copy constructor
+		 * @param[in]  <unnamed>
+		 */
+
+		timer_wheel(const timer_wheel&);
+
+		/**
+		 * @brief      deleted assignment operator
+		 * @param[in]  <unnamed>
+		 */
+
+		timer_wheel& operator = (const timer_wheel&);
+
+	};
+
+	// define the static constants so they can be used in the namespace
+	const int timer_wheel::LEVELS;
+	const int timer_wheel::SLOT_BITS;
+	const int timer_wheel::SLOTS;
+	const unsigned timer_wheel::DEFAULT_TICK;
+
+}
+
+#endif /* __INCLUDE_NET_TIMER_WHEEL__ */
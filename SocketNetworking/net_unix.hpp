@@ -0,0 +1,291 @@
+/**
+ * Unix domain stream sockets, for producers and consumers on the same host
+ * as their server. Their bytes are copied from one socket buffer to the
+ * other without going through the TCP stack, so there are no checksums,
+ * segments, acknowledgements or Nagle's algorithm to pay for.
+ *
+ * A net::unix_server binds to a path in the file system, or to an abstract
+ * name that starts with '@' and leaves no file behind. It accepts like a
+ * net::server, and a net::unix_client connects to the same path. Both
+ * extend their TCP counterparts, so every accepted socket, and every
+ * client, has the same send()/read() API and works with the event loop,
+ * the send queues and the socket streams.
+ *
+ * net::make_socket_pair() creates two connected clients with socketpair(),
+ * e.g. for a worker thread or a forked child, without a path at all.
+ *
+ * A unix_client can also pass an open file descriptor to the process on
+ * the other end with unix_client::send_fd(), which the other end takes
+ * with unix_client::read_fd(). The kernel installs a duplicate of the
+ * descriptor in the receiving process, so a listener can hand a connected
+ * socket, or an open file, to another process on the same host.
+ *
+ * @namespace  	net
+ * @author 		Rico Tiongson
+ * @package  	SocketNetworking
+ */
+
+#ifndef __INCLUDE_NET_UNIX__
+#define __INCLUDE_NET_UNIX__
+
+#include <cstring>			// std::memset(), std::memcpy()
+#include <cstddef>			// offsetof()
+#include <string>			// std::string
+#include <utility>			// std::pair, std::move()
+#include <unistd.h>			// unlink()
+#include <sys/stat.h>		// lstat(), S_ISSOCK()
+#include <sys/socket.h>		// socketpair(), sendmsg(), recvmsg(), SCM_RIGHTS
+#include <sys/uio.h>		// iovec
+#include <sys/un.h>			// sockaddr_un
+#include "net_server.hpp"	// net::server
+#include "net_client.hpp"	// net::client
+
+namespace net {
+
+	using namespace std;
+
+	/**
+	 * @brief      fills in the address of a Unix domain socket
+	 * @param[in]  path     the path of the socket file, or an abstract name that starts with '@'
+	 * @param      address  where to put the address
+	 * @throw      a socket_exception if the path is empty or too long
+	 * @return     the length of the address, to pass to bind() or connect()
+	 */
+
+	inline socklen_t unix_address(const string& path, sockaddr_un& address) NET_THROWS(socket_exception) {
+		if (path.empty() || path.size() >= sizeof address.sun_path) {
+			errno = path.empty() ? EINVAL : ENAMETOOLONG;
+			throw socket_exception("net::unix_address()");
+		}
+		memset(&address, 0, sizeof address);
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, path.data(), path.size());
+		if (path[0] != '@')
+			return offsetof(sockaddr_un, sun_path) + path.size() + 1;
+		// an abstract name starts with a '\0' instead, and its length is given by the address length alone
+		address.sun_path[0] = '\0';
+		return offsetof(sockaddr_un, sun_path) + path.size();
+	}
+
+	/**
+	 * @brief      a server socket bound to a path on the local host
+	 */
+
+	class unix_server : public server {
+	public:
+
+		/**
+		 * @brief      constructs an empty server socket
+		 */
+
+		unix_server() {}
+
+		/**
+		 * @brief      constructs a Unix domain server socket and binds it to a path
+		 * @details    calls socket(), bind(), and listen() in that order; a socket file that is left at the path by a
+		 *             server that did not unlink it is replaced, once connecting to it is refused; a socket that a
+		 *             server still listens on fails with EADDRINUSE, and any other file at the path makes bind() fail
+		 * @param[in]  path     the path of the socket file, or an abstract name that starts with '@'
+		 * @param[in]  maxconn  the backlog parameter on listen() [default: server::DEFAULT_MAXCONN]
+		 * @throw      a socket_exception if the server could not bind to the path or listen to connections
+		 */
+
+		explicit unix_server(const string& path, int maxconn = server::DEFAULT_MAXCONN) {
+			struct sockaddr_un address;
+			socklen_t length = unix_address(path, address);
+			socket::operator = (socket(::socket(AF_UNIX, SOCK_STREAM, 0)));
+			if (sockfd < 0)
+				throw socket_exception("unix_server::socket()");
+			accepts.reset(new atomic<unsigned long>(0));
+			// unlink the socket file of a previous server, like SO_REUSEADDR does for a port, but only once nothing
+			// listens on it anymore, so a second instance cannot take the path away from a running one
+			struct stat status;
+			if (path[0] != '@' && lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+				int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+				if (probe < 0)
+					throw socket_exception("unix_server::socket()");
+				bool stale = ::connect(probe, (sockaddr*) &address, length) < 0 && errno == ECONNREFUSED;
+				::close(probe);
+				if (!stale) {
+					errno = EADDRINUSE;
+					throw socket_exception("unix_server::bind()");
+				}
+				::unlink(path.c_str());
+			}
+			// bind to path
+			if (bind(sockfd, (sockaddr*) &address, length) < 0)
+				throw socket_exception("unix_server::bind()");
+			// listen to connections
+			if (listen(sockfd, maxconn) < 0)
+				throw socket_exception("unix_server::listen()");
+		}
+
+		/**
+		 * @brief      gets the path that this server socket is bound to, instead of the ip address of the host
+		 * @throw      a socket_exception if the socket cannot get its name
+		 * @return     the path of the socket file, or its abstract name with a leading '@'
+		 */
+
+		virtual const char* ip() const NET_THROWS(socket_exception) {
+			return socket::ip();
+		}
+
+	};
+
+	/**
+	 * @brief      a client socket of a Unix domain connection, which can also pass file descriptors
+	 */
+
+	class unix_client : public client {
+	public:
+
+		/**
+		 * @brief      constructs and wraps a file descriptor as a client socket
+		 * @details    does not call connect()
+		 * @param[in]  sockfd	a Unix domain socket file descriptor
+		 */
+
+		unix_client(int sockfd = -1): client(sockfd) {}
+
+		/**
+		 * @brief      constructs and wraps another socket as a client socket, e.g. one accepted by a unix_server
+		 * @details    does not call connect()
+		 * @param[in]  sock		another Unix domain socket
+		 */
+
+		unix_client(const socket& sock): client(sock) {}
+
+		/**
+		 * @brief      constructs a copy of another client socket, sharing its receive buffer
+		 * @param[in]  sock		a client socket of a Unix domain connection
+		 */
+
+		unix_client(const client& sock): client(sock) {}
+
+		/**
+		 * @brief      constructs a client socket by taking over another socket
+		 * @details    does not call connect(); the other socket is left empty
+		 * @param[in]  sock		the socket to move from
+		 */
+
+		unix_client(socket&& sock): client(std::move(sock)) {}
+
+		/**
+		 * @brief      constructs and connects a client socket to a unix_server
+		 * @param[in]  path     the path of the socket file, or an abstract name that starts with '@'
+		 * @throw      a socket_exception if the client cannot connect to the path
+		 */
+
+		explicit unix_client(const string& path): client(::socket(AF_UNIX, SOCK_STREAM, 0)) {
+			if (sockfd < 0)
+				throw socket_exception("unix_client::socket()");
+			struct sockaddr_un address;
+			socklen_t length = unix_address(path, address);
+			if (::connect(sockfd, (sockaddr*) &address, length) < 0)
+				throw socket_exception("unix_client::connect()");
+		}
+
+		/**
+		 * @brief      passes an open file descriptor to the process on the other end
+		 * @details    sends a single byte that carries the descriptor, to be taken with unix_client::read_fd(); the
+		 *             descriptor stays open in this process as well, and may be closed as soon as this returns
+		 * @param[in]  fd    the file descriptor to pass, e.g. a net::socket or an open file
+		 * @throw      a socket_exception if the descriptor could not be sent
+		 * @return     a reference to this client object
+		 */
+
+		unix_client& send_fd(int fd) NET_THROWS(socket_exception) {
+			char marker = '\0';
+			struct iovec data = {&marker, 1};
+			union {
+				struct cmsghdr header; // aligns the buffer for the header
+				char buffer[CMSG_SPACE(sizeof(int))];
+			} control;
+			memset(&control, 0, sizeof control);
+			struct msghdr message;
+			memset(&message, 0, sizeof message);
+			message.msg_iov = &data;
+			message.msg_iovlen = 1;
+			message.msg_control = control.buffer;
+			message.msg_controllen = sizeof control.buffer;
+			struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(header), &fd, sizeof fd);
+			io_probe probe;
+			ssize_t sent = ::sendmsg(sockfd, &message, MSG_NOSIGNAL);
+			probe.sent(sockfd, 1, sent);
+			if (sent < 0)
+				throw socket_exception("unix_client::send_fd()");
+			return *this;
+		}
+
+		/**
+		 * @brief      takes a file descriptor passed with unix_client::send_fd()
+		 * @details    closes this client socket if the connection was lost. The descriptor travels with a byte of its own,
+		 *             which the kernel drops along with the descriptor if a plain read takes it, so this client must read
+		 *             straight from the socket (see client::unbuffer()) and must not have read ahead of the descriptor.
+		 * @param      fd    set to the received file descriptor, which this process must close; -1 if the connection was lost
+		 * @throw      a socket_exception if there was an error in receiving, if this client is buffered, or if the next
+		 *             byte did not carry a file descriptor
+		 * @return     a reference to this client object, which can be used to detect if the connection was unexpectedly closed or not
+		 */
+
+		unix_client& read_fd(int& fd) NET_THROWS(socket_exception) {
+			fd = -1;
+			if (buffered() || available()) {
+				errno = EINVAL;
+				throw socket_exception("unix_client::read_fd()");
+			}
+			char marker;
+			struct iovec data = {&marker, 1};
+			union {
+				struct cmsghdr header; // aligns the buffer for the header
+				char buffer[CMSG_SPACE(sizeof(int))];
+			} control;
+			struct msghdr message;
+			memset(&message, 0, sizeof message);
+			message.msg_iov = &data;
+			message.msg_iovlen = 1;
+			message.msg_control = control.buffer;
+			message.msg_controllen = sizeof control.buffer;
+			io_probe probe;
+			ssize_t received = ::recvmsg(sockfd, &message, 0);
+			probe.received(sockfd, 1, received);
+			if (received < 0)
+				throw socket_exception("unix_client::read_fd()");
+			if (!received) {
+				close();
+				return *this;
+			}
+			for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+				if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && header->cmsg_len >= CMSG_LEN(sizeof(int)))
+					memcpy(&fd, CMSG_DATA(header), sizeof fd);
+			if (fd < 0) {
+				// a truncated control message means the descriptor was dropped, e.g. because this process has too many open
+				errno = message.msg_flags & MSG_CTRUNC ? EMFILE : EBADMSG;
+				throw socket_exception("unix_client::read_fd()");
+			}
+			return *this;
+		}
+
+	};
+
+	/**
+	 * @brief      creates two Unix domain sockets that are connected to each other, with socketpair()
+	 * @details    either end may be handed to another thread, or kept by a forked child while the parent keeps the other
+	 * @throw      a socket_exception if the sockets could not be created
+	 * @return     the two ends of the connection
+	 */
+
+	inline pair<unix_client, unix_client> make_socket_pair() NET_THROWS(socket_exception) {
+		int fds[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+			throw socket_exception("net::make_socket_pair()");
+		return make_pair(unix_client(fds[0]), unix_client(fds[1]));
+	}
+
+}
+
+#endif /* __INCLUDE_NET_UNIX__ */
@@ -0,0 +1,103 @@
+/**
+ * Receive a file from a client over several parallel connections, writing each stripe at its offset in the file.
+ * Compile with: g++ receiver.cpp -std=c++11 -pthread -o receiver
+ */
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "../net_server.hpp"
+#include "../net_client.hpp"
+#include "../net_file.hpp"
+#include "stripe.hpp"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+	// get arguments
+	if (argc < 3) {
+		printf("Some missing arguments\n");
+		printf("Format: %s <port> <filename>\n", argv[0]);
+		return 0;
+	}
+	char* port = argv[1];
+	char* filename = argv[2];
+	// open server for the streams of one sender
+	net::server server(atoi(port));
+	printf("Server is at %s:%s\n", server.ip(), port);
+	printf("Waiting for client...\n");
+	// the first stream tells how many more to expect
+	stripe_header first;
+	vector<net::client> clients;
+	vector<stripe_header> headers;
+	try {
+		net::client client = server.accept();
+		first = client.read<stripe_header>();
+		if (first.streams < 1 || first.streams > MAX_STREAMS || first.stripe < 1) {
+			printf("Invalid stripe header\n");
+			return EXIT_FAILURE;
+		}
+		// every index from 0 to streams - 1 must arrive exactly once, so each stream is kept at its own index
+		clients.resize(first.streams);
+		headers.resize(first.streams);
+		for (int i = 0; i < first.streams; ++i) {
+			if (i > 0)
+				client = server.accept();
+			stripe_header header = i ? client.read<stripe_header>() : first;
+			if (header.size != first.size || header.stripe != first.stripe || header.streams != first.streams) {
+				printf("Stream %d belongs to another transfer\n", i);
+				return EXIT_FAILURE;
+			}
+			if (header.index < 0 || header.index >= header.streams || clients[header.index]) {
+				printf("Stream %d has an invalid or duplicate index %d\n", i, (int) header.index);
+				return EXIT_FAILURE;
+			}
+			clients[header.index] = client;
+			headers[header.index] = header;
+		}
+	} catch (net::socket_exception& ex) {
+		printf("Could not read stripe header: %s\n", ex.what());
+		return EXIT_FAILURE;
+	}
+	printf("Receiving file (size=%.3fKB) over %d streams...\n", first.size / 1000.0, first.streams);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	try {
+		// preallocate the file once; every stream then maps its own stripes
+		net::mapped_file(filename, first.size);
+	} catch (net::socket_exception& ex) {
+		printf("Could not create file: %s\n", ex.what());
+		return EXIT_FAILURE;
+	}
+	vector<thread> threads;
+	vector<char> results(first.streams, false);
+	for (int i = 0; i < first.streams; ++i) {
+		threads.push_back(thread([&, i] {
+			net::client& client = clients[i];
+			const stripe_header& header = headers[i];
+			try {
+				net::mapped_file file(filename, header.size, false);
+				for (uint64_t k = header.index; k < stripe_count(header) && client; k += header.streams)
+					net::receive_file(client, file, k * header.stripe, stripe_length(header, k));
+				results[i] = client.good();
+			} catch (net::socket_exception& ex) {
+				printf("Stream %d failed: %s\n", i, ex.what());
+			}
+		}));
+	}
+	bool ok = true;
+	for (int i = 0; i < first.streams; ++i) {
+		threads[i].join();
+		ok = ok && results[i];
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	for (int i = 0; i < first.streams; ++i)
+		if (clients[i]) clients[i].send(ok);
+	if (!ok) {
+		printf("Receive failed\n");
+		return EXIT_FAILURE;
+	}
+	printf("Downloaded file to %s in %.3fs, %.2f MB/s aggregate\n", filename, seconds, first.size / seconds / 1e6);
+}
@@ -0,0 +1,87 @@
+/**
+ * Send a file to a server over several parallel connections, each one carrying every n-th stripe of the file.
+ * Compile with: g++ sender.cpp -std=c++11 -pthread -o sender
+ */
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>			// open()
+#include <sys/stat.h>		// fstat()
+#include "../net_client.hpp"
+#include "../net_pool.hpp"
+#include "stripe.hpp"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+	// get arguments
+	if (argc < 4) {
+		printf("Some missing arguments\n");
+		printf("Format: %s <host> <port> <filename> [streams=4] [stripe_kb=1024]\n", argv[0]);
+		return 0;
+	}
+	char* host = argv[1];
+	char* port = argv[2];
+	char* filename = argv[3];
+	int streams = argc > 4 ? atoi(argv[4]) : 4;
+	uint64_t stripe = (argc > 5 ? atoll(argv[5]) : 1024) * 1024;
+	if (streams < 1 || streams > MAX_STREAMS || stripe < 1) {
+		printf("The number of streams must be from 1 to %d, and the stripe size must be positive\n", (int) MAX_STREAMS);
+		return EXIT_FAILURE;
+	}
+	// retrieve file
+	int file = open(filename, O_RDONLY);
+	struct stat info;
+	if (file < 0 || fstat(file, &info) < 0) {
+		printf("File not found\n");
+		return EXIT_FAILURE;
+	}
+	// connect every stream to the server
+	vector<net::client> clients(streams);
+	net::backoff retry;
+	for (int i = 0; i < streams; ++i) {
+		while (!clients[i]) {
+			try {clients[i] = net::client(host, atoi(port), 5000);}
+			catch (net::socket_exception) {
+				printf("Cannot connect to \"%s:%s\". Attempting to reconnect...\n", host, port);
+				retry.wait();
+			}
+		}
+	}
+	printf("Uploading over %d streams of %llu KB stripes...\n", streams, (unsigned long long) stripe / 1024);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<thread> threads;
+	vector<char> results(streams, false);
+	for (int i = 0; i < streams; ++i) {
+		threads.push_back(thread([&, i] {
+			net::client& client = clients[i];
+			stripe_header header = {(uint64_t) info.st_size, stripe, streams, i};
+			try {
+				client.send(header);
+				// sendfile() takes its own offset, so every thread can share the file descriptor
+				for (uint64_t k = i; k < stripe_count(header) && client; k += streams)
+					client.send_file(file, k * stripe, stripe_length(header, k));
+				// receive a ping back that all is ok
+				results[i] = client.read<bool>();
+			} catch (net::socket_exception& ex) {
+				printf("Stream %d failed: %s\n", i, ex.what());
+			}
+		}));
+	}
+	bool ok = true;
+	for (int i = 0; i < streams; ++i) {
+		threads[i].join();
+		ok = ok && results[i];
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	close(file);
+	if (!ok) {
+		printf("An error occured in uploading %s (size=%lluB)\n", filename, (unsigned long long) info.st_size);
+		return EXIT_FAILURE;
+	}
+	printf("Uploaded %s (size=%.3fKB) in %.3fs, %.2f MB/s aggregate\n", filename, info.st_size / 1000.0, seconds, info.st_size / seconds / 1e6);
+}
@@ -0,0 +1,33 @@
+/**
+ * The header sent at the start of every connection of a striped file transfer.
+ * The file is cut into stripes of a fixed size, and stripe k is sent over
+ * connection (k % streams), in order, right after the header.
+ */
+
+#ifndef __INCLUDE_STRIPE__
+#define __INCLUDE_STRIPE__
+
+#include <stdint.h>
+
+struct stripe_header {
+	uint64_t size;		// the size of the whole file in bytes
+	uint64_t stripe;	// the size of each stripe in bytes; the last one may be shorter
+	int32_t streams;	// the number of parallel connections
+	int32_t index;		// the index of this connection, from 0 to streams - 1
+};
+
+// the largest number of parallel connections a receiver accepts for one transfer
+const int32_t MAX_STREAMS = 64;
+
+// gets the number of stripes in a file
+inline uint64_t stripe_count(const stripe_header& header) {
+	return (header.size + header.stripe - 1) / header.stripe;
+}
+
+// gets the number of bytes in a stripe
+inline uint64_t stripe_length(const stripe_header& header, uint64_t stripe) {
+	uint64_t offset = stripe * header.stripe;
+	return header.size - offset < header.stripe ? header.size - offset : header.stripe;
+}
+
+#endif /* __INCLUDE_STRIPE__ */
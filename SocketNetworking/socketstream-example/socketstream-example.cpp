@@ -1,53 +1,44 @@
-// a two-way server-client chat example using socket streams 
+// a two-way server-client chat example using socket streams
+// compile: g++ socketstream-example.cpp -std=c++11 -pthread [-DSERVER] -o <server|client>
 #include <iostream>					// std::cout, std::cin, std::getline(), std::endl, std::flush
-#include <unistd.h>					// fork()
+#include <thread>					// std::thread
+#include <sys/socket.h>				// shutdown()
 #include "../net_server.hpp"		// net::server, net::socket
 #include "../net_client.hpp"		// net::client, net::socket
-#include "../net_socketstream.hpp" 	// net::isocketstream, net::osocketstream
+#include "../net_socketstream.hpp" 	// net::iosocketstream
 
 using namespace std;
 
 int main() {
 #ifdef SERVER // compile with -DSERVER option
+	const char* me = "Server: ", * peer = "Client: ";
 	net::server server(4000);
 	cout << "Host: " << server.ip() << endl;
 	cout << "Port: " << server.port() << endl;
 	cout << "Accepting client..." << endl;
 	net::socket socket = server.accept();
 	cout << "Client " << socket.ip() << ":" << socket.port() << endl;
-	cout << "Server: " << flush;
-	if (fork()) {
-		net::isocketstream sockin(socket);
-		string message;
-		while (getline(sockin, message))
-			if (!message.empty())
-				cout << "\rClient: " << message << "\nServer: " << flush;
-	} else {
-		net::osocketstream sockout(socket);
-		string message;
-		while (getline(cin, message)) {
-			sockout << message << endl;
-			cout << "Server: " << flush;
-		}
-	}
 #else // CLIENT
+	const char* me = "Client: ", * peer = "Server: ";
 	cout << "Connecting to server..." << endl;
 	net::client socket("localhost", 4000);
 	cout << "Connect to server at " << socket.ip() << ":" << socket.port() << " has joined." << endl;
-	cout << "Client: " << flush;
-	if (fork()) {
-		net::isocketstream sockin(socket);
+#endif
+	// a single stream reads and writes the socket, one thread for each of its directions
+	net::iosocketstream sockio(socket);
+	cout << me << flush;
+	thread receiver([&] {
 		string message;
-		while (getline(sockin, message))
+		while (getline(sockio.in(), message))
 			if (!message.empty())
-				cout << "\rServer: " << message << "\nClient: " << flush;
-	} else {
-		net::osocketstream sockout(socket);
-		string message;
-		while (getline(cin, message)) {
-			sockout << message << endl;
-			cout << "Client: " << flush;
-		}
+				cout << "\r" << peer << message << "\n" << me << flush;
+	});
+	string message;
+	while (getline(cin, message)) {
+		sockio.out() << message << endl;
+		cout << me << flush;
 	}
-#endif
-}
\ No newline at end of file
+	// let the other side know that nothing more will be sent, then wait for it to finish
+	shutdown(socket, SHUT_WR);
+	receiver.join();
+}